@@ -14,13 +14,19 @@ def get_arguments() -> Namespace:
         ['-t', 'Current time in format: month-year.', str, None],
         ['-m', 'Magnitude to restrict BRIGHT table with.', float, None],
         ['-fov', 'Field-of-view restriction for strategy-specific relations.', float, None],
-        ['-table', 'Type of table to generate.', str,
-         ['HIP', 'ANGLE', 'DOT', 'SPHERE', 'PLANE', 'PYRAMID', 'COMPOSITE']
-         ],
-        ['-tablename', 'Name of the table to generate.', str, None]
+        ['-table', 'Comma-separated types of tables to generate.', str, None],
+        ['-tablename', 'Comma-separated names of the tables to generate.', str, None],
+        ['-index', 'Index to build for the multi-feature tables.', str, ['SQLITE', 'MEMORY', 'RTREE']]
     ]))
 
-    return parser.parse_args()
+    arguments = parser.parse_args()
+    table_types = ['HIP', 'ANGLE', 'DOT', 'SPHERE', 'PLANE', 'PYRAMID', 'COMPOSITE']
+    if any(t not in table_types for t in arguments.table.split(',')):
+        parser.error('-table entries must be in {}.'.format(table_types))
+    if len(arguments.table.split(',')) != len(arguments.tablename.split(',')):
+        parser.error('-table and -tablename must have the same number of entries.')
+
+    return arguments
 
 
 if __name__ == '__main__':
@@ -43,5 +49,6 @@ if __name__ == '__main__':
             str(arguments.m),
             str(arguments.fov),
             arguments.table,
-            arguments.tablename
+            arguments.tablename,
+            arguments.index if arguments.index is not None else 'SQLITE'
         ])
@@ -81,13 +81,23 @@ def get_arguments() -> Namespace:
         ['-esstep', 'Step size (of false positives) per iter.', int, None],
         ['-rmiter', 'Number of different false negative simulations.', int, None],
         ['-rmstep', 'Step size (of removed blobs) per iter.', int, None],
-        ['-rmsigma', 'Size of removed blob.', float, None]
+        ['-rmsigma', 'Size of removed blob.', float, None],
+        ['-index', 'Where to search the reference table (MEMORY = in-memory index, RTREE = R*Tree, if one exists).',
+         str, ['SQLITE', 'MEMORY', 'RTREE']
+         ],
+        ['-inmem', 'Copy the reference database into RAM before running (1 = yes, 0 = no).', int, [0, 1]],
+        ['-share', 'Share one catalog and in-memory index between all processes (1 = yes, 0 = no).', int, [0, 1]],
+        ['-threads', 'Number of threads to run the trials of each process on.', int, None],
+        ['-pin', 'Pin each thread to a CPU of its own (1 = yes, 0 = no).', int, [0, 1]],
+        ['-recfile', 'Append trials to a record file per process, and merge these at the end (1 = yes, 0 = no).',
+         int, [0, 1]],
+        ['-search', 'Number of threads to test the hypotheses of each identification on.', int, None]
     ]))
 
     return parser.parse_args()
 
 
-def execute_chunk(recdb, samples):
+def execute_chunk(recdb, recfile, samples):
     global arguments  # Must be run after retrieving the arguments in main!
 
     call([
@@ -118,13 +128,20 @@ def execute_chunk(recdb, samples):
         str(arguments.esstep),
         str(arguments.rmiter),
         str(arguments.rmstep),
-        str(arguments.rmsigma)
+        str(arguments.rmsigma),
+        arguments.index if arguments.index is not None else 'SQLITE',
+        str(arguments.inmem if arguments.inmem is not None else 0),
+        arguments.share_name,
+        str(arguments.threads if arguments.threads is not None else 1),
+        str(arguments.pin if arguments.pin is not None else 0),
+        recfile,
+        str(arguments.search if arguments.search is not None else 1)
     ])
 
 
 if __name__ == '__main__':
     from multiprocessing import Pool
-    from os import rename, remove
+    from os import rename, remove, getpid
     from os.path import abspath
     from subprocess import call
     from sqlite3 import connect
@@ -138,12 +155,10 @@ if __name__ == '__main__':
         arguments = get_arguments()
         simulations = round(arguments.samples / arguments.pnum)
 
-        # Execute in parallel.
-        Pool(arguments.pnum).starmap(execute_chunk, zip(
-            [arguments.recdb + f'-{i}' for i in range(arguments.pnum)], [simulations for _ in range(arguments.pnum)]
-        ))
+        # The first process to start publishes the shared catalog, and all others attach to it.
+        arguments.share_name = f'/hoku-{getpid()}' if arguments.share == 1 else '0'
 
-        # Resource collection.
+        # Resource collection. Each process either writes to a database of its own, or to a record file of its own.
         main_db = connect(arguments.recdb)
         main_cursor = main_db.cursor()
         main_cursor.execute(f"""
@@ -151,20 +166,43 @@ if __name__ == '__main__':
                 {SCHEMAS[arguments.exper]}
             );
         """)
-
-        for sec_db in list(map(lambda a: connect(a), [arguments.recdb + f'-{i}' for i in range(0, arguments.pnum)])):
-            sec_cursor = sec_db.cursor()
-            sec_records = sec_cursor.execute(f"""
-                SELECT *
-                FROM {arguments.etable}
-            """).fetchall()
-
-            for record in sec_records:
-                main_cursor.execute(f"""
-                    INSERT INTO {arguments.etable}
-                    VALUES ({PREPARED[arguments.exper]})
-                """, record)
-            sec_db.close()
-
         main_db.commit()
-        list(map(lambda a: remove(arguments.recdb + f'-{a}'), range(0, arguments.pnum)))
+
+        if arguments.recfile == 1:
+            rec_files = [arguments.recdb + f'-{i}.lj' for i in range(arguments.pnum)]
+            Pool(arguments.pnum).starmap(execute_chunk, zip(
+                [arguments.recdb for _ in range(arguments.pnum)], rec_files,
+                [simulations for _ in range(arguments.pnum)]
+            ))
+        else:
+            Pool(arguments.pnum).starmap(execute_chunk, zip(
+                [arguments.recdb + f'-{i}' for i in range(arguments.pnum)], ['0' for _ in range(arguments.pnum)],
+                [simulations for _ in range(arguments.pnum)]
+            ))
+        if arguments.share == 1 and Path('/dev/shm' + arguments.share_name).is_file():
+            remove('/dev/shm' + arguments.share_name)
+
+        # All record files are bulk-loaded in a single transaction.
+        if arguments.recfile == 1:
+            main_db.close()
+            call([abspath(__file__).replace('/perform-e.py', '') + '/../bin/MergeL', arguments.recdb] + rec_files)
+            list(map(lambda a: remove(a), rec_files))
+
+        else:
+            sec_names = [arguments.recdb + f'-{i}' for i in range(0, arguments.pnum)]
+            for sec_db in list(map(lambda a: connect(a), sec_names)):
+                sec_cursor = sec_db.cursor()
+                sec_records = sec_cursor.execute(f"""
+                    SELECT *
+                    FROM {arguments.etable}
+                """).fetchall()
+
+                for record in sec_records:
+                    main_cursor.execute(f"""
+                        INSERT INTO {arguments.etable}
+                        VALUES ({PREPARED[arguments.exper]})
+                    """, record)
+                sec_db.close()
+
+            main_db.commit()
+            list(map(lambda a: remove(arguments.recdb + f'-{a}'), range(0, arguments.pnum)))
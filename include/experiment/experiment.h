@@ -26,10 +26,22 @@ namespace Experiment {
         unsigned int samples, extra_star_min, extra_star_step, remove_star_step;
         unsigned int shift_star_iter, extra_star_iter, remove_star_iter;
         double shift_star_step, remove_star_sigma;
+
+        unsigned int n_threads = 1;
+        bool is_pinned = false;
+        unsigned int n_search_threads = 1;
     };
 
     class ParametersBuilder;
 
+    /// Runs the n-th trial of a worker, and returns the result to log.
+    using TrialFunction = std::function<Nibble::tuple_d (unsigned int n)>;
+
+    void run_trials (unsigned int n_trials, const std::shared_ptr<Lumberjack> &lu,
+                     const std::shared_ptr<Parameters> &ep,
+                     const std::function<TrialFunction (unsigned int w)> &worker);
+    void pin_to_cpu (unsigned int w);
+
     /// @brief Namespace that holds all parameters and functions to conduct the query experiment with.
     namespace Query {
         template<class T>
@@ -55,61 +67,82 @@ namespace Experiment {
         template<class T>
         void trial (const std::shared_ptr<Chomp> &ch, const std::shared_ptr<Lumberjack> &lu,
                     const std::shared_ptr<Experiment::Parameters> &ep) {
-            Benchmark be = Benchmark::Builder()
-                    .using_chomp(ch)
-                    .limited_by_m(ep->m_bar)
-                    .limited_by_n_stars(ep->n_limit)
-                    .limited_by_fov(ep->image_fov)
-                    .build();
-            std::shared_ptr<T> identifier = Identification::Builder<T>()
-                    .using_chomp(ch)
-                    .given_image(std::make_shared<Benchmark>(be))
-                    .using_epsilon_1(ep->epsilon_1)
-                    .using_epsilon_2(ep->epsilon_2)
-                    .using_epsilon_3(ep->epsilon_3)
-                    .using_epsilon_4(ep->epsilon_4)
-                    .limit_n_comparisons(ep->nu_limit)
-                    .identified_by(ep->identifier)
-                    .with_table(ep->reference_table)
-                    .build();
-            cxxtimer::Timer t(false);
-
             std::array<unsigned int, 3> iters = {ep->shift_star_iter, ep->extra_star_iter, ep->remove_star_iter};
             std::array<std::function<double(int j)>, 3> errors = {
                     [&] (int j) { return ((j == 0) ? 0 : j * ep->shift_star_step); },
                     [&] (int j) { return ep->extra_star_min + j * ep->extra_star_step; },
                     [&] (int j) { return ep->remove_star_step * j; }
             };
-            std::array<std::function<void(double e)>, 3> error_consumers = {
-                    [&] (double e) { be.shift_light(static_cast<signed>(be.get_image()->size()), e); },
-                    [&] (double e) { be.add_extra_light(static_cast<signed>(e)); },
-                    [&] (double e) { be.remove_light(static_cast<unsigned int>(e), ep->remove_star_sigma); }
-            };
 
+            // Enumerate every trial (the type of error i and its amount), in the order a single thread would run them.
+            std::vector<std::pair<int, double>> trials;
             for (int i = 0; i < 3; i++) {
                 for (unsigned int j = 0; j < iters[i]; j++) {
-                    double error = errors[i](j);
-
-                    for (unsigned int k = 0; k < ep->samples; k++) {
-                        std::cout << "[EXPERIMENT] Generating stars..." << std::endl;
-                        be.generate_stars(ch, Benchmark::NO_N, ep->m_bar);
-                        error_consumers[i](error);
-
-                        std::cout << "[EXPERIMENT] Performing identification." << std::endl;
-                        t.start(); // Perform a single trial. Record it's duration.
-                        Identification::StarsEither w = identifier->identify();
-                        t.stop();
-
-                        lu->log_trial({ep->epsilon_1, ep->epsilon_2, ep->epsilon_3, ep->epsilon_4,
-                                       (i == 0) ? error : 0.0, (i == 1) ? error : 0.0, (i == 2) ? error : 0.0,
-                                       static_cast<double>(identifier->get_nu()),
-                                       static_cast<double>(t.count()),
-                                       percentage_correct(w, *be.get_answers(), be.get_fov()),
-                                       (w.error == Identification::NO_CONFIDENT_A_EITHER) ? 1.0 : 0.0
-                        }), t.reset();
-                    }
+                    for (unsigned int k = 0; k < ep->samples; k++) trials.emplace_back(i, errors[i](j));
                 }
             }
+
+            // Each worker has its own image, identifier and timer. All share our catalog.
+            run_trials(static_cast<unsigned int>(trials.size()), lu, ep, [&] (unsigned int) -> TrialFunction {
+                // Our catalog is loaded by its first search, which happens as our first image is generated (here). The
+                // load time is carried over to the first trial of this worker.
+                auto load_time = std::make_shared<double>(ch->get_load_time());
+                auto be = std::make_shared<Benchmark>(
+                        Benchmark::Builder()
+                                .using_chomp(ch)
+                                .limited_by_m(ep->m_bar)
+                                .limited_by_n_stars(ep->n_limit)
+                                .limited_by_fov(ep->image_fov)
+                                .build());
+                std::shared_ptr<T> identifier = Identification::Builder<T>()
+                        .using_chomp(ch)
+                        .given_image(be)
+                        .using_epsilon_1(ep->epsilon_1)
+                        .using_epsilon_2(ep->epsilon_2)
+                        .using_epsilon_3(ep->epsilon_3)
+                        .using_epsilon_4(ep->epsilon_4)
+                        .limit_n_comparisons(ep->nu_limit)
+                        .identified_by(ep->identifier)
+                        .with_table(ep->reference_table)
+                        .searching_on_n_threads(ep->n_search_threads)
+                        .build();
+                auto t = std::make_shared<cxxtimer::Timer>(false);
+
+                return [&trials, ch, ep, be, identifier, t, load_time] (const unsigned int n) -> Nibble::tuple_d {
+                    const int i = trials[n].first;
+                    const double error = trials[n].second;
+                    HOKU_TRACE(VERBOSE, EXPERIMENT, "Generating stars...");
+                    be->generate_stars(ch, Benchmark::NO_N, ep->m_bar);
+                    if (i == 0) be->shift_light(static_cast<signed>(be->get_image()->size()), error);
+                    if (i == 1) be->add_extra_light(static_cast<signed>(error));
+                    if (i == 2) be->remove_light(static_cast<unsigned int>(error), ep->remove_star_sigma);
+
+                    // Catalog lookups and load times are only attributable to a trial if no other trial runs at once.
+                    // These are traced (and so only written between batches of trials), never printed from here.
+                    HOKU_TRACE(VERBOSE, EXPERIMENT, "Performing identification.");
+                    const unsigned long lookups = ch->get_hip_lookups();
+                    static_cast<void>(lookups);
+                    t->start(); // Perform a single trial. Record it's duration.
+                    Identification::StarsEither w = identifier->identify();
+                    t->stop();
+                    if (ep->n_threads == 1) {
+                        HOKU_TRACE(INFO, EXPERIMENT, "Catalog lookups: " << ch->get_hip_lookups() - lookups);
+                    }
+                    if (ep->n_threads == 1 && ch->get_load_time() > *load_time) {
+                        HOKU_TRACE(INFO, EXPERIMENT, "Catalog load time (ms): " << ch->get_load_time() - *load_time);
+                    }
+                    *load_time = ch->get_load_time();
+
+                    Nibble::tuple_d result = {ep->epsilon_1, ep->epsilon_2, ep->epsilon_3, ep->epsilon_4,
+                                              (i == 0) ? error : 0.0, (i == 1) ? error : 0.0, (i == 2) ? error : 0.0,
+                                              static_cast<double>(identifier->get_nu()),
+                                              static_cast<double>(t->count()),
+                                              percentage_correct(w, *be->get_answers(), be->get_fov()),
+                                              (w.error == Identification::NO_CONFIDENT_A_EITHER) ? 1.0 : 0.0};
+                    t->reset();
+                    return result;
+                };
+            });
         }
     }
 }
@@ -172,6 +205,14 @@ public:
         p.remove_star_step = step, p.remove_star_sigma = sigma;
         return *this;
     }
+    ParametersBuilder &running_on_n_threads (const unsigned int n, const bool is_pinned = false) {
+        p.n_threads = std::max(1u, n), p.is_pinned = is_pinned; // Pinned workers each run on a CPU of their own.
+        return *this;
+    }
+    ParametersBuilder &searching_on_n_threads (const unsigned int n) {
+        p.n_search_threads = std::max(1u, n); // Threads to test the hypotheses of a single identification on.
+        return *this;
+    }
     Parameters build () { return this->p; }
 
 private:
@@ -7,30 +7,102 @@
 #ifndef HOKU_LUMBERJACK_H
 #define HOKU_LUMBERJACK_H
 
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <thread>
+
 #include "storage/nibble.h"
 
 /// @brief Class used to log the results of all experiments.
 class Lumberjack : public Nibble {
 public:
     class Builder;
-    ~Lumberjack ();
 
     static int create_table (const std::string &database_path, const std::string &table_name,
                              const std::string &schema);
+    static int merge_records (const std::string &database_path, const std::vector<std::string> &record_paths);
     int log_trial (const tuple_d &result);
+    void flush ();
+
+    static const unsigned int DEFAULT_BATCH_SIZE;
+    static const unsigned int DEFAULT_FLUSH_INTERVAL_MS;
+    static const char RECORD_MAGIC[8];
+    static const uint32_t RECORD_VERSION;
 
 private:
-    int flush_buffer ();
-    static const unsigned long MAXIMUM_BUFFER_SIZE;
+    /// Fixed portion of a record file. This is followed by the trial table, identifier name and timestamp (each
+    /// RECORD_NAME_SIZE bytes), and then by n_values doubles for each trial.
+    struct RecordHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t byte_order;
+        uint32_t n_values;
+        uint32_t reserved;
+    };
+    static const unsigned int RECORD_NAME_SIZE;
+
+    /// @brief Background thread that writes our results to the database. Results are handed over through a lock-free
+    /// stack, and are committed in batches through a single prepared statement on a connection of its own. The writer
+    /// drains every result (and stops) once the last Lumberjack that holds it is destroyed. If a batch cannot be
+    /// written (for any reason other than a busy database), the error is kept and rethrown to our next caller.
+    class Writer {
+    public:
+        Writer (const std::string &database_name, const std::string &trial_table, const std::string &trial_fields,
+                unsigned int n_values, const std::string &identifier_name, const std::string &timestamp,
+                unsigned int batch_size, unsigned int flush_interval_ms);
+        ~Writer ();
+
+        void push (const tuple_d &result);
+        void flush ();
+        void rethrow_error ();
+
+    private:
+        struct Node {
+            tuple_d result;
+            Node *next;
+        };
+
+        void run ();
+        void write (const std::vector<tuple_d> &results);
+
+        std::shared_ptr<SQLite::Database> conn;
+        std::unique_ptr<SQLite::Statement> insert;
+        std::string identifier_name, timestamp;
+        unsigned int n_values, batch_size, flush_interval_ms;
+
+        std::atomic<Node *> pending{nullptr};
+        std::atomic<unsigned int> n_pending{0};
+        std::atomic<uint64_t> n_pushed{0};
+        std::atomic<bool> has_error{false};
+
+        // Everything below is guarded by wake_mutex. Results are counted as taken once written (or dropped after an
+        // error), so flush can wait for them.
+        std::mutex wake_mutex;
+        std::condition_variable wake, taken;
+        bool is_stopping = false;
+        unsigned int n_flushing = 0;
+        uint64_t n_taken = 0;
+        std::exception_ptr error;
+        bool is_error_reported = false;
+        std::thread thread;
+    };
+
     unsigned int expected_result_size;
-    std::vector<tuple_d> result_buffer;
+    std::shared_ptr<Writer> writer;
+    std::shared_ptr<std::ofstream> record_file;
 
     std::string trial_fields;
     std::string identifier_name;
     std::string timestamp;
 
     Lumberjack (const std::string &database_name, const std::string &trial_table, const std::string &prefix,
-                const std::string &timestamp);
+                const std::string &timestamp, unsigned int batch_size, unsigned int flush_interval_ms,
+                const std::string &record_path);
 };
 
 class Lumberjack::Builder {
@@ -51,13 +123,30 @@ public:
         this->at_time = tim;
         return *this;
     }
-    Lumberjack build () { return Lumberjack(database_name, trial_table, prefix, at_time); }
+    Builder &using_batch_size (unsigned int n) {
+        this->batch_size = n; // Number of results committed together.
+        return *this;
+    }
+    Builder &flushed_every (unsigned int ms) {
+        this->flush_interval_ms = ms; // Longest time a result waits before being written.
+        return *this;
+    }
+    Builder &appending_to_file (const std::string &path) {
+        this->record_path = path; // Trials are written here instead of the database, to be merged later.
+        return *this;
+    }
+    Lumberjack build () {
+        return Lumberjack(database_name, trial_table, prefix, at_time, batch_size, flush_interval_ms, record_path);
+    }
 
 private:
     std::string database_name;
     std::string trial_table;
     std::string prefix;
     std::string at_time;
+    unsigned int batch_size = DEFAULT_BATCH_SIZE;
+    unsigned int flush_interval_ms = DEFAULT_FLUSH_INTERVAL_MS;
+    std::string record_path;
 };
 
 
@@ -19,6 +19,8 @@ public:
     StarsEither identify () override;
 
     static int generate_table (const std::shared_ptr<Chomp> &ch, double fov, const std::string &table_name);
+    static int generate_tables (const std::shared_ptr<Chomp> &ch, const Neighborhood &nb,
+                                const std::vector<std::string> &table_names);
 
     static const int NO_CANDIDATE_PAIR_FOUND_EITHER;
     static const int NO_CANDIDATES_FOUND_EITHER;
@@ -33,9 +35,13 @@ private:
         int error = 0;
     };
 
-    LabelsEither query_for_pair (double theta);
+    static const std::array<std::string, 1> QUERY_FOCI;
+    static const std::string QUERY_LABELS;
+
+    const int *query_for_pair (double theta);
     PairsEither find_candidate_pair (const Star &b_i, const Star &b_j);
     StarsEither direct_match_test (const Star::list &big_p, const Star::list &r, const Star::list &b);
+    StarsEither identify_pair (unsigned int i, unsigned int j);
 };
 
 #endif /* HOKU_ANGLE_H */
\ No newline at end of file
@@ -42,8 +42,9 @@ protected:
     StarsEither e_reduction ();
     StarsEither e_identify ();
 
-    static int generate_triangle_table (const std::shared_ptr<Chomp> &ch, double fov, const std::string &table_name,
-                                        area_function compute_area, moment_function compute_moment);
+    static int generate_triangle_tables (const std::shared_ptr<Chomp> &ch, const Neighborhood &nb,
+                                         const std::vector<std::string> &table_names, area_function compute_area,
+                                         moment_function compute_moment);
 
     TrioVectorEither base_query_for_trios (const index_trio &c, area_function compute_area,
                                            moment_function compute_moment);
@@ -63,10 +64,15 @@ private:
         int error = 0;
     };
 
+    static const std::array<std::string, 2> QUERY_FOCI;
+    static const std::string QUERY_LABELS;
+
     void initialize_pivot (const index_trio & = {-1, -1, -1});
-    std::vector<labels_list> query_for_trio (double a, double i);
+    unsigned int query_for_trio (double a, double i);
+    const int *trio_labels (const std::shared_ptr<BucketIndex> &bi, unsigned int r) const;
     TriosEither pivot (const index_trio &);
     StarsEither direct_match_test (const Star::list &big_p, const Star::trio &r, const Star::trio &b);
+    StarsEither identify_trio (const index_trio &c);
 };
 
 #endif /* HOKU_BASE_TRIANGLE_H */
\ No newline at end of file
@@ -22,7 +22,11 @@ public:
     ~CompositePyramid () final = default;
 
 private:
-    labels_list_list query_for_trios (double, double);
+    static const std::array<std::string, 2> QUERY_FOCI;
+    static const std::string QUERY_LABELS;
+
+    unsigned int query_for_trios (double a, double i);
+    const int *trio_labels (const std::shared_ptr<BucketIndex> &bi, unsigned int r) const;
     bool verification (const Star::trio &r, const Star::trio &b) override;
     TriosEither find_catalog_stars (const Star::trio &) override;
 };
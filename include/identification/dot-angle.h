@@ -18,6 +18,8 @@ public:
     StarsEither identify () override;
 
     static int generate_table (const std::shared_ptr<Chomp> &ch, double fov, const std::string &table_name);
+    static int generate_tables (const std::shared_ptr<Chomp> &ch, const Neighborhood &nb,
+                                const std::vector<std::string> &table_names);
 
     static const int NO_CANDIDATE_TRIO_FOUND_EITHER;
     static const int NO_CANDIDATES_FOUND_EITHER;
@@ -31,9 +33,13 @@ private:
         int error = 0;
     };
 
+    static const std::array<std::string, 3> QUERY_FOCI;
+    static const std::string QUERY_LABELS;
+
     Star::trio find_closest (const Star &b_i);
-    LabelsEither query_for_trio (double theta_1, double theta_2, double phi);
+    const int *query_for_trio (double theta_1, double theta_2, double phi);
     TriosEither find_candidate_trio (const Star &b_i, const Star &b_j, const Star &b_c);
+    StarsEither identify_trio (const Star::trio &b);
 };
 
 /// Alias for the DotAngle class. 'Dot' distinguishes the process I am testing here enough from the 5 other methods.
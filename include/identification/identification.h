@@ -11,27 +11,41 @@
 
 #include <memory>
 #include <algorithm>
+#include <exception>
+#include <functional>
 
 #include "benchmark/benchmark.h"
 #include "storage/chomp.h"
 #include "math/rotation.h"
+#include "trace/trace.h"
 
 /// @brief Abstract base class for all identification procedures.
 class Identification {
 public:
     template<class T>
     class Builder;
+    class Overlay;
 
     using labels_list = std::vector<int>;
-    struct LabelsEither {
-        labels_list result;
-        int error = 0;
-    };
     struct StarsEither {
         Star::list result;
         int error = 0;
     };
 
+    /// @brief FOV-feasible pairs and trios of the BRIGHT catalog. These are enumerated once and shared between the
+    /// generators of every table family.
+    struct Neighborhood {
+        Star::list stars;
+        double fov = 0;
+
+        /// For each star i, the ascending indices of all stars after i that are within fov of i.
+        std::vector<std::vector<unsigned int>> near;
+
+        /// For each star i, every (j, k) where i < j < k and all three stars are within fov of each other. This is
+        /// empty if trios were not requested.
+        std::vector<std::vector<std::array<unsigned int, 2>>> trios;
+    };
+
     Identification (const std::shared_ptr<Benchmark> &be, const std::shared_ptr<Chomp> &ch, double epsilon_1,
                     double epsilon_2, double epsilon_3, double epsilon_4, unsigned int nu_max,
                     const std::string &identifier, const std::string &table_name);
@@ -43,6 +57,15 @@ public:
     virtual StarsEither identify () = 0;
 
     unsigned int get_nu ();
+    void given_image (const std::shared_ptr<Benchmark> &image);
+
+    template<class T>
+    static std::vector<StarsEither> identify_all (const Builder<T> &builder,
+                                                  const std::vector<std::shared_ptr<Benchmark>> &images,
+                                                  unsigned int n_threads = 0);
+
+    static Neighborhood find_neighborhood (const std::shared_ptr<Chomp> &ch, double fov, bool with_trios = true);
+    static Neighborhood find_neighborhood (const Star::list &stars, double fov, bool with_trios = true);
 
     static const int TABLE_ALREADY_EXISTS;
     static const int NO_CONFIDENT_A_EITHER;
@@ -56,8 +79,65 @@ protected:
     std::shared_ptr<Chomp> ch;
     unsigned int nu_max, nu;
 
-    static Star::list find_positive_overlay (const Star::list &big_i, const Star::list &big_p, const Rotation &q,
-                                             double epsilon);
+    /// Handle to our reference table. All SQLite searches of an identifier go through this, never through ch.
+    std::shared_ptr<Chomp::Handle> handle;
+
+    /// Buffer for the results of our catalog searches, reused between searches.
+    Nibble::Results big_r_results;
+
+    /// Buffer for the rows found by an in-memory index, reused between searches.
+    std::vector<unsigned int> big_r_rows;
+
+    /// Number of threads the hypotheses of one identify() call are tested on, and whether the result must be the one a
+    /// single thread would find. Identifiers that test on other threads are built with build_search_worker.
+    unsigned int n_search_threads = 1;
+    bool is_search_deterministic = true;
+    std::function<std::shared_ptr<Identification> ()> build_search_worker;
+    std::vector<std::shared_ptr<Identification>> search_workers;
+
+    /// Spatial hash of our image, built once per search and shared with our search workers.
+    std::shared_ptr<const Overlay> image_overlay;
+
+    StarsEither search (unsigned int n, const std::function<StarsEither (Identification &, unsigned int)> &test);
+    StarsEither search_hypotheses (unsigned int n,
+                                   const std::function<StarsEither (Identification &, unsigned int)> &test);
+
+    Star::list find_positive_overlay (const Star::list &big_p, const Rotation &q);
+
+    static std::vector<std::vector<unsigned int>> find_fov_neighbors (const Star::list &all_stars, double fov);
+    static unsigned int count_generation_threads ();
+    static void distribute_pivots (unsigned int n, unsigned int n_threads,
+                                   const std::function<void (unsigned int, unsigned int)> &work);
+    static void steal_work (unsigned int n, unsigned int n_threads,
+                            const std::function<void (unsigned int, unsigned int)> &work);
+    static int load_tables (const std::shared_ptr<Chomp> &ch, const std::vector<std::string> &table_names,
+                            const std::string &schema, const std::string &key, const std::string &fields,
+                            const std::function<Nibble::tuple_d ()> &build_rows);
+};
+
+/// @brief Spatial hash of the stars of an image, used to match rotated catalog stars against the image. Stars are
+/// bucketed by the cube (of width twice the chord of epsilon) they fall in, so any image star within epsilon of a
+/// point lies in at most 8 cubes around it. Each rotated star is thus compared to a handful of image stars (with a dot
+/// product against the cosine of epsilon), instead of all of them.
+class Identification::Overlay {
+public:
+    Overlay (const Star::list &big_i, double epsilon);
+
+    Star::list find_matches (const Star::list &big_p, const Rotation &q) const;
+
+private:
+    int find_first_within (const Vector3 &r) const;
+    unsigned int bucket_for (long long x, long long y, long long z) const;
+
+    Star::list big_i;
+    double cos_epsilon, chord, cell_width;
+    unsigned int n_buckets;
+
+    /// Members of bucket b are member[bucket_start[b]] through member[bucket_start[b + 1] - 1], in image order, with
+    /// their unit vectors stored alongside (x, y, z) in 'points'.
+    std::vector<unsigned int> bucket_start;
+    std::vector<unsigned int> member;
+    std::vector<double> points;
 };
 
 template<class T>
@@ -99,10 +179,22 @@ public:
         table_name = name; // Name of table in nibble database to use to query for candidates.
         return *this;
     }
+    Builder &searching_on_n_threads (unsigned int n, bool is_deterministic = true) {
+        n_search_threads = n; // Number of threads to test the hypotheses of one identify() call on.
+        is_search_deterministic = is_deterministic; // If true, return the match a single thread would find.
+        return *this;
+    }
     std::shared_ptr<T> build () {
-        return std::make_shared<T>(
+        std::shared_ptr<T> t = std::make_shared<T>(
                 be, ch, epsilon_1, epsilon_2, epsilon_3, epsilon_4, nu_max, identifier, table_name
         );
+        t->n_search_threads = n_search_threads, t->is_search_deterministic = is_search_deterministic;
+
+        // Identifiers that test our hypotheses on other threads are built the same way, and share our catalog.
+        Builder<T> worker = *this;
+        worker.n_search_threads = 1;
+        t->build_search_worker = [worker] () mutable -> std::shared_ptr<Identification> { return worker.build(); };
+        return t;
     }
 
 private:
@@ -111,6 +203,35 @@ private:
     std::shared_ptr<Benchmark> be;
     std::shared_ptr<Chomp> ch;
     unsigned int nu_max;
+    unsigned int n_search_threads = 1;
+    bool is_search_deterministic = true;
 };
 
+/// Identify every image in the given list, using n_threads threads (one per core if n_threads is 0). Each thread
+/// builds a single identifier from the given builder and reuses it (along with its search buffers and table handle)
+/// for every image it takes. All identifiers share the catalog of the builder.
+///
+/// @tparam T Identification method to use.
+/// @param builder Builder holding the catalog, epsilons and table of our identifiers. Its image is ignored.
+/// @param images Images to identify.
+/// @param n_threads Number of threads to identify our images with.
+/// @return The result of identify() for each image, in the order of images.
+template<class T>
+std::vector<Identification::StarsEither> Identification::identify_all (
+        const Builder<T> &builder, const std::vector<std::shared_ptr<Benchmark>> &images, unsigned int n_threads) {
+    const auto n = static_cast<unsigned int>(images.size());
+    n_threads = std::max(1u, std::min(n, (n_threads == 0) ? count_generation_threads() : n_threads));
+
+    std::vector<StarsEither> results(n);
+    std::vector<std::shared_ptr<T>> identifiers(n_threads);
+    steal_work(n, n_threads, [&] (const unsigned int i, const unsigned int t) -> void {
+        if (identifiers[t] == nullptr) identifiers[t] = Builder<T>(builder).given_image(images[i]).build();
+        else identifiers[t]->given_image(images[i]);
+
+        results[i] = identifiers[t]->identify();
+    });
+
+    return results;
+}
+
 #endif /* HOKU_IDENTIFICATION_H */
@@ -25,9 +25,6 @@ public:
     ~Pyramid () override = default;
 
 protected:
-    /// Alias for a list of catalog ID lists (STL vector of vectors of integers).
-    using labels_list_list = std::vector<labels_list>;
-
     static const int NO_CONFIDENT_R_FOUND_EITHER;
 
     struct TriosEither {
@@ -35,22 +32,30 @@ protected:
         int error = 0;
     };
 
-    Star::list common (const labels_list_list &big_r_ab_ell, const labels_list_list &big_r_ac_ell,
-                       const Star::list &removed);
+    /// Flat and sorted labels of our last three candidate sets, and the intersections between these. Each is reused
+    /// between searches, so our candidate sets are only allocated while they grow.
+    std::array<labels_list, 3> big_r_ell_flat;
+    labels_list big_i_ell, big_i_ell_2;
+
+    Star::list common (const labels_list &big_r_ab_ell, const labels_list &big_r_ac_ell, const Star::list &removed);
 
-    Star::list common (const labels_list_list &big_r_ae_ell, const labels_list_list &big_r_be_ell,
-                       const labels_list_list &big_r_ce_ell, const Star::list &removed);
+    Star::list common (const labels_list &big_r_ae_ell, const labels_list &big_r_be_ell,
+                       const labels_list &big_r_ce_ell, const Star::list &removed);
 
     virtual bool verification (const Star::trio &r, const Star::trio &b);
     virtual TriosEither find_catalog_stars (const Star::trio &);
 
     StarsEither identify_as_list (const Star::list &b);
+    StarsEither identify_trio (int i, int j, int k);
 
 private:
     /// Alias for a pair of catalog IDs (2-element STL array of integers).
     using label_pair = std::array<int, 2>;
 
-    labels_list_list query_for_pairs (double);
+    static const std::array<std::string, 1> QUERY_FOCI;
+    static const std::string QUERY_LABELS;
+
+    void query_for_pairs (double theta, labels_list &out_ell);
 };
 
 #endif /* HOKU_PYRAMID_H */
\ No newline at end of file
@@ -18,6 +18,8 @@ public:
     StarsEither identify () override;
 
     static int generate_table (const std::shared_ptr<Chomp> &ch, double fov, const std::string &table_name);
+    static int generate_tables (const std::shared_ptr<Chomp> &ch, const Neighborhood &nb,
+                                const std::vector<std::string> &table_names);
 
     static double spherical_area (const Vector3 &b_1, const Vector3 &b_2, const Vector3 &b_3);
     static double spherical_moment (const Vector3 &b_1, const Vector3 &b_2, const Vector3 &b_3);
@@ -14,8 +14,9 @@ namespace RandomDraw {
     double draw_real (double floor, double ceiling);
     double draw_normal (double mu, double sigma);
 
-    namespace { std::random_device seed; /* NOLINT(cert-err58-cpp) */ }
-    static std::mt19937_64 mersenne_twister(seed()); // NOLINT(cert-err58-cpp)
+    // Each thread draws from its own generator, so threads never race on the state of a shared one.
+    namespace { thread_local std::random_device seed; /* NOLINT(cert-err58-cpp) */ }
+    static thread_local std::mt19937_64 mersenne_twister(seed()); // NOLINT(cert-err58-cpp)
 }
 
 #endif /* HOKU_RANDOM_DRAW_H */
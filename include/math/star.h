@@ -10,6 +10,7 @@
 #include <array>
 #include <vector>
 #include <limits>
+#include <ostream>
 
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wpedantic"
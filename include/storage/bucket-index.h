@@ -0,0 +1,52 @@
+/// @file bucket-index.h
+/// @author Glenn Galvizo
+///
+/// Header file for BucketIndex class, which holds an in-memory index over two feature columns of a reference table
+/// (i.e. the a and i columns of the PLANE, SPHERE and COMPOSITE tables). Box searches cost O(1 + k log B) for k
+/// touched buckets of B rows, with no SQL parsing or row materialization involved.
+
+#ifndef HOKU_BUCKET_INDEX_H
+#define HOKU_BUCKET_INDEX_H
+
+#include <memory>
+#include <vector>
+
+#include "storage/k-vector.h"
+
+/// @brief Class for box searching two feature columns. Rows are sorted by their first feature and searched with a
+/// k-vector. Consecutive rows are grouped into buckets, and the rows of each bucket are kept sorted by their second
+/// feature.
+class BucketIndex {
+public:
+    BucketIndex (const std::vector<double> &y_1, const std::vector<double> &y_2, const std::vector<int> &ell,
+                 unsigned int stride, unsigned int bucket_size = DEFAULT_BUCKET_SIZE);
+    BucketIndex (const double *y_1, const double *y_2, const int *ell, unsigned int n, unsigned int stride,
+                 const std::shared_ptr<const void> &storage, unsigned int bucket_size = DEFAULT_BUCKET_SIZE);
+
+    unsigned int bound_query (double y_1a, double y_1b, double y_2a, double y_2b, std::vector<unsigned int> &out) const;
+
+    std::vector<Pantry::Shelf> shelves (const std::string &prefix) const;
+    static BucketIndex attach (const std::shared_ptr<const Pantry> &pantry, const std::string &prefix);
+
+    /// @return Pointer to the 'stride' labels attached to row r.
+    const int *labels (const unsigned int r) const { return kv.labels(r); }
+    unsigned int size () const { return kv.size(); }
+    unsigned int get_stride () const { return kv.get_stride(); }
+
+    static const unsigned int DEFAULT_BUCKET_SIZE;
+
+private:
+    BucketIndex (const KVector &kv, unsigned int bucket_size) : kv(kv), bucket_size(bucket_size) {}
+    void build (const double *y_2, unsigned int bucket_size);
+
+    KVector kv;
+    unsigned int bucket_size;
+
+    /// Second key and row of every row, sorted by the second key within each bucket. These live in bucket_storage when
+    /// we build them, and in a pantry when we attach to one.
+    std::shared_ptr<const void> bucket_storage;
+    const double *bucket_y_2;
+    const unsigned int *bucket_r;
+};
+
+#endif /* HOKU_BUCKET_INDEX_H */
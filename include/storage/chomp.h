@@ -8,41 +8,126 @@
 #ifndef HOKU_CHOMP_H
 #define HOKU_CHOMP_H
 
+#include <array>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <set>
+
 #include "storage/nibble.h"
+#include "storage/k-vector.h"
+#include "storage/bucket-index.h"
+#include "storage/feature-grid.h"
+#include "storage/crumb.h"
+#include "storage/sky-grid.h"
 
 /// @brief Class for accessing the Hipparcos catalog.
 class Chomp : public Nibble {
 public:
     class Builder;
+    class Handle;
     using Nibble::tuples_d;
 
+    struct StarEither {
+        Star result;
+        int error = 0;
+    };
+
 public:
     int generate_tables (const std::string &catalog_path, const std::string &current_time, double m_bright);
     Star::list bright_as_list ();
 
     Star query_hip (int label);
-    tuples_d simple_bound_query (const std::vector<std::string> &foci, const std::string &fields,
-                                 const std::vector<double> &y_a, const std::vector<double> &y_b,
-                                 unsigned int expected);
+    StarEither find_hip (int label);
+    unsigned long get_hip_lookups ();
+    double get_load_time ();
+    int simple_bound_query (const std::vector<std::string> &foci, const std::string &labels,
+                            const std::string &features, const std::vector<double> &y_a,
+                            const std::vector<double> &y_b, Results &out);
+    int rtree_bound_query (const std::vector<std::string> &foci, const std::string &labels,
+                           const std::string &features, const std::vector<double> &y_a,
+                           const std::vector<double> &y_b, Results &out);
+    std::shared_ptr<KVector> k_vector (const std::string &table);
+    std::shared_ptr<BucketIndex> bucket_index (const std::string &table);
+    std::shared_ptr<FeatureGrid> feature_grid (const std::string &table);
 
     Star::list nearby_bright_stars (const Vector3 &focus, double fov, unsigned int expected);
     Star::list nearby_hip_stars (const Vector3 &focus, double fov, unsigned int expected);
 
     static const int TABLE_EXISTS;
+    static const int NO_STAR_FOUND_EITHER;
 
 private:
-    Star::list all_bright_stars;
-    Star::list all_hip_stars;
+    /// @brief Our stars, label lookup and sky grids. Each is loaded or built with its first use, exactly once (by
+    /// whichever thread gets there first), and is shared between all copies and handles of this Chomp. Each star
+    /// catalog lives in its storage when we load it ourselves, and in a pantry when we attach to one.
+    struct Catalog {
+        std::once_flag bright_loaded, hip_loaded, bright_grid_built, hip_grid_built;
+
+        std::shared_ptr<const void> bright_storage;
+        std::shared_ptr<const void> hip_storage;
+        const Star *all_bright_stars = nullptr;
+        const Star *all_hip_stars = nullptr;
+        unsigned int n_bright = 0, n_hip = 0;
+        const int *hip_index = nullptr;
+        unsigned int n_hip_index = 0;
+
+        std::shared_ptr<SkyGrid> bright_grid;
+        std::shared_ptr<SkyGrid> hip_grid;
+
+        std::atomic<unsigned long> hip_lookups{0};
+        std::atomic<long long> load_ns{0};
+    };
+    std::shared_ptr<Catalog> catalog = std::make_shared<Catalog>();
+
     std::string bright_table;
     std::string hip_table;
+    std::map<std::string, std::shared_ptr<KVector>> k_vectors;
+    std::map<std::string, std::shared_ptr<BucketIndex>> bucket_indices;
+    std::map<std::string, std::shared_ptr<FeatureGrid>> feature_grids;
+    std::set<std::string> rtree_tables;
+
+    static const int NO_STAR_INDEX;
+
+    std::string bound_sql;
+    std::shared_ptr<const Pantry> pantry;
 
-    void load_all_stars ();
-    static std::array<double, 7> components_from_line (const std::string &entry, double y_t);
+    const Catalog &bright_catalog ();
+    const Catalog &hip_catalog ();
+    void load_bright_stars ();
+    void load_hip_stars ();
+    void load_stars (const std::string &table, Star::list &stars);
+    void load_stars_from_table (const std::string &table, Star::list &stars);
+    static void load_stars_from_crumb (const std::string &path, Star::list &stars);
+    bool is_crumb_current (const std::string &table);
+    void load_k_vector (const std::string &table);
+    void load_bucket_index (const std::string &table);
+    void load_feature_grid (const std::string &table);
+    std::vector<Pantry::Shelf> pantry_shelves ();
+    std::shared_ptr<const Pantry> attach_pantry (const std::string &name, const std::vector<std::string> &tables);
+    bool is_pantry_current (const Pantry &p, const std::vector<std::string> &tables);
+    static Star::list nearby_stars (const SkyGrid &grid, const Star *stars, const Vector3 &focus, double fov,
+                                    unsigned int expected);
+    int simple_bound_query (const std::string *foci, std::size_t n_foci, const std::string &labels,
+                            const std::string &features, const double *y_a, const double *y_b, Results &out);
+    int rtree_bound_query (const std::string *foci, std::size_t n_foci, const std::string &labels,
+                           const std::string &features, const double *y_a, const double *y_b, Results &out);
+
+    /// Fields of every parsable catalog row, column-major and in catalog order.
+    struct CatalogColumns {
+        std::vector<double> alpha, delta, pm_alpha, pm_delta, m, label;
+    };
+    static void parse_catalog (const char *begin, const char *end, CatalogColumns &c);
+    static bool parse_field (const char *line, std::size_t length, std::size_t offset, std::size_t width, double &out);
 
     static double year_difference (const std::string &current_time);
 
     Chomp (const std::string &database_name, const std::string &hip_name, const std::string &bright_name,
-           const std::string &catalog_path = "", const std::string &current_time = "", double m_bright = 0);
+           const std::string &catalog_path = "", const std::string &current_time = "", double m_bright = 0,
+           const std::vector<std::string> &k_vector_tables = {}, const std::vector<std::string> &rtree_tables = {},
+           const std::vector<std::string> &bucket_index_tables = {},
+           const std::vector<std::string> &feature_grid_tables = {}, bool in_memory = false,
+           const std::string &pantry_name = "");
 };
 
 class Chomp::Builder {
@@ -71,7 +156,34 @@ public:
         this->m_bright = m;
         return *this;
     }
-    Chomp build () { return Chomp(database_name, hip_name, bright_name, catalog_path, current_time, m_bright); }
+    Builder &using_k_vector (const std::string &table) {
+        this->k_vector_tables.push_back(table); // Pair table (label_a, label_b, theta) to index in memory.
+        return *this;
+    }
+    Builder &using_rtree (const std::string &table) {
+        this->rtree_tables.push_back(table); // Multi-feature table whose R*Tree should answer our bound queries.
+        return *this;
+    }
+    Builder &using_bucket_index (const std::string &table) {
+        this->bucket_index_tables.push_back(table); // Triangle table (labels, a, i) to index in memory.
+        return *this;
+    }
+    Builder &using_feature_grid (const std::string &table) {
+        this->feature_grid_tables.push_back(table); // Dot table (labels, theta_1, theta_2, phi) to index in memory.
+        return *this;
+    }
+    Builder &in_memory () {
+        this->is_in_memory = true; // Copy the database into RAM, and search this copy instead.
+        return *this;
+    }
+    Builder &using_shared_catalog (const std::string &name) {
+        this->pantry_name = name; // POSIX shared memory segment (i.e. "/hoku") to attach to, or publish to if absent.
+        return *this;
+    }
+    Chomp build () {
+        return Chomp(database_name, hip_name, bright_name, catalog_path, current_time, m_bright, k_vector_tables,
+                     rtree_tables, bucket_index_tables, feature_grid_tables, is_in_memory, pantry_name);
+    }
 
 private:
     std::string database_name;
@@ -79,7 +191,47 @@ private:
     std::string catalog_path;
     std::string bright_name;
     std::string hip_name;
+    std::vector<std::string> k_vector_tables;
+    std::vector<std::string> rtree_tables;
+    std::vector<std::string> bucket_index_tables;
+    std::vector<std::string> feature_grid_tables;
+    bool is_in_memory = false;
+    std::string pantry_name;
     double m_bright;
 };
 
+/// @brief Search handle bound to one table of a Chomp. A handle never changes its table, and searches through its own
+/// SQLite connection (opened with its first search), so handles on different threads can share one Chomp. The star
+/// catalogs and the in-memory indices of the Chomp are shared with the handle, not copied. A single handle must not be
+/// used by more than one thread at once.
+class Chomp::Handle {
+public:
+    Handle (const std::shared_ptr<Chomp> &ch, const std::string &table);
+    Handle (const Handle &) = delete;
+    Handle &operator= (const Handle &) = delete;
+
+    template<std::size_t N>
+    int bound_query (const std::array<std::string, N> &foci, const std::string &labels, const std::string &features,
+                     const std::array<double, N> &y_a, const std::array<double, N> &y_b, Results &out);
+    const std::string &get_table () const;
+
+private:
+    /// Copy of our Chomp, selected on our table. Its connection is replaced with our own before our first search.
+    Chomp reader;
+    bool is_connected = false;
+};
+
+/// Search our table for all rows whose foci lie between y_a and y_b, as Chomp::simple_bound_query does (through the
+/// R*Tree of our table if our Chomp was built with it). Our fields and bounds are fixed in size, so a search that hits
+/// our statement cache allocates nothing of its own.
+///
+/// @return The number of rows found. These are written to out.
+template<std::size_t N>
+int Chomp::Handle::bound_query (const std::array<std::string, N> &foci, const std::string &labels,
+                                const std::string &features, const std::array<double, N> &y_a,
+                                const std::array<double, N> &y_b, Results &out) {
+    if (!is_connected) reader.reconnect(), is_connected = true;
+    return reader.simple_bound_query(foci.data(), N, labels, features, y_a.data(), y_b.data(), out);
+}
+
 #endif /* HOKU_CHOMP_H */
@@ -0,0 +1,85 @@
+/// @file crumb.h
+/// @author Glenn Galvizo
+///
+/// Header file for Crumb class, which writes and memory-maps versioned binary images of the tables in a Nibble
+/// database. Mapping these files lets every process share the same read-only pages of the page cache, instead of each
+/// process materializing a private copy of a table through SQLite.
+
+#ifndef HOKU_CRUMB_H
+#define HOKU_CRUMB_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "storage/nibble.h"
+
+/// @brief Class for a read-only, memory-mapped binary image of a single Nibble table.
+///
+/// Columns with an integer type (labels) are packed row by row into one int32 block, so the labels of a row are
+/// adjacent. Columns with a floating point type (features) are stored one after another, each as a contiguous double
+/// array. Every block is aligned to ALIGNMENT bytes.
+class Crumb {
+public:
+    static std::shared_ptr<Crumb> open (const std::string &path);
+    static int write (Nibble &nb, const std::string &table, const std::string &path);
+    static std::string path_for (const std::string &database_name, const std::string &table);
+    static bool does_crumb_exist (const std::string &path);
+    static bool is_crumb_current (const std::string &path, uint64_t fingerprint);
+
+    Crumb (const Crumb &) = delete;
+    Crumb &operator= (const Crumb &) = delete;
+    ~Crumb ();
+
+    int label_column (const std::string &name) const;
+    int feature_column (const std::string &name) const;
+
+    /// @return Pointer to the n_labels labels of row r.
+    const int32_t *labels (const uint64_t r) const { return label_block + r * n_labels; }
+    const int32_t *labels () const { return label_block; }
+    const double *features (const unsigned int c) const { return feature_blocks[c]; }
+
+    uint64_t size () const { return n_rows; }
+    uint64_t get_fingerprint () const { return fingerprint; }
+    unsigned int get_n_labels () const { return n_labels; }
+    unsigned int get_n_features () const { return n_features; }
+
+    static const char MAGIC[8];
+    static const uint32_t VERSION;
+    static const uint32_t ALIGNMENT;
+    static const int NO_COLUMN_FOUND;
+
+private:
+    /// Fixed portion of the file. This is followed by one NAME_SIZE name per column (labels, then features). The
+    /// fingerprint is that of the source table (see Nibble::fingerprint) when the file was written.
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t byte_order;
+        uint32_t n_labels;
+        uint32_t n_features;
+        uint64_t n_rows;
+        uint64_t fingerprint;
+        uint64_t label_offset;
+        uint64_t feature_offset;
+        uint64_t feature_stride;
+    };
+    static const unsigned int NAME_SIZE;
+    static uint64_t align (uint64_t offset);
+    static bool is_layout_valid (const Header &h, uint64_t map_size);
+
+    explicit Crumb (const std::string &path);
+
+    void *map;
+    size_t map_size;
+
+    uint64_t n_rows, fingerprint;
+    unsigned int n_labels, n_features;
+    std::vector<std::string> label_names, feature_names;
+
+    const int32_t *label_block;
+    std::vector<const double *> feature_blocks;
+};
+
+#endif /* HOKU_CRUMB_H */
@@ -0,0 +1,60 @@
+/// @file feature-grid.h
+/// @author Glenn Galvizo
+///
+/// Header file for FeatureGrid class, which holds an in-memory uniform grid over three feature columns of a reference
+/// table (i.e. the theta_1, theta_2 and phi columns of the DOT table). Box searches only visit the few cells the box
+/// touches, with no SQL parsing or row materialization involved.
+
+#ifndef HOKU_FEATURE_GRID_H
+#define HOKU_FEATURE_GRID_H
+
+#include <array>
+#include <memory>
+#include <vector>
+
+#include "storage/pantry.h"
+
+/// @brief Class for box searching three feature columns. The bounding box of the features is split into a uniform
+/// grid, and the rows of each cell are stored contiguously (features and labels together) in cell order.
+class FeatureGrid {
+public:
+    FeatureGrid (const std::array<const double *, 3> &y, const int *ell, unsigned int n, unsigned int stride,
+                 unsigned int occupancy = DEFAULT_OCCUPANCY);
+
+    unsigned int bound_query (const std::array<double, 3> &y_a, const std::array<double, 3> &y_b,
+                              std::vector<unsigned int> &out) const;
+
+    std::vector<Pantry::Shelf> shelves (const std::string &prefix) const;
+    static FeatureGrid attach (const std::shared_ptr<const Pantry> &pantry, const std::string &prefix);
+
+    /// @return Pointer to the 'stride' labels attached to entry p (as returned by bound_query).
+    const int *labels (const unsigned int p) const { return &cell_ell[p * stride]; }
+
+    /// @return Row of the source table that entry p came from.
+    unsigned int row (const unsigned int p) const { return cell_row[p]; }
+    unsigned int size () const { return n; }
+    unsigned int get_stride () const { return stride; }
+    unsigned int get_n_cells () const { return n_cells[0] * n_cells[1] * n_cells[2]; }
+
+    static const unsigned int DEFAULT_OCCUPANCY;
+
+private:
+    FeatureGrid () = default;
+    unsigned int cell_of (unsigned int d, double y_d) const;
+
+    unsigned int n, stride;
+
+    /// Lower corner, cell width and number of cells along each feature.
+    std::array<double, 3> y_0, w;
+    std::array<unsigned int, 3> n_cells;
+
+    /// Entries of cell c are [cell_begin[c], cell_begin[c + 1]). Each entry holds its features, labels and row. These
+    /// live in cell_storage when we build them, and in a pantry when we attach to one.
+    std::shared_ptr<const void> cell_storage;
+    const unsigned int *cell_begin;
+    const std::array<double, 3> *cell_y;
+    const int *cell_ell;
+    const unsigned int *cell_row;
+};
+
+#endif /* HOKU_FEATURE_GRID_H */
@@ -0,0 +1,55 @@
+/// @file k-vector.h
+/// @author Glenn Galvizo
+///
+/// Header file for KVector class, which holds an in-memory k-vector index over a single sorted feature column of a
+/// reference table (i.e. the theta column of the ANGLE and PYRAMID tables). Range searches cost O(1 + k), with no
+/// SQL parsing or row materialization involved.
+
+#ifndef HOKU_K_VECTOR_H
+#define HOKU_K_VECTOR_H
+
+#include <memory>
+#include <vector>
+
+#include "storage/pantry.h"
+
+/// @brief Class for range searching a sorted feature column with the k-vector technique (Mortari and Neta).
+class KVector {
+public:
+    /// Half-open interval [begin, end) of rows whose key lies between the bounds of a search.
+    struct Range {
+        unsigned int begin = 0;
+        unsigned int end = 0;
+    };
+
+    KVector (const std::vector<double> &y, const std::vector<int> &ell, unsigned int stride);
+    KVector (const double *y, const int *ell, unsigned int n, unsigned int stride,
+             const std::shared_ptr<const void> &storage);
+
+    Range bound_query (double y_a, double y_b) const;
+
+    std::vector<Pantry::Shelf> shelves (const std::string &prefix) const;
+    static KVector attach (const std::shared_ptr<const Pantry> &pantry, const std::string &prefix);
+
+    /// @return Pointer to the 'stride' labels attached to row r.
+    const int *labels (const unsigned int r) const { return &ell[r * stride]; }
+    double key (const unsigned int r) const { return y[r]; }
+    unsigned int size () const { return n; }
+    unsigned int get_stride () const { return stride; }
+
+private:
+    KVector () = default;
+    void build ();
+
+    std::shared_ptr<const void> storage;
+    const double *y;
+    const int *ell;
+    unsigned int n, stride;
+
+    /// Our k-vector lives in k_storage when we build it, and in the storage of our keys when we attach to a pantry.
+    std::shared_ptr<const void> k_storage;
+    const unsigned int *k;
+    double m, q;
+};
+
+#endif /* HOKU_K_VECTOR_H */
@@ -7,6 +7,8 @@
 #ifndef HOKU_NIBBLE_H
 #define HOKU_NIBBLE_H
 
+#include <cstdint>
+#include <map>
 #include <memory>
 #include "third-party/sqlite-cpp/SQLiteCpp.h"
 
@@ -24,26 +26,60 @@ public:
         int error;
     };
 
+    /// @brief Reusable buffer of query results. Labels are stored as ints and features as doubles, each row-major with
+    /// a fixed stride. Refilling a buffer keeps its capacity, so steady-state searches do not allocate.
+    struct Results {
+        std::vector<int> ell;
+        std::vector<double> y;
+        unsigned int n_labels = 0, n_features = 0, n_rows = 0;
+
+        /// @return Pointer to the n_labels labels of row r.
+        const int *labels (const unsigned int r) const { return ell.data() + r * n_labels; }
+
+        /// @return Pointer to the n_features features of row r.
+        const double *features (const unsigned int r) const { return y.data() + r * n_features; }
+        unsigned int size () const { return n_rows; }
+        bool empty () const { return n_rows == 0; }
+    };
+
     std::shared_ptr<SQLite::Database> conn; // This must be public to work with SQLiteCpp library.
 
 public:
-    explicit Nibble (const std::string &database_name);
+    explicit Nibble (const std::string &database_name, bool in_memory = false);
 
     tuples_d search_table (const std::string &fields, unsigned int expected);
     tuples_d search_table (const std::string &fields, const std::string &constraint, unsigned int expected);
+    tuples_d search_table (const std::string &fields, const std::string &constraint, const tuple_d &values,
+                           unsigned int expected);
+    int search_table (const std::string &labels, const std::string &features, const std::string &constraint,
+                      const tuple_d &values, Results &out);
     Either search_single (const std::string &fields, const std::string &constraint = "");
+    Either search_single (const std::string &fields, const std::string &constraint, const tuple_d &values);
 
     void select_table (const std::string &table);
     bool does_table_exist (const std::string &table);
     int create_table (const std::string &table, const std::string &schema);
+    int create_table (const std::string &table, const std::string &schema, const std::string &key);
+    int bulk_insert_into_table (const std::string &fields, const tuple_d &rows);
+    uint64_t fingerprint (const std::string &table);
 
     int find_attributes (std::string &schema, std::string &fields);
     int sort_and_index (const std::string &focus);
+    int index_table (const std::string &focus);
+    int index_rtree (const std::string &labels, const std::string &features);
 
     static const int TABLE_NOT_CREATED_RET;
     static const int NO_RESULT_FOUND_EITHER;
+    static const unsigned int STATEMENT_CACHE_LIMIT;
+    static const unsigned int BULK_BATCH_SIZE;
+    static const std::string RTREE_SUFFIX;
+    static const std::string RTREE_ROWS_SUFFIX;
+    static const std::string GENERATION_TABLE;
 
 public:
+    /// Insert a single row into the current table. Our table is stamped with a new generation (see fingerprint), so
+    /// prefer bulk_insert_into_table for more than a handful of rows.
+    ///
     /// @tparam T Type of input vector. Should be tuple_i or tuple_d.
     template<typename T>
     int insert_into_table (const std::string &fields, const T &in_values) {
@@ -55,17 +91,39 @@ public:
         sql.append("?)");
 
         // Bind all the fields to the in values.
-        SQLite::Statement query(*conn, sql);
+        std::shared_ptr<SQLite::Statement> query = prepare(sql);
         for (unsigned int i = 0; i < in_values.size(); i++) {
-            query.bind(i + 1, in_values[i]);
+            query->bind(i + 1, in_values[i]);
         }
-        query.exec();
+        query->exec(), query->reset();
+        stamp_generation(current_table);
 
         return 0;
     }
 
 protected:
+    std::shared_ptr<SQLite::Statement> prepare (const std::string &sql);
+    void reconnect ();
+    static unsigned int count_fields (const std::string &fields);
+    static std::vector<std::string> split_fields (const std::string &fields);
+    static void fetch_results (SQLite::Statement &query, unsigned int n_labels, unsigned int n_features,
+                               Results &out);
+    void stamp_generation (const std::string &table);
+
     std::string current_table;
+
+    /// Location of our database on disk. Our connection may instead be to an in-memory copy of it.
+    std::string database_name;
+    bool is_in_memory;
+
+    /// URI of our in-memory copy, if we have one. Every copy of this Nibble (and their connections) shares this copy.
+    std::string memory_uri;
+
+private:
+    void connect_to_memory_copy ();
+
+    /// Prepared statements of our connection, keyed by their SQL. Shared between all copies of this Nibble.
+    std::shared_ptr<std::map<std::string, std::shared_ptr<SQLite::Statement>>> statements;
 };
 
 #endif /* HOKU_NIBBLE_H */
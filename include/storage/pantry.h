@@ -0,0 +1,102 @@
+/// @file pantry.h
+/// @author Glenn Galvizo
+///
+/// Header file for Pantry class, which publishes and attaches to a named, read-only POSIX shared memory segment. A
+/// segment holds the star catalog and the in-memory reference indices of a Chomp, so every process on a machine can
+/// share one copy of them instead of each building its own.
+
+#ifndef HOKU_PANTRY_H
+#define HOKU_PANTRY_H
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/// @brief Class for a named POSIX shared memory segment of shelves (named, aligned byte arrays).
+///
+/// The segment starts with a header and a directory of its shelves. The header's 'ready' flag is set only after every
+/// shelf has been written, so processes that attach while the segment is being published wait for it instead of
+/// reading a partial segment.
+class Pantry {
+public:
+    /// Named array to publish. The data is copied into the segment by publish, and is kept alive until then by owner
+    /// (if the shelf owns its data).
+    struct Shelf {
+        std::string name;
+        const void *data;
+        uint64_t size;
+        std::shared_ptr<const void> owner;
+    };
+
+    static std::shared_ptr<Pantry> open (const std::string &name);
+    static int publish (const std::string &name, const std::vector<Shelf> &shelves);
+    static int remove (const std::string &name);
+
+    Pantry (const Pantry &) = delete;
+    Pantry &operator= (const Pantry &) = delete;
+    ~Pantry ();
+
+    bool has_shelf (const std::string &shelf) const { return directory.find(shelf) != directory.end(); }
+
+    /// @return Shelf for n elements of type T, which start at data.
+    template<typename T>
+    static Shelf shelf_of (const std::string &name, const T *data, const uint64_t n) {
+        return Shelf{name, data, sizeof(T) * n, nullptr};
+    }
+
+    /// @return Shelf that owns a copy of the given values.
+    template<typename T>
+    static Shelf shelf_of (const std::string &name, const std::vector<T> &values) {
+        auto owner = std::make_shared<std::vector<T>>(values);
+        return Shelf{name, owner->data(), sizeof(T) * owner->size(), owner};
+    }
+
+    /// @return Pointer to the elements of the given shelf, and the number of these in n. Throws if no such shelf
+    /// exists, or if its size is not a multiple of the size of T.
+    template<typename T>
+    const T *shelf (const std::string &shelf, uint64_t &n) const {
+        auto s = directory.find(shelf);
+        if (s == directory.end() || s->second.second % sizeof(T) != 0) {
+            throw std::runtime_error(std::string("Shelf " + shelf + " does not exist in pantry " + name + "."));
+        }
+        n = s->second.second / sizeof(T);
+        return reinterpret_cast<const T *>(static_cast<const char *>(map) + s->second.first);
+    }
+
+    static const char MAGIC[8];
+    static const uint32_t VERSION;
+    static const uint32_t ALIGNMENT;
+    static const unsigned int WAIT_LIMIT_MS;
+    static const int SEGMENT_EXISTS;
+
+private:
+    /// Fixed portion of the segment. This is followed by one Entry per shelf.
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t byte_order;
+        uint32_t ready;
+        uint32_t n_shelves;
+        uint64_t size;
+    };
+    struct Entry {
+        char name[64];
+        uint64_t offset;
+        uint64_t size;
+    };
+    static uint64_t align (uint64_t offset);
+
+    Pantry (const std::string &name, int fd);
+
+    std::string name;
+    void *map;
+    size_t map_size;
+
+    /// Offset and size of each shelf, keyed by name.
+    std::map<std::string, std::pair<uint64_t, uint64_t>> directory;
+};
+
+#endif /* HOKU_PANTRY_H */
@@ -0,0 +1,46 @@
+/// @file sky-grid.h
+/// @author Glenn Galvizo
+///
+/// Header file for SkyGrid class, which holds an in-memory spatial index over a list of stars. The unit sphere is
+/// split into the six faces of a cube, and each face into an n x n grid of (equiangular) cells. A cone search only
+/// visits the cells that overlap the cone, so its cost depends on the size of the cone and not on the size of the
+/// catalog.
+
+#ifndef HOKU_SKY_GRID_H
+#define HOKU_SKY_GRID_H
+
+#include <utility>
+
+#include "math/star.h"
+
+/// @brief Class for cone searching a list of stars with a cube-face grid.
+class SkyGrid {
+public:
+    explicit SkyGrid (const Star::list &stars, unsigned int n = DEFAULT_N);
+    SkyGrid (const Star *stars, unsigned int n_stars, unsigned int n = DEFAULT_N);
+
+    std::vector<unsigned int> cone_query (const Vector3 &focus, double theta) const;
+
+    unsigned int get_n_cells () const { return 6 * n * n; }
+
+    static const unsigned int DEFAULT_N;
+
+private:
+    unsigned int cell_for (const Vector3 &s) const;
+    std::pair<unsigned int, unsigned int> cell_range (const Vector3 &f, double theta_r, unsigned int face,
+                                                      unsigned int offset) const;
+    static Vector3 face_point (unsigned int face, double u, double v);
+
+    unsigned int n;
+
+    /// Members of cell c are member[cell_start[c]] through member[cell_start[c + 1] - 1], with their unit vectors
+    /// stored alongside (x, y, z) in 'points' for locality.
+    std::vector<unsigned int> cell_start;
+    std::vector<unsigned int> member;
+    std::vector<double> points;
+
+    std::vector<Vector3> cell_center;
+    double cell_radius;
+};
+
+#endif /* HOKU_SKY_GRID_H */
@@ -0,0 +1,85 @@
+/// @file trace.h
+/// @author Glenn Galvizo
+///
+/// Header file for Trace namespace, which records the progress messages of the identification methods and experiments
+/// into an in-memory ring buffer. Tracing is chosen at compile time: unless HOKU_TRACE_LEVEL is defined above 0, every
+/// HOKU_TRACE statement compiles to nothing (its message is never even built).
+
+#ifndef HOKU_TRACE_H
+#define HOKU_TRACE_H
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+#ifndef HOKU_TRACE_LEVEL
+#define HOKU_TRACE_LEVEL 0
+#endif
+
+/// @brief Namespace for the lock-free trace buffer.
+///
+/// Any number of threads may record at once, and each record only takes a ticket through one atomic increment. The
+/// buffer holds the last CAPACITY records. Older records are overwritten (and counted as dropped) if the buffer is not
+/// flushed in time. Records are only written to a stream by flush, which should be called away from any timed code.
+namespace Trace {
+    enum Level : uint8_t {
+        WARNING = 1,
+        INFO = 2,
+        VERBOSE = 3
+    };
+    enum Category : uint8_t {
+        EXPERIMENT = 0,
+        ANGLE,
+        DOT,
+        TRIANGLE,
+        SPHERE,
+        PLANE,
+        PYRAMID,
+        COMPOSITE
+    };
+
+    /// @brief Text of a single record. This is built in place (without allocation), and is truncated at TEXT_SIZE.
+    class Line {
+    public:
+        static const unsigned int TEXT_SIZE = 112;
+
+        Line &operator<< (const char *s);
+        Line &operator<< (const std::string &s) { return *this << s.c_str(); }
+        Line &operator<< (int n);
+        Line &operator<< (unsigned int n);
+        Line &operator<< (long n);
+        Line &operator<< (unsigned long n);
+        Line &operator<< (double n);
+
+        const char *text () const { return buffer; }
+        unsigned int size () const { return length; }
+
+    private:
+        char buffer[TEXT_SIZE] = {};
+        unsigned int length = 0;
+    };
+
+    void record (Level level, Category category, const Line &line);
+    uint64_t flush (std::ostream &os);
+    uint64_t count_dropped ();
+    const char *category_name (Category category);
+
+    extern const unsigned int CAPACITY;
+}
+
+/// Record the given message (a chain of << operands) at the given level and category, i.e.
+/// HOKU_TRACE(VERBOSE, ANGLE, "Finding candidate pair for [" << i << "," << j << "]"). Messages above HOKU_TRACE_LEVEL
+/// are compiled out.
+#if HOKU_TRACE_LEVEL > 0
+#define HOKU_TRACE(level, category, message) do { \
+    if (Trace::level <= HOKU_TRACE_LEVEL) { \
+        Trace::Line hoku_trace_line; \
+        hoku_trace_line << message; \
+        Trace::record(Trace::level, Trace::category, hoku_trace_line); \
+    } \
+} while (false)
+#else
+#define HOKU_TRACE(level, category, message) do {} while (false)
+#endif
+
+#endif /* HOKU_TRACE_H */
@@ -5,6 +5,13 @@
 /// the data.
 
 #include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <pthread.h>
+#include <sched.h>
 
 #include "experiment/experiment.h"
 #include "math/random-draw.h"
@@ -24,6 +31,93 @@ double Experiment::Map::percentage_correct (const Identification::StarsEither &b
         }) != b.result.end()) ? 1.0 : 0;
     });
 
-    std::cout << "[EXPERIMENT] Percentage correct: " << count / b.result.size() << std::endl;
+    HOKU_TRACE(INFO, EXPERIMENT, "Percentage correct: " << count / b.result.size());
     return count / b.result.size();
-}
\ No newline at end of file
+}
+/// Pin the calling thread to the w-th CPU (modulo the number of CPUs) that this process may run on. This is only done
+/// on Linux, and is otherwise a no-op.
+void Experiment::pin_to_cpu (const unsigned int w) {
+#if defined(__linux__)
+    cpu_set_t allowed, pinned;
+    CPU_ZERO(&pinned);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0 || CPU_COUNT(&allowed) == 0) return;
+
+    for (int c = 0, n = 0; c < CPU_SETSIZE; c++) {
+        if (CPU_ISSET(c, &allowed) && n++ == static_cast<int>(w % static_cast<unsigned int>(CPU_COUNT(&allowed)))) {
+            CPU_SET(c, &pinned);
+            break;
+        }
+    }
+    pthread_setaffinity_np(pthread_self(), sizeof(pinned), &pinned);
+#else
+    static_cast<void>(w);
+#endif
+}
+
+/// Run trials [0, n_trials) on ep->n_threads workers. Each worker w first calls worker(w) on its own thread to build
+/// its own state (i.e. image and identifier), and then takes trials one at a time until none are left. The results of
+/// every trial are logged with lu from the calling thread alone, so lu is never touched by more than one thread. Every
+/// result is written before we return, and an exception is thrown if any of these could not be.
+///
+/// The first exception thrown by worker, by a trial or by lu stops every worker after its current trial, and is
+/// rethrown here once every worker has stopped.
+void Experiment::run_trials (const unsigned int n_trials, const std::shared_ptr<Lumberjack> &lu,
+                             const std::shared_ptr<Parameters> &ep,
+                             const std::function<TrialFunction (unsigned int w)> &worker) {
+    std::atomic<unsigned int> next_trial(0);
+    std::mutex results_mutex;
+    std::condition_variable results_ready;
+    std::vector<Nibble::tuple_d> results;
+    std::exception_ptr first_error = nullptr;
+    auto stop = [&] (const std::exception_ptr &e) -> void {
+        std::lock_guard<std::mutex> guard(results_mutex);
+        if (first_error == nullptr) first_error = e;
+        next_trial = n_trials;
+        results_ready.notify_one();
+    };
+
+    std::vector<std::thread> workers;
+    for (unsigned int w = 0; w < ep->n_threads; w++) {
+        workers.emplace_back([&, w] () -> void {
+            try {
+                if (ep->is_pinned) pin_to_cpu(w);
+                TrialFunction run_trial = worker(w);
+
+                for (unsigned int n = next_trial++; n < n_trials; n = next_trial++) {
+                    Nibble::tuple_d result = run_trial(n);
+                    std::lock_guard<std::mutex> guard(results_mutex);
+                    results.push_back(std::move(result));
+                    results_ready.notify_one();
+                }
+            }
+            catch (...) {
+                stop(std::current_exception());
+            }
+        });
+    }
+
+    // We are the single writer. Results are logged in batches, outside of the lock that the workers push under. Any
+    // trace records are written here too, away from the timed work of our workers.
+    std::vector<Nibble::tuple_d> batch;
+    try {
+        for (unsigned int n_logged = 0; n_logged < n_trials; n_logged += static_cast<unsigned int>(batch.size())) {
+            batch.clear();
+            {
+                std::unique_lock<std::mutex> lock(results_mutex);
+                results_ready.wait(lock, [&] () -> bool { return !results.empty() || first_error != nullptr; });
+                if (first_error != nullptr) break;
+                batch.swap(results);
+            }
+            for (const Nibble::tuple_d &result : batch) lu->log_trial(result);
+            Trace::flush(std::cout);
+        }
+    }
+    catch (...) {
+        stop(std::current_exception());
+    }
+    for (std::thread &w : workers) w.join();
+    Trace::flush(std::cout);
+
+    if (first_error != nullptr) std::rethrow_exception(first_error);
+    lu->flush();
+}
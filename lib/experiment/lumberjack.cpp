@@ -5,18 +5,31 @@
 
 #include <algorithm>
 #include <chrono>
+#include <cstring>
+#include <iostream>
 #include <thread>
 #include <libgen.h>
 
-#include "math/random-draw.h"
+#include "third-party/sqlite/sqlite3.h"
+
 #include "experiment/lumberjack.h"
 
-const unsigned long Lumberjack::MAXIMUM_BUFFER_SIZE = 50;
+const unsigned int Lumberjack::DEFAULT_BATCH_SIZE = 50;
+const unsigned int Lumberjack::DEFAULT_FLUSH_INTERVAL_MS = 1000;
+const char Lumberjack::RECORD_MAGIC[8] = {'H', 'O', 'K', 'U', 'L', 'O', 'G', 'S'};
+const uint32_t Lumberjack::RECORD_VERSION = 1;
+const unsigned int Lumberjack::RECORD_NAME_SIZE = 64;
 
-Lumberjack::Lumberjack (const std::string &database_name, const std::string &trial_table, const std::string &prefix,
-                        const std::string &timestamp) : Nibble(database_name) {
-    result_buffer.reserve(MAXIMUM_BUFFER_SIZE); // NOTE: We assume that Lumberjack has already been created.
+/// Byte order marker. A record file written on a machine with a different endianness will not match this when merged.
+static const uint32_t BYTE_ORDER_MARK = 0x01020304;
 
+/// Constructor. If a record path is given, trials are appended to this file (which only this Lumberjack and its copies
+/// write to) instead of the database. The database is then only read here, to find the schema of our table.
+Lumberjack::Lumberjack (const std::string &database_name, const std::string &trial_table, const std::string &prefix,
+                        const std::string &timestamp, const unsigned int batch_size,
+                        const unsigned int flush_interval_ms, const std::string &record_path) :
+        Nibble(database_name) {
+    // NOTE: We assume that Lumberjack has already been created.
     // We won't be changing our table from here. Ensure it exists before proceeding.
     if (!does_table_exist(trial_table)) {
         throw std::runtime_error(std::string("Table " + trial_table + " does not exist."));
@@ -28,60 +41,266 @@ Lumberjack::Lumberjack (const std::string &database_name, const std::string &tri
     std::string schema;
     find_attributes(schema, trial_fields);
     expected_result_size = static_cast<unsigned int> (std::count(trial_fields.begin(), trial_fields.end(), ',')) - 1;
+
+    if (!record_path.empty()) {
+        for (const std::string &name : {trial_table, identifier_name, timestamp}) {
+            if (name.size() >= RECORD_NAME_SIZE) {
+                throw std::runtime_error(std::string("Name " + name + " is too long."));
+            }
+        }
+        this->record_file = std::make_shared<std::ofstream>(record_path, std::ios::binary | std::ios::trunc);
+        if (!record_file->is_open()) throw std::runtime_error(std::string("Record file cannot be opened."));
+
+        RecordHeader h = {};
+        std::copy(RECORD_MAGIC, RECORD_MAGIC + sizeof(RECORD_MAGIC), h.magic);
+        h.version = RECORD_VERSION, h.byte_order = BYTE_ORDER_MARK, h.n_values = expected_result_size;
+        record_file->write(reinterpret_cast<const char *>(&h), sizeof(RecordHeader));
+        for (const std::string &name : {trial_table, identifier_name, timestamp}) {
+            char buffer[RECORD_NAME_SIZE] = {};
+            std::copy(name.begin(), name.end(), buffer);
+            record_file->write(buffer, RECORD_NAME_SIZE);
+        }
+        if (!record_file->good()) throw std::runtime_error(std::string("Record file cannot be written."));
+        return;
+    }
+
+    this->writer = std::make_shared<Writer>(database_name, trial_table, trial_fields, expected_result_size,
+                                            identifier_name, timestamp, std::max(1u, batch_size), flush_interval_ms);
 }
-Lumberjack::~Lumberjack () { flush_buffer(); }
 
 int Lumberjack::create_table (const std::string &database_path, const std::string &table_name,
                               const std::string &schema) {
     return Nibble(database_path).create_table(table_name, schema);
 }
 
+/// Bulk-load the given record files (written by Lumberjacks built with appending_to_file) into the database at
+/// database_path. Each trial is inserted into the table named in its file, which must already exist. All files are
+/// loaded in a single transaction, so either every file is merged or none are. A trailing partial record (i.e. from a
+/// worker that was killed mid-write) is ignored.
+///
+/// @return Number of trials merged. An exception is thrown if a file cannot be read or does not match its table.
+int Lumberjack::merge_records (const std::string &database_path, const std::vector<std::string> &record_paths) {
+    Nibble nb(database_path);
+    SQLite::Transaction t(*nb.conn);
+
+    int n_merged = 0;
+    for (const std::string &path : record_paths) {
+        std::ifstream in(path, std::ios::binary);
+        if (!in.is_open()) throw std::runtime_error(std::string("Record file " + path + " cannot be opened."));
+
+        RecordHeader h = {};
+        char names[3][RECORD_NAME_SIZE] = {};
+        in.read(reinterpret_cast<char *>(&h), sizeof(RecordHeader));
+        for (auto &name : names) in.read(name, RECORD_NAME_SIZE);
+        if (!in || !std::equal(RECORD_MAGIC, RECORD_MAGIC + sizeof(RECORD_MAGIC), h.magic) ||
+            h.version != RECORD_VERSION || h.byte_order != BYTE_ORDER_MARK) {
+            throw std::runtime_error(std::string("Record file " + path + " is not valid."));
+        }
+        std::string trial_table(names[0], strnlen(names[0], RECORD_NAME_SIZE));
+        std::string identifier_name(names[1], strnlen(names[1], RECORD_NAME_SIZE));
+        std::string timestamp(names[2], strnlen(names[2], RECORD_NAME_SIZE));
+
+        // The table must hold the identifier name, the timestamp and one column for each value of our records.
+        std::string schema, fields;
+        if (!nb.does_table_exist(trial_table)) {
+            throw std::runtime_error(std::string("Table " + trial_table + " does not exist."));
+        }
+        nb.select_table(trial_table);
+        nb.find_attributes(schema, fields);
+        if (std::count(fields.begin(), fields.end(), ',') - 1 != static_cast<long>(h.n_values)) {
+            throw std::runtime_error(std::string("Record file " + path + " does not match " + trial_table + "."));
+        }
+
+        std::string sql = "INSERT INTO " + trial_table + " (" + fields + ") VALUES (?, ?";
+        for (unsigned int a = 0; a < h.n_values; a++) sql.append(", ?");
+        SQLite::Statement insert(*nb.conn, sql.append(")"));
+
+        // Fields here are 1-indexed.
+        for (tuple_d result(h.n_values); in.read(reinterpret_cast<char *>(result.data()),
+                                                 sizeof(double) * h.n_values); n_merged++) {
+            insert.bind(1, identifier_name), insert.bind(2, timestamp);
+            for (unsigned int j = 0; j < h.n_values; j++) insert.bind(static_cast<int>(j + 3), result[j]);
+            insert.exec(), insert.reset();
+        }
+    }
+
+    t.commit();
+    return n_merged;
+}
+
+/// Hand the given result to our writer, or append it to our record file. This never waits on the database (or on any
+/// lock). Our record file is not thread-safe: only one thread may log to it.
+///
+/// @return 0 if the result is queued. An exception is thrown if the result is not of the size our table expects, if
+/// it cannot be appended to our record file, or if our writer has failed to write an earlier result.
 int Lumberjack::log_trial (const tuple_d &result) {
     if (result.size() != expected_result_size) {
         throw std::runtime_error(std::string("Result is not of size: " + std::to_string(expected_result_size) + "."));
     }
-    result_buffer.emplace_back(result);
 
-    // If we have reached our storage max, flush the buffer.
-    return (result_buffer.size() >= MAXIMUM_BUFFER_SIZE) ? flush_buffer() : 0;
+    if (record_file != nullptr) {
+        record_file->write(reinterpret_cast<const char *>(result.data()), sizeof(double) * expected_result_size);
+        if (!record_file->good()) throw std::runtime_error(std::string("Record file cannot be written."));
+        return 0;
+    }
+    writer->rethrow_error();
+    writer->push(result);
+    return 0;
 }
 
-int Lumberjack::flush_buffer () {
-    // Do not proceed if the buffer is empty.
-    if (result_buffer.empty()) return 0;
-
-    std::string sql = "INSERT INTO " + current_table + std::string(" (") + trial_fields + ") VALUES ";
-    for (unsigned int i = 0; i < result_buffer.size(); i++) {
-        sql.append("(?, ");
-        for (unsigned int a = 0; a < expected_result_size; a++) sql.append("?, ");
-        sql.append("?),");
+/// Wait for every result logged before now to be written to the database (or to our record file). An exception is
+/// thrown if any of these could not be written.
+void Lumberjack::flush () {
+    if (record_file != nullptr) {
+        if (!record_file->flush().good()) throw std::runtime_error(std::string("Record file cannot be written."));
+        return;
     }
-    sql.erase(sql.size() - 1);
+    writer->flush();
+}
 
-    SQLite::Statement insert(*conn, sql);
-    for (unsigned int i = 0; i < result_buffer.size(); i++) {
+/// Constructor. Our connection is switched to WAL mode (so readers of the database never block us) and waits on the
+/// locks of other writers instead of failing right away. Our insert statement is prepared once here, and is reused
+/// for every batch. Our thread starts here. Batches are at least one result, and our interval is at least 1 ms (so
+/// our thread never spins).
+Lumberjack::Writer::Writer (const std::string &database_name, const std::string &trial_table,
+                            const std::string &trial_fields, const unsigned int n_values,
+                            const std::string &identifier_name, const std::string &timestamp,
+                            const unsigned int batch_size, const unsigned int flush_interval_ms) :
+        identifier_name(identifier_name), timestamp(timestamp), n_values(n_values),
+        batch_size(std::max(1u, batch_size)), flush_interval_ms(std::max(1u, flush_interval_ms)) {
+    const int FLAGS = SQLite::OPEN_READWRITE; // NOLINT(hicpp-signed-bitwise)
+    this->conn = std::make_shared<SQLite::Database>(database_name, FLAGS);
+    conn->setBusyTimeout(static_cast<int>(this->flush_interval_ms));
+    conn->exec("PRAGMA journal_mode = WAL");
 
-        // Fields here are 1-indexed.
-        insert.bind((i * (expected_result_size + 2)) + 1, this->identifier_name);
-        insert.bind((i * (expected_result_size + 2)) + 2, this->timestamp);
-        for (unsigned int j = 0; j < expected_result_size; j++) {
-            insert.bind((i * (expected_result_size + 2)) + j + 3, result_buffer[i][j]);
+    std::string insert_sql = "INSERT INTO " + trial_table + " (" + trial_fields + ") VALUES (?, ?";
+    for (unsigned int a = 0; a < n_values; a++) insert_sql.append(", ?");
+    insert_sql.append(")");
+    this->insert = std::unique_ptr<SQLite::Statement>(new SQLite::Statement(*conn, insert_sql));
+
+    this->thread = std::thread(&Writer::run, this);
+}
+
+/// Destructor. Every result pushed before now is written before our thread stops. We cannot throw from here, so an
+/// error that was never rethrown to a caller (i.e. one from our last batch) is written to stderr instead.
+Lumberjack::Writer::~Writer () {
+    {
+        std::lock_guard<std::mutex> guard(wake_mutex);
+        is_stopping = true;
+    }
+    wake.notify_one();
+    thread.join();
+
+    if (error != nullptr && !is_error_reported) {
+        try {
+            std::rethrow_exception(error);
+        }
+        catch (const std::exception &e) {
+            std::cerr << "[LUMBERJACK] Results could not be written: " << e.what() << std::endl;
         }
     }
+}
+
+/// Push the given result onto our stack of pending results. This is lock-free. If a full batch is now pending, our
+/// thread is woken up to write it. Otherwise, it is written within our flush interval.
+void Lumberjack::Writer::push (const tuple_d &result) {
+    auto *node = new Node{result, pending.load(std::memory_order_relaxed)};
+    while (!pending.compare_exchange_weak(node->next, node, std::memory_order_release, std::memory_order_relaxed));
+    n_pushed.fetch_add(1, std::memory_order_release);
+
+    if (n_pending.fetch_add(1, std::memory_order_relaxed) + 1 == batch_size) wake.notify_one();
+}
+
+/// Wake our thread, and wait until every result pushed before now has been taken by it. Our error (if any) is then
+/// rethrown.
+void Lumberjack::Writer::flush () {
+    {
+        std::unique_lock<std::mutex> lock(wake_mutex);
+        const uint64_t n_target = n_pushed.load(std::memory_order_acquire);
+        n_flushing++;
+        wake.notify_one();
+        taken.wait(lock, [this, n_target] () -> bool { return n_taken >= n_target; });
+        n_flushing--;
+    }
+    rethrow_error();
+}
+
+/// Rethrow the error that stopped our thread from writing, if there is one. Once this happens, every result that is
+/// pushed is dropped instead of written, so this is rethrown to every caller after.
+void Lumberjack::Writer::rethrow_error () {
+    if (!has_error.load(std::memory_order_acquire)) return;
 
-    while (true) {
+    std::lock_guard<std::mutex> guard(wake_mutex);
+    is_error_reported = true;
+    std::rethrow_exception(error);
+}
+
+/// Body of our thread. Each time we wake (after our flush interval, once a batch is pending, when flushed, or when
+/// stopping), every pending result is taken at once and written. We only stop once nothing is left. After our first
+/// error, results are taken but no longer written.
+void Lumberjack::Writer::run () {
+    std::vector<tuple_d> results;
+    for (bool is_last = false; !is_last;) {
+        {
+            std::unique_lock<std::mutex> lock(wake_mutex);
+            wake.wait_for(lock, std::chrono::milliseconds(flush_interval_ms), [this] () -> bool {
+                return is_stopping || n_flushing > 0 || n_pending.load(std::memory_order_relaxed) >= batch_size;
+            });
+            is_last = is_stopping;
+        }
+
+        // Our stack holds the newest result first. Its results are reversed, so they are written in pushed order.
+        results.clear();
+        for (Node *n = pending.exchange(nullptr, std::memory_order_acquire), *next; n != nullptr; n = next) {
+            next = n->next;
+            results.push_back(std::move(n->result));
+            delete n;
+        }
+        n_pending.fetch_sub(static_cast<unsigned int>(results.size()), std::memory_order_relaxed);
+        std::reverse(results.begin(), results.end());
+
+        std::exception_ptr e;
         try {
-            SQLite::Transaction t(*conn);
-            if (insert.exec() != static_cast<signed> (result_buffer.size()))
-                throw std::runtime_error(std::string("All results were not recorded."));
-            else {
-                result_buffer.clear(), result_buffer.reserve(MAXIMUM_BUFFER_SIZE), t.commit();
-                return 0;
-            }
+            if (!has_error.load(std::memory_order_relaxed)) write(results);
+        }
+        catch (...) {
+            e = std::current_exception();
         }
-        catch (SQLite::Exception &) {
-            // Handle collisions by waiting a random amount of time.
-            std::this_thread::sleep_for(std::chrono::milliseconds(RandomDraw::draw_integer(0, 1000)));
+        {
+            std::lock_guard<std::mutex> guard(wake_mutex);
+            if (e != nullptr) this->error = e, has_error.store(true, std::memory_order_release);
+            n_taken += results.size();
+        }
+        taken.notify_all();
+    }
+}
+
+/// Write the given results, with one transaction (a group commit) per batch. If another process holds the database
+/// for longer than our busy timeout, the batch is retried after a short wait. Only our thread waits here. Any other
+/// error is thrown.
+void Lumberjack::Writer::write (const std::vector<tuple_d> &results) {
+    if (results.empty()) return;
+
+    for (std::size_t begin = 0; begin < results.size(); begin += batch_size) {
+        const std::size_t end = std::min(results.size(), begin + batch_size);
+        for (unsigned int wait_ms = 10;; wait_ms = std::min(2 * wait_ms, flush_interval_ms)) {
+            try {
+                SQLite::Transaction t(*conn);
+                for (std::size_t i = begin; i < end; i++) {
+                    // Fields here are 1-indexed.
+                    insert->bind(1, identifier_name), insert->bind(2, timestamp);
+                    for (unsigned int j = 0; j < n_values; j++) insert->bind(static_cast<int>(j + 3), results[i][j]);
+                    insert->exec(), insert->reset();
+                }
+                t.commit();
+                break;
+            }
+            catch (SQLite::Exception &e) {
+                const int code = e.getErrorCode() & 0xff; // NOLINT(hicpp-signed-bitwise)
+                if (code != SQLITE_BUSY && code != SQLITE_LOCKED) throw;
+                insert->reset();
+                std::this_thread::sleep_for(std::chrono::milliseconds(wait_ms));
+            }
         }
     }
 }
@@ -4,71 +4,73 @@
 /// Source file for Angle class, which matches a set of body vectors (stars) to their inertial counter-parts in the
 /// database.
 
+#include <algorithm>
 #include <iostream>
+#include <tuple>
 
 #include "identification/angle.h"
 
 const unsigned int Angle::QUERY_STAR_SET_SIZE = 2;
 const int Angle::NO_CANDIDATES_FOUND_EITHER = -1;
 const int Angle::NO_CANDIDATE_PAIR_FOUND_EITHER = -2;
+const std::array<std::string, 1> Angle::QUERY_FOCI = {"theta"};
+const std::string Angle::QUERY_LABELS = "label_a, label_b";
 
 int Angle::generate_table (const std::shared_ptr<Chomp> &ch, const double fov, const std::string &table_name) {
-    SQLite::Transaction transaction(*ch->conn);
-
-    // Exit early if the table already exists.
-    if (ch->create_table(
-            table_name,
-            "label_a INT, "
-            "label_b INT, "
-            "theta FLOAT"
-    ) == Nibble::TABLE_NOT_CREATED_RET)
-        return TABLE_ALREADY_EXISTS;
-
-    ch->select_table(table_name);
-
-    // (i, j) are distinct, where no (i, j) = (j, i).
-    Star::list all_stars = ch->bright_as_list();
-    for (unsigned int i = 0; i < all_stars.size() - 1; i++) {
-        for (unsigned int j = i + 1; j < all_stars.size(); j++) {
-            double theta = (180.0 / M_PI) * Vector3::Angle(all_stars[i], all_stars[j]);
-
-            // Only insert if the angle between both stars is less than fov.
-            if (theta < fov)
-                ch->insert_into_table(
-                        "label_a, label_b, theta",
-                        Nibble::tuple_d{static_cast<double> (all_stars[i].get_label()),
-                                        static_cast<double> (all_stars[j].get_label()),
-                                        theta
-                        });
+    return generate_tables(ch, find_neighborhood(ch, fov, false), {table_name});
+}
+
+int Angle::generate_tables (const std::shared_ptr<Chomp> &ch, const Neighborhood &nb,
+                            const std::vector<std::string> &table_names) {
+    // Our tables are clustered on theta, so they need no separate index.
+    return load_tables(ch, table_names, "label_a INT, label_b INT, theta FLOAT", "theta, label_a, label_b",
+                       "label_a, label_b, theta", [&nb] () -> Nibble::tuple_d {
+        // (i, j) are distinct, where no (i, j) = (j, i). Only neighbors can have an angle less than fov.
+        struct PairRow {
+            int ell[2];
+            double theta;
+        };
+        std::vector<PairRow> rows;
+        for (unsigned int i = 0; i < nb.stars.size(); i++) {
+            for (const unsigned int j : nb.near[i]) {
+                double theta = (180.0 / M_PI) * Vector3::Angle(nb.stars[i], nb.stars[j]);
+                if (theta < nb.fov) rows.push_back(PairRow{{nb.stars[i].get_label(), nb.stars[j].get_label()}, theta});
+            }
         }
-    }
 
-    transaction.commit();
-    return ch->sort_and_index("theta");
+        // Sort by our entire key (theta, then labels), and write our rows straight into their final order.
+        std::sort(rows.begin(), rows.end(), [] (const PairRow &r_1, const PairRow &r_2) -> bool {
+            return std::tie(r_1.theta, r_1.ell[0], r_1.ell[1]) < std::tie(r_2.theta, r_2.ell[0], r_2.ell[1]);
+        });
+        Nibble::tuple_d values;
+        values.reserve(3 * rows.size());
+        for (const PairRow &r : rows) {
+            values.insert(values.end(), {static_cast<double>(r.ell[0]), static_cast<double>(r.ell[1]), r.theta});
+        }
+        return values;
+    });
 }
 
-Identification::LabelsEither Angle::query_for_pair (const double theta) {
-    std::vector<labels_list> big_r_ell;
-    Nibble::tuples_d big_r_ell_tuples;
-
-    // Query using theta with epsilon bounds. Return NO_CONFIDENT_R if nothing is found.
-    big_r_ell_tuples = ch->simple_bound_query(
-            {"theta"},
-            "label_a, label_b",
-            {theta - epsilon_1},
-            {theta + epsilon_1},
-            500
-    );
-    nu++;
+/// Search for the first catalog pair whose angle is within epsilon_1 of theta. The labels are read where they lie (in
+/// our in-memory index or in our result buffer), so nothing is copied.
+///
+/// @return Pointer to the two labels of the first candidate, valid until our next search. Otherwise, nullptr.
+const int *Angle::query_for_pair (const double theta) {
+    std::shared_ptr<KVector> kv = ch->k_vector(table_name);
 
-    if (big_r_ell_tuples.empty()) return LabelsEither{{}, NO_CANDIDATES_FOUND_EITHER};
-    else {
-        // Create the candidate label list.
-        for (const Nibble::tuple_d &candidate : big_r_ell_tuples) {
-            big_r_ell.emplace_back(labels_list{static_cast<int>(candidate[0]), static_cast<int>(candidate[1])});
-        }
-        return LabelsEither{big_r_ell[0], 0};
+    // Use the in-memory index if one exists for our table. We only need the first candidate here.
+    if (kv != nullptr) {
+        KVector::Range r = kv->bound_query(theta - epsilon_1, theta + epsilon_1);
+        nu++;
+
+        return (r.begin == r.end) ? nullptr : kv->labels(r.begin);
     }
+
+    // Query using theta with epsilon bounds. Return nothing if nothing is found.
+    handle->bound_query(QUERY_FOCI, QUERY_LABELS, "", {theta - epsilon_1}, {theta + epsilon_1}, big_r_results);
+    nu++;
+
+    return (big_r_results.empty()) ? nullptr : big_r_results.labels(0);
 }
 
 Angle::PairsEither Angle::find_candidate_pair (const Star &b_i, const Star &b_j) {
@@ -78,13 +80,13 @@ Angle::PairsEither Angle::find_candidate_pair (const Star &b_i, const Star &b_j)
     if (theta > be->get_fov()) return PairsEither{{}, NO_CANDIDATE_PAIR_FOUND_EITHER};
 
     // If no candidate is found, break early.
-    LabelsEither big_r_ell = this->query_for_pair(theta);
-    if (big_r_ell.error == NO_CANDIDATES_FOUND_EITHER) return PairsEither{{}, NO_CANDIDATE_PAIR_FOUND_EITHER};
+    const int *r_ell = this->query_for_pair(theta);
+    if (r_ell == nullptr) return PairsEither{{}, NO_CANDIDATE_PAIR_FOUND_EITHER};
 
     // Otherwise, obtain and return the inertial vectors for the given candidates.
     return PairsEither{Star::pair{
-            ch->query_hip(big_r_ell.result[0]),
-            ch->query_hip(big_r_ell.result[1])
+            ch->query_hip(r_ell[0]),
+            ch->query_hip(r_ell[1])
     }, 0};
 }
 
@@ -103,10 +105,10 @@ Identification::StarsEither Angle::direct_match_test (const Star::list &big_p, c
     for (unsigned int i = 0; i < 2; i++) {
         std::array<int, 2> a = {(i == 0) ? 0 : 1, (i == 0) ? 1 : 0}; // We define our identity 'a' below.
 
-        big_m[i] = Identification::find_positive_overlay(*be->get_image(), big_p, Rotation::triad(
+        big_m[i] = find_positive_overlay(big_p, Rotation::triad(
                 {b[0], b[1]},
                 {r[a[0]], r[a[1]]}
-        ), this->epsilon_4);
+        ));
         big_a[i] = {Star::define_label(b[0], r[a[0]].get_label()), Star::define_label(b[1], r[a[1]].get_label())};
     }
 
@@ -119,28 +121,33 @@ Identification::StarsEither Angle::direct_match_test (const Star::list &big_p, c
 
 std::vector<Identification::labels_list> Angle::query () {
     double theta = (180.0 / M_PI) * Vector3::Angle(be->get_image()->at(0), be->get_image()->at(1));
+    std::shared_ptr<KVector> kv = ch->k_vector(table_name);
     std::vector<labels_list> big_r_ell;
 
-    // Query using theta with epsilon bounds.
-    ch->select_table(table_name);
-    Nibble::tuples_d big_r_tuples = ch->simple_bound_query(
-            {"theta"},
-            "label_a, label_b",
-            {theta - epsilon_1},
-            {theta + epsilon_1},
-            500
-    );
+    // Use the in-memory index if one exists for our table.
+    if (kv != nullptr) {
+        KVector::Range r = kv->bound_query(theta - epsilon_1, theta + epsilon_1);
 
-    big_r_ell.reserve(big_r_tuples.size() / 2); // Sort r into list of catalog ID pairs.
-    for (const Nibble::tuple_d &r_t : big_r_tuples) {
-        big_r_ell.emplace_back(labels_list{static_cast<int>(r_t[0]), static_cast<int>(r_t[1])});
+        big_r_ell.reserve(r.end - r.begin);
+        for (unsigned int i = r.begin; i < r.end; i++) {
+            big_r_ell.emplace_back(labels_list{kv->labels(i)[0], kv->labels(i)[1]});
+        }
+        return big_r_ell;
+    }
+
+    // Otherwise, query using theta with epsilon bounds.
+    handle->bound_query(QUERY_FOCI, QUERY_LABELS, "", {theta - epsilon_1}, {theta + epsilon_1}, big_r_results);
+
+    big_r_ell.reserve(big_r_results.size()); // Sort r into list of catalog ID pairs.
+    for (unsigned int i = 0; i < big_r_results.size(); i++) {
+        big_r_ell.emplace_back(labels_list{big_r_results.labels(i)[0], big_r_results.labels(i)[1]});
     }
 
     return big_r_ell;
 }
 
 Identification::StarsEither Angle::reduce () {
-    ch->select_table(table_name), nu = 0;
+    nu = 0;
 
     for (unsigned int i = 0; i < be->get_image()->size() - 1; i++) {
         for (unsigned int j = i + 1; j < be->get_image()->size(); j++) {
@@ -157,6 +164,31 @@ Identification::StarsEither Angle::reduce () {
     return StarsEither{{}, NO_CONFIDENT_R_EITHER};
 }
 
+/// Test the hypothesis that body stars i and j are a catalog pair.
+///
+/// @return NO_CONFIDENT_A if no confident match exists for this pair. Otherwise, body stars b with the attached labels
+/// of the inertial pair r.
+Identification::StarsEither Angle::identify_pair (const unsigned int i, const unsigned int j) {
+    // Narrow down current pair to two stars in catalog. The order is currently unknown.
+    HOKU_TRACE(VERBOSE, ANGLE, "Finding candidate pair for [" << i << "," << j << "]");
+    PairsEither r = find_candidate_pair(be->get_image()->at(i), be->get_image()->at(j));
+    if (r.error == NO_CANDIDATE_PAIR_FOUND_EITHER) return StarsEither{{}, NO_CONFIDENT_A_EITHER};
+
+    // Find candidate stars around the candidate pair.
+    Star::list big_p = ch->nearby_hip_stars(r.result[0], be->get_fov(), 500);
+    nu++;
+
+    // Find the most likely pair combination given the two pairs.
+    HOKU_TRACE(VERBOSE, ANGLE, "Performing DMT for [" << i << "," << j << "]");
+    StarsEither a = direct_match_test(
+            big_p,
+            {r.result[0], r.result[1]},
+            {be->get_image()->at(i), be->get_image()->at(j)}
+    );
+    if (a.error != NO_CONFIDENT_A_EITHER) HOKU_TRACE(INFO, ANGLE, "Match found!");
+    return a;
+}
+
 /// @return NO_CONFIDENT_A if an identification cannot be found exhaustively. EXCEEDED_NU_MAX if an
 /// identification cannot be found within a certain number of query picks. Otherwise, body stars b with the attached
 /// labels of the inertial pair r.
@@ -164,33 +196,12 @@ Identification::StarsEither Angle::identify () {
     nu = 0;
 
     // There exists |big_i| choose 2 possibilities.
-    for (unsigned int i = 0; i < be->get_image()->size() - 1; i++) {
-        for (unsigned int j = i + 1; j < be->get_image()->size(); j++) {
-            // Practical limit: exit early if we have iterated through too many comparisons without match.
-            if (nu > nu_max) return StarsEither{{}, EXCEEDED_NU_MAX_EITHER};
-
-            // Narrow down current pair to two stars in catalog. The order is currently unknown.
-            std::cout << "[ANGLE] Finding candidate pair for [" << i << "," << j << "]" << std::endl;
-            PairsEither r = find_candidate_pair(be->get_image()->at(i), be->get_image()->at(j));
-            if (r.error == NO_CANDIDATE_PAIR_FOUND_EITHER) continue;
-
-            // Find candidate stars around the candidate pair.
-            Star::list big_p = ch->nearby_hip_stars(r.result[0], be->get_fov(), 500);
-            nu++;
-
-            // Find the most likely pair combination given the two pairs.
-            std::cout << "[ANGLE] Performing DMT for [" << i << "," << j << "]" << std::endl;
-            StarsEither a = direct_match_test(
-                    big_p,
-                    {r.result[0], r.result[1]},
-                    {be->get_image()->at(i), be->get_image()->at(j)}
-            );
-            if (a.error != NO_CONFIDENT_A_EITHER) {
-                std::cout << "[ANGLE] Match found!" << std::endl;
-                return a;
-            }
-        }
+    std::vector<std::array<unsigned int, 2>> c;
+    for (unsigned int i = 0; i + 1 < be->get_image()->size(); i++) {
+        for (unsigned int j = i + 1; j < be->get_image()->size(); j++) c.push_back({i, j});
     }
 
-    return StarsEither{{}, NO_CONFIDENT_A_EITHER};
+    return search(static_cast<unsigned int>(c.size()), [&c] (Identification &w, const unsigned int h) -> StarsEither {
+        return static_cast<Angle &>(w).identify_pair(c[h][0], c[h][1]);
+    });
 }
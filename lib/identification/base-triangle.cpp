@@ -7,91 +7,91 @@
 #include <iostream>
 #include <cmath>
 #include <algorithm>
+#include <tuple>
 
 #include "identification/base-triangle.h"
 
 const int  BaseTriangle::NO_CANDIDATE_STARS_FOUND_EITHER = -1;
 const int BaseTriangle::NO_CANDIDATE_STAR_SET_FOUND_EITHER = -2;
 const BaseTriangle::index_trio BaseTriangle::STARTING_INDEX_TRIO = {0, 1, 2};
-
-int BaseTriangle::generate_triangle_table (const std::shared_ptr<Chomp> &ch, const double fov,
-                                           const std::string &table_name, area_function compute_area,
-                                           moment_function compute_moment) {
-    SQLite::Transaction initial_transaction(*ch->conn);
-
-    // Exit early if the table already exists.
-    if (ch->create_table(table_name,
-                         "label_a INT, "
-                         "label_b INT, "
-                         "label_c INT, "
-                         "a FLOAT, "
-                         "i FLOAT")
-        == Nibble::TABLE_NOT_CREATED_RET)
-        return TABLE_ALREADY_EXISTS;
-
-    initial_transaction.commit();
-    ch->select_table(table_name);
-
-    // (i, j, k) are distinct, where no (i, j, k) = (j, k, i), (j, i, k), ....
-    Star::list all_stars = ch->bright_as_list();
-    for (unsigned int i = 0; i < all_stars.size() - 2; i++) {
-        SQLite::Transaction transaction(*ch->conn);
-        for (unsigned int j = i + 1; j < all_stars.size() - 1; j++) {
-            for (unsigned int k = j + 1; k < all_stars.size(); k++) {
-
-                // Only insert if the angle between all stars are separated by fov degrees or less.
-                if (Star::within_angle({all_stars[i], all_stars[j], all_stars[k]}, fov)) {
-                    double a_t = compute_area(all_stars[i], all_stars[j], all_stars[k]);
-                    double i_t = compute_moment(all_stars[i], all_stars[j], all_stars[k]);
-
-                    // Prevent insertion of trios with error areas / moments.
-                    if (a_t > 0 && !std::isnan(i_t) && i_t > 0) {
-                        ch->insert_into_table(
-                                "label_a, label_b, label_c, a, i",
-                                Nibble::tuple_d{
-                                        static_cast<double>(all_stars[i].get_label()),
-                                        static_cast<double>(all_stars[j].get_label()),
-                                        static_cast<double>(all_stars[k].get_label()),
-                                        a_t,
-                                        i_t
-                                }
-                        );
-                    }
+const std::array<std::string, 2> BaseTriangle::QUERY_FOCI = {"a", "i"};
+const std::string BaseTriangle::QUERY_LABELS = "label_a, label_b, label_c";
+
+int BaseTriangle::generate_triangle_tables (const std::shared_ptr<Chomp> &ch, const Neighborhood &nb,
+                                            const std::vector<std::string> &table_names, area_function compute_area,
+                                            moment_function compute_moment) {
+    // Our tables are clustered on (a, i), so they need no separate index.
+    return load_tables(ch, table_names, "label_a INT, label_b INT, label_c INT, a FLOAT, i FLOAT",
+                       "a, i, label_a, label_b, label_c", "label_a, label_b, label_c, a, i",
+                       [&] () -> Nibble::tuple_d {
+        // Spread our pivots (i) across all cores. Each thread collects its rows in its own buffer.
+        struct TrioRow {
+            int ell[3];
+            double a, i;
+        };
+        std::vector<std::vector<TrioRow>> thread_rows(count_generation_threads());
+        distribute_pivots(static_cast<unsigned int>(nb.stars.size()), static_cast<unsigned int>(thread_rows.size()),
+                          [&] (const unsigned int i, const unsigned int t) -> void {
+            for (const std::array<unsigned int, 2> &jk : nb.trios[i]) {
+                const Star &b_i = nb.stars[i], &b_j = nb.stars[jk[0]], &b_k = nb.stars[jk[1]];
+                double a_t = compute_area(b_i, b_j, b_k), i_t = compute_moment(b_i, b_j, b_k);
+
+                // Prevent insertion of trios with error areas / moments.
+                if (a_t > 0 && !std::isnan(i_t) && i_t > 0) {
+                    thread_rows[t].push_back(TrioRow{{b_i.get_label(), b_j.get_label(), b_k.get_label()}, a_t, i_t});
                 }
             }
+        });
+
+        // Merge our buffers and sort by our entire key (a, i, then labels), so the rows can be written in their final
+        // order. The order of our buffers depends on which thread took each pivot, so ties must be broken here.
+        std::vector<TrioRow> rows;
+        for (std::vector<TrioRow> &t_rows : thread_rows) {
+            rows.insert(rows.end(), t_rows.begin(), t_rows.end());
+            std::vector<TrioRow>().swap(t_rows);
         }
-        // Commit every star I change.
-        transaction.commit();
-    }
+        std::sort(rows.begin(), rows.end(), [] (const TrioRow &r_1, const TrioRow &r_2) -> bool {
+            return std::tie(r_1.a, r_1.i, r_1.ell[0], r_1.ell[1], r_1.ell[2]) <
+                   std::tie(r_2.a, r_2.i, r_2.ell[0], r_2.ell[1], r_2.ell[2]);
+        });
 
-    return ch->sort_and_index("a, i");
+        Nibble::tuple_d values;
+        values.reserve(5 * rows.size());
+        for (const TrioRow &r : rows) {
+            values.insert(values.end(), {static_cast<double>(r.ell[0]), static_cast<double>(r.ell[1]),
+                                         static_cast<double>(r.ell[2]), r.a, r.i});
+        }
+        return values;
+    });
 }
 
-std::vector<BaseTriangle::labels_list> BaseTriangle::query_for_trio (const double a, const double i) {
-    std::vector<labels_list> big_r_ell;
-    Nibble::tuples_d matches;
+/// Search for all catalog trios whose area and polar moment are within our epsilon bounds of (a, i). The candidates are
+/// left where they were found (in big_r_rows if our table has an in-memory index, otherwise in big_r_results), and are
+/// read with trio_labels.
+///
+/// @return The number of candidates found.
+unsigned int BaseTriangle::query_for_trio (const double a, const double i) {
+    std::shared_ptr<BucketIndex> bi = ch->bucket_index(table_name);
+
+    // Use the in-memory index if one exists for our table.
+    if (bi != nullptr) {
+        return bi->bound_query(a - epsilon_1, a + epsilon_1, i - epsilon_2, i + epsilon_2, big_r_rows);
+    }
 
     // Query for candidates using all fields.
-    matches = ch->simple_bound_query(
-            {"a", "i"},
-            "label_a, label_b, label_c",
+    handle->bound_query(
+            QUERY_FOCI, QUERY_LABELS, "",
             {a - epsilon_1, i - epsilon_2},
             {a + epsilon_1, i + epsilon_2},
-            500
+            big_r_results
     );
-    if (matches.empty()) return {};
-
-    // Next, transform this set into candidate set labels.
-    big_r_ell.reserve(matches.size());
-    std::for_each(matches.begin(), matches.end(), [&big_r_ell] (const Chomp::tuple_d &t) -> void {
-        big_r_ell.emplace_back(labels_list{
-                static_cast<int> (t[0]),
-                static_cast<int> (t[1]),
-                static_cast<int>(t[2])
-        });
-    });
+    return static_cast<unsigned int>(big_r_results.size());
+}
 
-    return big_r_ell;
+/// @return Pointer to the three labels of candidate r from our last query_for_trio. This is valid until our next
+/// search.
+const int *BaseTriangle::trio_labels (const std::shared_ptr<BucketIndex> &bi, const unsigned int r) const {
+    return (bi != nullptr) ? bi->labels(big_r_rows[r]) : big_r_results.labels(r);
 }
 
 BaseTriangle::TrioVectorEither BaseTriangle::base_query_for_trios (const index_trio &c, area_function compute_area,
@@ -101,7 +101,6 @@ BaseTriangle::TrioVectorEither BaseTriangle::base_query_for_trios (const index_t
             be->get_image()->at(c[1]),
             be->get_image()->at(c[2])
     };
-    std::vector<labels_list> big_r_ell;
     std::vector<Star::trio> big_r;
 
     // Do not attempt to find matches if all stars are not within fov.
@@ -110,21 +109,19 @@ BaseTriangle::TrioVectorEither BaseTriangle::base_query_for_trios (const index_t
     }
 
     // Search for the current trio.
-    big_r_ell = this->query_for_trio(compute_area(b[0], b[1], b[2]), compute_moment(b[0], b[1], b[2]));
+    unsigned int n = this->query_for_trio(compute_area(b[0], b[1], b[2]), compute_moment(b[0], b[1], b[2]));
     nu++;
 
     // If this is empty, then break early.
-    if (big_r_ell.empty()) return TrioVectorEither{{}, NO_CANDIDATE_STARS_FOUND_EITHER};
-
-    big_r.reserve(big_r_ell.size()); // Grab stars themselves from catalog IDs found in matches. Return these matches.
-    std::for_each(
-            big_r_ell.begin(), big_r_ell.end(),
-            [&big_r, this] (const labels_list &r_ell) -> void {
-                big_r.push_back({ch->query_hip(static_cast<int> (r_ell[0])),
-                                 ch->query_hip(static_cast<int> (r_ell[1])),
-                                 ch->query_hip(static_cast<int> (r_ell[2]))});
-            }
-    );
+    if (n == 0) return TrioVectorEither{{}, NO_CANDIDATE_STARS_FOUND_EITHER};
+
+    // Grab stars themselves from catalog IDs found in matches. Return these matches.
+    std::shared_ptr<BucketIndex> bi = ch->bucket_index(table_name);
+    big_r.reserve(n);
+    for (unsigned int r = 0; r < n; r++) {
+        const int *r_ell = trio_labels(bi, r);
+        big_r.push_back({ch->query_hip(r_ell[0]), ch->query_hip(r_ell[1]), ch->query_hip(r_ell[2])});
+    }
 
     return TrioVectorEither{big_r, 0};
 }
@@ -170,13 +167,13 @@ BaseTriangle::TriosEither BaseTriangle::pivot (const index_trio &c) {
 
     switch (big_r_1->size()) {
         case 1: // Only 1 trio exists. This must be the matching trio.
-            std::cout << "[TRIANGLE] Unique trio found. Pivot ending." << std::endl;
+            HOKU_TRACE(VERBOSE, TRIANGLE, "Unique trio found. Pivot ending.");
             return TriosEither{(*big_r_1)[0], 0};
         case 0: // No trios exist. Exit early.
-            std::cout << "[TRIANGLE] All trios filtered out. Pivot ending." << std::endl;
+            HOKU_TRACE(VERBOSE, TRIANGLE, "All trios filtered out. Pivot ending.");
             return TriosEither{{}, NO_CANDIDATE_STAR_SET_FOUND_EITHER};
         default: // 2+ trios exists. Run with different 3rd element and history, or exit with error set.
-            std::cout << "[TRIANGLE] Continuing pivot. Current size: " << big_r_1->size() << std::endl;
+            HOKU_TRACE(VERBOSE, TRIANGLE, "Continuing pivot. Current size: " << big_r_1->size());
             return (static_cast<unsigned>(c[2]) != be->get_image()->size() - 1) ? pivot(index_trio{
                     c[0],
                     c[1],
@@ -201,10 +198,10 @@ BaseTriangle::StarsEither BaseTriangle::direct_match_test (const Star::list &big
 
     // Determine the rotation to take frame R to B.
     for (unsigned int i = 0; i < 6; i++) {
-        big_m[i] = Identification::find_positive_overlay(*be->get_image(), big_p, Rotation::triad(
+        big_m[i] = find_positive_overlay(big_p, Rotation::triad(
                 {b[0], b[1], b[2]},
                 {r[big_a_c[i][0]], r[big_a_c[i][1]], r[big_a_c[i][2]]}
-        ), this->epsilon_4);
+        ));
         big_a[i] = {
                 Star::define_label(b[0], r[big_a_c[i][0]].get_label()),
                 Star::define_label(b[1], r[big_a_c[i][1]].get_label()),
@@ -229,8 +226,19 @@ BaseTriangle::StarsEither BaseTriangle::direct_match_test (const Star::list &big
 }
 
 /// Find the matching pairs using the appropriate triangle table and by comparing areas and polar moments. This is
-/// just a wrapper for query_for_trio.
-std::vector<BaseTriangle::labels_list> BaseTriangle::e_query (double a, double i) { return query_for_trio(a, i); }
+/// just a wrapper for query_for_trio, which copies each candidate out.
+std::vector<BaseTriangle::labels_list> BaseTriangle::e_query (double a, double i) {
+    std::shared_ptr<BucketIndex> bi = ch->bucket_index(table_name);
+    std::vector<labels_list> big_r_ell;
+
+    unsigned int n = query_for_trio(a, i);
+    big_r_ell.reserve(n);
+    for (unsigned int r = 0; r < n; r++) {
+        const int *r_ell = trio_labels(bi, r);
+        big_r_ell.emplace_back(labels_list{r_ell[0], r_ell[1], r_ell[2]});
+    }
+    return big_r_ell;
+}
 
 BaseTriangle::StarsEither BaseTriangle::e_reduction () {
     pivot_c = {};
@@ -257,41 +265,46 @@ BaseTriangle::StarsEither BaseTriangle::e_reduction () {
     return StarsEither{{}, NO_CONFIDENT_R_EITHER};
 }
 
+/// Test the hypothesis that body stars c are a catalog trio. Pivot with the other body stars if necessary.
+BaseTriangle::StarsEither BaseTriangle::identify_trio (const index_trio &c) {
+    initialize_pivot(c); // Find matches of current body trio to catalog. Pivot if necessary.
+    TriosEither r = pivot(c);
+    big_r_1 = nullptr;
+
+    // Practical limit: exit early if we have iterated through too many comparisons without match.
+    if (nu > nu_max) return StarsEither{{}, EXCEEDED_NU_MAX_EITHER};
+
+    // Require that the pivot produces a meaningful result.
+    if (r.error == NO_CANDIDATE_STAR_SET_FOUND_EITHER) return StarsEither{{}, NO_CONFIDENT_A_EITHER};
+
+    // Find candidate stars around the candidate trio.
+    Star::list big_p = ch->nearby_hip_stars(r.result[0], be->get_fov(), 500);
+    nu++;
+
+    // Find the most likely map given the two pairs.
+    HOKU_TRACE(VERBOSE, TRIANGLE, "Performing DMT for [" << c[0] << "," << c[1] << "," << c[2] << "]");
+    StarsEither a = direct_match_test(big_p, r.result, {
+            be->get_image()->at(c[0]),
+            be->get_image()->at(c[1]),
+            be->get_image()->at(c[2])
+    });
+    if (a.error != NO_CONFIDENT_A_EITHER) HOKU_TRACE(INFO, TRIANGLE, "Match found!");
+    return a;
+}
+
 BaseTriangle::StarsEither BaseTriangle::e_identify () {
     pivot_c = {};
     nu = 0;
 
     // There exists |big_i| choose 3 possibilities.
+    std::vector<index_trio> c;
     for (int i = 0; i < static_cast<signed> (be->get_image()->size() - 2); i++) {
         for (int j = i + 1; j < static_cast<signed> (be->get_image()->size() - 1); j++) {
-            for (int k = j + 1; k < static_cast<signed> (be->get_image()->size()); k++) {
-                initialize_pivot({i, j, k}); // Find matches of current body trio to catalog. Pivot if necessary.
-                TriosEither r = pivot({i, j, k});
-                big_r_1 = nullptr;
-
-                // Practical limit: exit early if we have iterated through too many comparisons without match.
-                if (nu > nu_max) return StarsEither{{}, EXCEEDED_NU_MAX_EITHER};
-
-                // Require that the pivot produces a meaningful result.
-                if (r.error == NO_CANDIDATE_STAR_SET_FOUND_EITHER) continue;
-
-                // Find candidate stars around the candidate trio.
-                Star::list big_p = ch->nearby_hip_stars(r.result[0], be->get_fov(), 500);
-                nu++;
-
-                // Find the most likely map given the two pairs.
-                std::cout << "[TRIANGLE] Performing DMT for [" << i << "," << j << "," << k << "]" << std::endl;
-                StarsEither a = direct_match_test(big_p, r.result, {
-                        be->get_image()->at(i),
-                        be->get_image()->at(j),
-                        be->get_image()->at(k)
-                });
-                if (a.error != NO_CONFIDENT_A_EITHER) {
-                    std::cout << "[TRIANGLE] Match found!" << std::endl;
-                    return a;
-                }
-            }
+            for (int k = j + 1; k < static_cast<signed> (be->get_image()->size()); k++) c.push_back({i, j, k});
         }
     }
-    return StarsEither{{}, NO_CONFIDENT_A_EITHER};
+
+    return search(static_cast<unsigned int>(c.size()), [&c] (Identification &w, const unsigned int h) -> StarsEither {
+        return static_cast<BaseTriangle &>(w).identify_trio(c[h]);
+    });
 }
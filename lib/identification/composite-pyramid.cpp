@@ -11,32 +11,42 @@
 #include "identification/planar-triangle.h"
 #include "identification/composite-pyramid.h"
 
+const std::array<std::string, 2> Composite::QUERY_FOCI = {"a", "i"};
+const std::string Composite::QUERY_LABELS = "label_a, label_b, label_c";
 
 int Composite::generate_table (const std::shared_ptr<Chomp> &ch, double fov, const std::string &table_name) {
     return Plane::generate_table(ch, fov, table_name);
 }
 
-Composite::labels_list_list Composite::query_for_trios (const double a, const double i) {
-    std::vector<labels_list> big_r_ell;
-    Nibble::tuples_d matches;
+/// Search for all catalog trios whose planar area and moment are within our epsilon bounds of (a, i). As with
+/// BaseTriangle::query_for_trio, the candidates are left where they were found and are read with trio_labels.
+///
+/// @return The number of candidates found.
+unsigned int Composite::query_for_trios (const double a, const double i) {
+    std::shared_ptr<BucketIndex> bi = ch->bucket_index(table_name);
+
+    // Use the in-memory index if one exists for our table.
+    if (bi != nullptr) {
+        bi->bound_query(a - epsilon_1, a + epsilon_1, i - epsilon_2, i + epsilon_2, big_r_rows);
+        nu++;
+        return static_cast<unsigned int>(big_r_rows.size());
+    }
 
     // Query for candidates using all fields.
-    matches = ch->simple_bound_query(
-            {"a", "i"},
-            "label_a, label_b, label_c, i",
+    handle->bound_query(
+            QUERY_FOCI, QUERY_LABELS, "i",
             {a - epsilon_1, i - epsilon_2},
             {a + epsilon_1, i + epsilon_2},
-            500
+            big_r_results
     );
     nu++;
+    return static_cast<unsigned int>(big_r_results.size());
+}
 
-    // Next, search this trio for stars matching the moment condition.
-    big_r_ell.reserve(matches.size());
-    std::for_each(matches.begin(), matches.end(), [&big_r_ell] (const Chomp::tuple_d &t) -> void {
-        big_r_ell.emplace_back(labels_list{static_cast<int> (t[0]), static_cast<int> (t[1]), static_cast<int>(t[2])});
-    });
-
-    return big_r_ell;
+/// @return Pointer to the three labels of candidate r from our last query_for_trios. This is valid until our next
+/// search.
+const int *Composite::trio_labels (const std::shared_ptr<BucketIndex> &bi, const unsigned int r) const {
+    return (bi != nullptr) ? bi->labels(big_r_rows[r]) : big_r_results.labels(r);
 }
 
 bool Composite::verification (const Star::trio &r, const Star::trio &b) {
@@ -46,24 +56,30 @@ bool Composite::verification (const Star::trio &r, const Star::trio &b) {
         b_e = (be->get_image()->at(RandomDraw::draw_integer(0, b.size())));
     } while (std::find(b.begin(), b.end(), b_e) != b.end());
 
-    // Find all star trios between eij, eik, and ejk.
-    auto find_trios = [this, &b_e, &b] (const int m, const int n) -> labels_list_list {
-        return this->query_for_trios(Trio::planar_area(b_e, b[m], b[n]), Trio::planar_moment(b_e, b[m], b[n]));
+    // Find all star trios between eij, eik, and ejk. The first two labels of each are flattened and sorted for common.
+    std::shared_ptr<BucketIndex> bi = ch->bucket_index(table_name);
+    auto find_trios = [this, &bi, &b_e, &b] (const int m, const int n, labels_list &out_ell) -> void {
+        unsigned int n_r = this->query_for_trios(Trio::planar_area(b_e, b[m], b[n]),
+                                                 Trio::planar_moment(b_e, b[m], b[n]));
+        out_ell.clear();
+        for (unsigned int r = 0; r < n_r; r++) {
+            out_ell.push_back(trio_labels(bi, r)[0]), out_ell.push_back(trio_labels(bi, r)[1]);
+        }
+        std::sort(out_ell.begin(), out_ell.end());
     };
-    labels_list_list big_r_eij_ell = find_trios(0, 1), big_r_eik_ell = find_trios(0, 2);
-    labels_list_list big_r_ejk_ell = find_trios(1, 2);
+    find_trios(0, 1, big_r_ell_flat[0]), find_trios(0, 2, big_r_ell_flat[1]), find_trios(1, 2, big_r_ell_flat[2]);
 
     // Determine the star E in the catalog using common stars.
-    Star::list big_t_e = common(big_r_eij_ell, big_r_eik_ell, big_r_ejk_ell, Star::list{});
+    Star::list big_t_e = common(big_r_ell_flat[0], big_r_ell_flat[1], big_r_ell_flat[2], Star::list{});
 
     // If there isn't exactly one star, exit here.
     if (big_t_e.size() != 1 || big_t_e.empty()) {
-        std::cout << "[COMPOSITE] Verification failed." << std::endl;
+        HOKU_TRACE(VERBOSE, COMPOSITE, "Verification failed.");
         return false;
     }
 
     // If this star is near our R set in the catalog, then this test has passed.
-    std::cout << "[COMPOSITE] Verification passed." << std::endl;
+    HOKU_TRACE(VERBOSE, COMPOSITE, "Verification passed.");
     return Star::within_angle({r[0], r[1], r[2], big_t_e[0]}, be->get_fov());
 }
 
@@ -71,15 +87,17 @@ bool Composite::verification (const Star::trio &r, const Star::trio &b) {
 /// Two verification steps occur: the singular element test and the fourth star test. If these are not met, then the
 /// error trio is returned.
 Composite::TriosEither Composite::find_catalog_stars (const Star::trio &b_f) {
-    std::cout << "[COMPOSITE] Finding catalog stars." << std::endl;
-    labels_list_list big_r_ell = this->query_for_trios(Trio::planar_area(b_f[0], b_f[1], b_f[2]),
-                                                       Trio::planar_moment(b_f[0], b_f[1], b_f[2]));
+    HOKU_TRACE(VERBOSE, COMPOSITE, "Finding catalog stars.");
+    unsigned int n_r = this->query_for_trios(Trio::planar_area(b_f[0], b_f[1], b_f[2]),
+                                             Trio::planar_moment(b_f[0], b_f[1], b_f[2]));
 
-    if (big_r_ell.size() != 1) return TriosEither{{}, NO_CONFIDENT_R_FOUND_EITHER};
+    if (n_r != 1) return TriosEither{{}, NO_CONFIDENT_R_FOUND_EITHER};
 
-    // Otherwise, perform the identification (DMT performed below).
+    // Otherwise, perform the identification (DMT performed below). Our candidate is copied out before we search again.
+    const int *r_ell = trio_labels(ch->bucket_index(table_name), 0);
+    std::array<int, 3> r_0 = {r_ell[0], r_ell[1], r_ell[2]};
     std::array<Star::list, 6> big_m = {}, big_a = {};
-    Star::list big_p = ch->nearby_bright_stars(ch->query_hip(big_r_ell[0][0]), be->get_fov(),
+    Star::list big_p = ch->nearby_bright_stars(ch->query_hip(r_0[0]), be->get_fov(),
                                                static_cast<unsigned int>(3 * be->get_image()->size()));
     nu++;
 
@@ -95,13 +113,13 @@ Composite::TriosEither Composite::find_catalog_stars (const Star::trio &b_f) {
 
     // Determine the rotation to take frame R to B.
     for (unsigned int i = 0; i < 6; i++) {
-        std::array<int, 3> j = {big_r_ell[0][big_a_c[i][0]], big_r_ell[0][big_a_c[i][1]], big_r_ell[0][big_a_c[i][2]]};
+        std::array<int, 3> j = {r_0[big_a_c[i][0]], r_0[big_a_c[i][1]], r_0[big_a_c[i][2]]};
         Rotation q = Rotation::triad(
                 {b_f[0], b_f[1], b_f[2]},
                 {ch->query_hip(j[0]), ch->query_hip(j[1]), ch->query_hip(j[2])}
         );
 
-        big_m[i] = find_positive_overlay(*be->get_image(), big_p, q, this->epsilon_4);
+        big_m[i] = find_positive_overlay(big_p, q);
         big_a[i] = {ch->query_hip(j[0]), ch->query_hip(j[1]), ch->query_hip(j[2])};
     }
 
@@ -120,7 +138,6 @@ Composite::TriosEither Composite::find_catalog_stars (const Star::trio &b_f) {
 
 std::vector<Identification::labels_list> Composite::query () {
     std::vector<labels_list> big_r_ell = {};
-    Nibble::tuples_d matches;
 
     // First, search for trio of stars matching area condition.
     double a = Trio::planar_area(
@@ -131,29 +148,24 @@ std::vector<Identification::labels_list> Composite::query () {
             be->get_image()->at(0),
             be->get_image()->at(1),
             be->get_image()->at(2));
-    matches = ch->simple_bound_query(
-            {"a", "i"},
-            "label_a, label_b, label_c, i",
+    handle->bound_query(
+            QUERY_FOCI, QUERY_LABELS, "i",
             {a - epsilon_1, i - epsilon_2},
             {a + epsilon_1, i + epsilon_2},
-            500);
+            big_r_results);
 
     // Next, transform all stars into candidate set labels.
-    big_r_ell.reserve(matches.size());
-    std::for_each(matches.begin(), matches.end(), [&big_r_ell] (const Chomp::tuple_d &t) -> void {
-        big_r_ell.emplace_back(labels_list{
-                static_cast<int> (t[0]),
-                static_cast<int> (t[1]),
-                static_cast<int>(t[2])
-        });
-    });
+    big_r_ell.reserve(big_r_results.size());
+    for (unsigned int j = 0; j < big_r_results.size(); j++) {
+        const int *r_ell = big_r_results.labels(j);
+        big_r_ell.emplace_back(labels_list{r_ell[0], r_ell[1], r_ell[2]});
+    }
 
     // Return the trios.
     return big_r_ell;
 }
 
 Composite::StarsEither Composite::reduce () {
-    ch->select_table(this->table_name);
     nu = 0;
 
     for (unsigned int dj = 1; dj < be->get_image()->size() - 1; dj++) {
@@ -164,7 +176,7 @@ Composite::StarsEither Composite::reduce () {
                 // Practical limit: exit early if we have iterated through too many comparisons without match.
                 if (nu > this->nu_max) return StarsEither{{}, NO_CONFIDENT_R_EITHER};
 
-                labels_list_list big_r_ell = this->query_for_trios(
+                unsigned int n_r = this->query_for_trios(
                         Trio::planar_area(be->get_image()->at(i),
                                           be->get_image()->at(j),
                                           be->get_image()->at(k)),
@@ -173,11 +185,12 @@ Composite::StarsEither Composite::reduce () {
                                           be->get_image()->at(k))
                 );
 
-                if (big_r_ell.size() != 1) continue;
+                if (n_r != 1) continue;
+                const int *r_ell = trio_labels(ch->bucket_index(table_name), 0);
                 return StarsEither{Star::list{
-                        ch->query_hip(big_r_ell[0][0]),
-                        ch->query_hip(big_r_ell[0][1]),
-                        ch->query_hip(big_r_ell[0][2])
+                        ch->query_hip(r_ell[0]),
+                        ch->query_hip(r_ell[1]),
+                        ch->query_hip(r_ell[2])
                 }, 0};
             }
         }
@@ -4,7 +4,9 @@
 /// Source file for DotAngle class, which matches a set of body vectors (stars) to their inertial counter-parts in
 /// the database.
 
+#include <algorithm>
 #include <iostream>
+#include <tuple>
 
 #include "math/trio.h"
 #include "identification/dot-angle.h"
@@ -12,82 +14,99 @@
 const unsigned int Dot::QUERY_STAR_SET_SIZE = 3;
 const int Dot::NO_CANDIDATES_FOUND_EITHER = -1;
 const int Dot::NO_CANDIDATE_TRIO_FOUND_EITHER = -2;
+const std::array<std::string, 3> Dot::QUERY_FOCI = {"theta_1", "theta_2", "phi"};
+const std::string Dot::QUERY_LABELS = "label_a, label_b, label_c";
 
 int Dot::generate_table (const std::shared_ptr<Chomp> &ch, double fov, const std::string &table_name) {
-    // Exit early if the table already exists.
-    if (ch->create_table(
-            table_name,
-            "label_a INT, "
-            "label_b INT, "
-            "label_c INT, "
-            "theta_1 FLOAT, "
-            "theta_2 FLOAT, "
-            "phi FLOAT"
-    ) == Nibble::TABLE_NOT_CREATED_RET)
-        return TABLE_ALREADY_EXISTS;
-
-    ch->select_table(table_name);
-
-    // Iterate through all possible permutations of i, j, c...
-    Star::list all_stars = ch->bright_as_list();
-    for (unsigned int i = 0; i < all_stars.size(); i++) {
-        SQLite::Transaction transaction(*ch->conn);
-
-        for (unsigned int j = 0; j < all_stars.size(); j++) {
-            for (unsigned int c = 0; c < all_stars.size(); c++) {
-                if (i == j || i == c || j == c) continue;
-
-                // Compute each feature (theta^1, theta^2, phi).
-                double theta_1 = (180.0 / M_PI) * Vector3::Angle(all_stars[c], all_stars[i]);
-                double theta_2 = (180.0 / M_PI) * Vector3::Angle(all_stars[c], all_stars[j]);
-                double phi = Trio::dot_angle(all_stars[i], all_stars[j], all_stars[c]);
-
-                // Condition 6d: theta^1 < theta^2.
-                if (theta_1 < theta_2 && Star::within_angle({all_stars[i], all_stars[j], all_stars[c]}, fov)) {
-                    ch->insert_into_table(
-                            "label_a, label_b, label_c, theta_1, theta_2, phi",
-                            Nibble::tuple_d{
-                                    static_cast<double> (all_stars[i].get_label()),
-                                    static_cast<double>(all_stars[j].get_label()),
-                                    static_cast<double> (all_stars[c].get_label()),
-                                    theta_1,
-                                    theta_2,
-                                    phi
-                            });
+    return generate_tables(ch, find_neighborhood(ch, fov), {table_name});
+}
+
+int Dot::generate_tables (const std::shared_ptr<Chomp> &ch, const Neighborhood &nb,
+                          const std::vector<std::string> &table_names) {
+    // Our tables are clustered on our features, so they need no separate index.
+    return load_tables(ch, table_names,
+                       "label_a INT, label_b INT, label_c INT, theta_1 FLOAT, theta_2 FLOAT, phi FLOAT",
+                       "theta_1, theta_2, phi, label_a, label_b, label_c",
+                       "label_a, label_b, label_c, theta_1, theta_2, phi", [&nb] () -> Nibble::tuple_d {
+        struct DotRow {
+            int ell[3];
+            double theta_1, theta_2, phi;
+        };
+        std::vector<std::vector<DotRow>> thread_rows(count_generation_threads());
+
+        // Every feasible trio gives up to three rows, one for each star as the central star c. Of (i, j, c) and
+        // (j, i, c), only the one with theta^1 < theta^2 is kept (condition 6d).
+        distribute_pivots(static_cast<unsigned int>(nb.stars.size()), static_cast<unsigned int>(thread_rows.size()),
+                          [&] (const unsigned int i, const unsigned int t) -> void {
+            for (const std::array<unsigned int, 2> &jk : nb.trios[i]) {
+                for (const std::array<unsigned int, 3> &cpq : {std::array<unsigned int, 3>{i, jk[0], jk[1]},
+                                                               std::array<unsigned int, 3>{jk[0], i, jk[1]},
+                                                               std::array<unsigned int, 3>{jk[1], i, jk[0]}}) {
+                    const Star &b_c = nb.stars[cpq[0]], &b_p = nb.stars[cpq[1]], &b_q = nb.stars[cpq[2]];
+                    double theta_p = (180.0 / M_PI) * Vector3::Angle(b_c, b_p);
+                    double theta_q = (180.0 / M_PI) * Vector3::Angle(b_c, b_q);
+                    if (theta_p == theta_q) continue;
+
+                    // Compute each feature (theta^1, theta^2, phi), with b_i as the star closer to c.
+                    const Star &b_i = (theta_p < theta_q) ? b_p : b_q, &b_j = (theta_p < theta_q) ? b_q : b_p;
+                    thread_rows[t].push_back(DotRow{
+                            {b_i.get_label(), b_j.get_label(), b_c.get_label()},
+                            std::min(theta_p, theta_q), std::max(theta_p, theta_q), Trio::dot_angle(b_i, b_j, b_c)
+                    });
                 }
             }
+        });
+
+        // Merge our buffers and sort by our entire key (theta^1, theta^2, phi, then labels), so the rows can be written
+        // in their final order. The order of our buffers depends on which thread took each pivot, so ties must be
+        // broken here.
+        std::vector<DotRow> rows;
+        for (std::vector<DotRow> &t_rows : thread_rows) {
+            rows.insert(rows.end(), t_rows.begin(), t_rows.end());
+            std::vector<DotRow>().swap(t_rows);
         }
-        transaction.commit();
-    }
-    return ch->sort_and_index("theta_1, theta_2, phi");
+        std::sort(rows.begin(), rows.end(), [] (const DotRow &r_1, const DotRow &r_2) -> bool {
+            return std::tie(r_1.theta_1, r_1.theta_2, r_1.phi, r_1.ell[0], r_1.ell[1], r_1.ell[2]) <
+                   std::tie(r_2.theta_1, r_2.theta_2, r_2.phi, r_2.ell[0], r_2.ell[1], r_2.ell[2]);
+        });
+
+        Nibble::tuple_d values;
+        values.reserve(6 * rows.size());
+        for (const DotRow &r : rows) {
+            values.insert(values.end(), {static_cast<double>(r.ell[0]), static_cast<double>(r.ell[1]),
+                                         static_cast<double>(r.ell[2]), r.theta_1, r.theta_2, r.phi});
+        }
+        return values;
+    });
 }
 
-Dot::LabelsEither Dot::query_for_trio (double theta_1, double theta_2, double phi) {
-    std::vector<labels_list> big_r_ell;
-    Nibble::tuples_d matches;
+/// Search for the first catalog trio whose features are within our epsilon bounds of (theta_1, theta_2, phi). As with
+/// Angle::query_for_pair, the labels are read where they lie instead of being copied.
+///
+/// @return Pointer to the three labels of the first candidate, valid until our next search. Otherwise, nullptr.
+const int *Dot::query_for_trio (double theta_1, double theta_2, double phi) {
+    std::shared_ptr<FeatureGrid> fg = ch->feature_grid(table_name);
+
+    // Use the in-memory index if one exists for our table. We only need the first candidate here.
+    if (fg != nullptr) {
+        fg->bound_query({theta_1 - epsilon_1, theta_2 - epsilon_2, phi - epsilon_3},
+                        {theta_1 + epsilon_1, theta_2 + epsilon_2, phi + epsilon_3}, big_r_rows);
+        nu++;
+
+        return (big_r_rows.empty()) ? nullptr : fg->labels(big_r_rows[0]);
+    }
 
     // Query for candidates using all fields.
-    matches = ch->simple_bound_query(
-            {"theta_1", "theta_2", "phi"},
-            "label_a, label_b, label_c",
+    handle->bound_query(
+            QUERY_FOCI, QUERY_LABELS, "",
             {theta_1 - epsilon_1, theta_2 - epsilon_2, phi - epsilon_3},
             {theta_1 + epsilon_1, theta_2 + epsilon_2, phi + epsilon_3},
-            500
+            big_r_results
     );
     nu++;
 
-    // Transform each tuple into a candidate list of labels.
-    big_r_ell.reserve(matches.size());
-    std::for_each(matches.begin(), matches.end(), [&big_r_ell] (const Chomp::tuple_d &t) -> void {
-        big_r_ell.emplace_back(labels_list{
-                static_cast<int> (t[0]),
-                static_cast<int> (t[1]),
-                static_cast<int>(t[2])
-        });
-    });
-
-    if (big_r_ell.empty()) return LabelsEither{{}, NO_CANDIDATES_FOUND_EITHER};
-    else return LabelsEither{big_r_ell[0], 0};
+    // We only need the first candidate here.
+    return (big_r_results.empty()) ? nullptr : big_r_results.labels(0);
 }
 
 Dot::TriosEither Dot::find_candidate_trio (const Star &b_i, const Star &b_j, const Star &b_c) {
@@ -101,14 +120,14 @@ Dot::TriosEither Dot::find_candidate_trio (const Star &b_i, const Star &b_j, con
     }
 
     // If not candidate is found, break early.
-    LabelsEither big_r_ell = this->query_for_trio(theta_1, theta_2, phi);
-    if (big_r_ell.error == NO_CANDIDATES_FOUND_EITHER) return TriosEither{{}, NO_CANDIDATE_TRIO_FOUND_EITHER};
+    const int *r_ell = this->query_for_trio(theta_1, theta_2, phi);
+    if (r_ell == nullptr) return TriosEither{{}, NO_CANDIDATE_TRIO_FOUND_EITHER};
 
     // Otherwise, obtain and return the inertial vectors for the given candidates.
     return {Star::trio{
-            ch->query_hip(big_r_ell.result[0]),
-            ch->query_hip(big_r_ell.result[1]),
-            ch->query_hip(big_r_ell.result[2])
+            ch->query_hip(r_ell[0]),
+            ch->query_hip(r_ell[1]),
+            ch->query_hip(r_ell[2])
     }, 0};
 }
 
@@ -144,7 +163,6 @@ Star::trio Dot::find_closest (const Star &b_i) {
 
 std::vector<Identification::labels_list> Dot::query () {
     std::vector<labels_list> big_r_ell;
-    Nibble::tuples_d matches;
 
     double theta_1 = (180.0 / M_PI) * Vector3::Angle(be->get_image()->at(2), be->get_image()->at(0));
     double theta_2 = (180.0 / M_PI) * Vector3::Angle(be->get_image()->at(2), be->get_image()->at(1));
@@ -156,30 +174,38 @@ std::vector<Identification::labels_list> Dot::query () {
         theta_1 = theta_2, theta_2 = theta_t;
     }
 
+    // Use the in-memory index if one exists for our table.
+    std::shared_ptr<FeatureGrid> fg = ch->feature_grid(table_name);
+    if (fg != nullptr) {
+        fg->bound_query({theta_1 - epsilon_1, theta_2 - epsilon_2, phi - epsilon_3},
+                        {theta_1 + epsilon_1, theta_2 + epsilon_2, phi + epsilon_3}, big_r_rows);
+        big_r_ell.reserve(big_r_rows.size());
+        for (const unsigned int p : big_r_rows) {
+            big_r_ell.emplace_back(labels_list{fg->labels(p)[0], fg->labels(p)[1], fg->labels(p)[2]});
+        }
+        return big_r_ell;
+    }
+
     // Query for our candidate set.
-    matches = ch->simple_bound_query(
-            {"theta_1", "theta_2", "phi"},
-            "label_a, label_b, label_c",
+    handle->bound_query(
+            QUERY_FOCI, QUERY_LABELS, "",
             {theta_1 - epsilon_1, theta_2 - epsilon_2, phi - epsilon_3},
             {theta_1 + epsilon_1, theta_2 + epsilon_2, phi + epsilon_3},
-            500
+            big_r_results
     );
 
-    // Transform candidate set tuples into labels list.
-    big_r_ell.reserve(matches.size());
-    std::for_each(matches.begin(), matches.end(), [&big_r_ell] (const Chomp::tuple_d &t) -> void {
-        big_r_ell.emplace_back(labels_list{
-                static_cast<int> (t[0]),
-                static_cast<int> (t[1]),
-                static_cast<int>(t[2])
-        });
-    });
+    // Transform candidate set rows into labels list.
+    big_r_ell.reserve(big_r_results.size());
+    for (unsigned int i = 0; i < big_r_results.size(); i++) {
+        const int *r_ell = big_r_results.labels(i);
+        big_r_ell.emplace_back(labels_list{r_ell[0], r_ell[1], r_ell[2]});
+    }
 
     return big_r_ell;
 }
 
 Identification::StarsEither Dot::reduce () {
-    ch->select_table(table_name), nu = 0;
+    nu = 0;
 
     for (const Star &c : *be->get_image()) {
         Star::trio b = find_closest(c);
@@ -196,42 +222,43 @@ Identification::StarsEither Dot::reduce () {
     return StarsEither{{}, NO_CONFIDENT_R_EITHER};
 }
 
+/// Test the hypothesis that body stars b form a catalog trio, with b[2] as its center.
+Identification::StarsEither Dot::identify_trio (const Star::trio &b) {
+    bool is_swapped = false;
+
+    // Determine which stars map to the current 'b'. If this fails, swap b_i and b_j.
+    HOKU_TRACE(VERBOSE, DOT, "Finding candidate trio.");
+    TriosEither r = find_candidate_trio(b[0], b[1], b[2]);
+    // if (r.error == NO_CANDIDATE_TRIO_FOUND_EITHER) {
+    //     HOKU_TRACE(VERBOSE, DOT, "Reversing candidate trio.");
+    //     r = find_candidate_trio(b[0], b[1], b[2]), is_swapped = true;
+    // }
+
+    // If there exist no matches at this point, then repeat for another pair.
+    if (r.error == NO_CANDIDATE_TRIO_FOUND_EITHER) return StarsEither{{}, NO_CONFIDENT_A_EITHER};
+
+    // Otherwise, attach the labels to the body and return this set.
+    HOKU_TRACE(INFO, DOT, "Match found!");
+    return StarsEither{Star::list{
+            Star::define_label(b[2], r.result[2].get_label()),
+            Star::define_label(b[(is_swapped) ? 1 : 0], r.result[0].get_label()),
+            Star::define_label(b[(is_swapped) ? 0 : 1], r.result[1].get_label())
+    }, 0};
+}
+
 Identification::StarsEither Dot::identify () {
     nu = 0;
 
+    std::vector<Star::trio> c;
     for (int i = 0; i < static_cast<signed> (be->get_image()->size() - 2); i++) {
-	    for (int j = i + 1; j < static_cast<signed> (be->get_image()->size() - 1); j++) {
-		    for (int k = i + 2; k < static_cast<signed> (be->get_image()->size()); k++) {
-			    Star::trio b = {be->get_image()->at(i),
-				            be->get_image()->at(j),
-				            be->get_image()->at(k)};
-    // for (const Star &c : *be->get_image()) {
-        // Star::trio b = find_closest(c);
-        bool is_swapped = false;
-
-        // Practical limit: exit early if we have iterated through too many comparisons without match.
-        if (nu > nu_max) return StarsEither{{}, EXCEEDED_NU_MAX_EITHER};
-
-        // Determine which stars map to the current 'b'. If this fails, swap b_i and b_j.
-        std::cout << "[DOT] Finding candidate trio." << std::endl;
-        TriosEither r = find_candidate_trio(b[0], b[1], b[2]);
-        // if (r.error == NO_CANDIDATE_TRIO_FOUND_EITHER) {
-        //     std::cout << "[DOT] Reversing candidate trio." << std::endl;
-        //     r = find_candidate_trio(b[0], b[1], b[2]), is_swapped = true;
-        // }
-
-        // If there exist no matches at this point, then repeat for another pair.
-        if (r.error == NO_CANDIDATE_TRIO_FOUND_EITHER) continue;
-
-        // Otherwise, attach the labels to the body and return this set.
-        std::cout << "[DOT] Match found!" << std::endl;
-        return StarsEither{Star::list{
-                Star::define_label(b[2], r.result[2].get_label()),
-                Star::define_label(b[(is_swapped) ? 1 : 0], r.result[0].get_label()),
-                Star::define_label(b[(is_swapped) ? 0 : 1], r.result[1].get_label())
-        }, 0};
-		    }}}
-    // }
+        for (int j = i + 1; j < static_cast<signed> (be->get_image()->size() - 1); j++) {
+            for (int k = i + 2; k < static_cast<signed> (be->get_image()->size()); k++) {
+                c.push_back({be->get_image()->at(i), be->get_image()->at(j), be->get_image()->at(k)});
+            }
+        }
+    }
 
-    return StarsEither{{}, NO_CONFIDENT_A_EITHER};
+    return search(static_cast<unsigned int>(c.size()), [&c] (Identification &w, const unsigned int h) -> StarsEither {
+        return static_cast<Dot &>(w).identify_trio(c[h]);
+    });
 }
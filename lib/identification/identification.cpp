@@ -3,7 +3,14 @@
 ///
 /// Source file for Identification class, which holds all common data between all identification processes.
 
+#define _USE_MATH_DEFINES
+
+#include <atomic>
+#include <cmath>
+#include <exception>
+#include <mutex>
 #include <numeric>
+#include <thread>
 
 #include "math/random-draw.h"
 #include "benchmark/benchmark.h"
@@ -23,30 +30,410 @@ Identification::Identification (const std::shared_ptr<Benchmark> &be, const std:
     this->nu_max = nu_max, this->nu = 0;
     this->be = be, this->ch = ch;
 
-    this->ch->select_table(this->table_name);
+    // Search our table through a handle of our own, so identifiers on other threads can share our Chomp.
+    this->handle = std::make_shared<Chomp::Handle>(ch, table_name);
 }
 
 unsigned int Identification::get_nu () { return this->nu; }
 
-/// Rotate every point with the given rotation and check if the angle of separation between any two stars is within a
-/// given limit sigma.
-Star::list Identification::find_positive_overlay (const Star::list &big_i, const Star::list &big_p, const Rotation &q,
-                                                  double epsilon) {
+/// Identify the given image on our next call to query(), reduce() or identify(). Our buffers and table handle are kept.
+void Identification::given_image (const std::shared_ptr<Benchmark> &image) {
+    this->be = image, this->nu = 0, this->image_overlay = nullptr;
+}
+
+/// Test the hypotheses [0, n) of an identify() call, and return the first that is verified. test(w, h) tests hypothesis
+/// h with identifier w, adding the comparisons it makes to w's nu. A result with no error is a verified match,
+/// EXCEEDED_NU_MAX_EITHER ends the search, and any other error moves on to the next hypothesis.
+///
+/// On more than one thread, hypotheses are handed out in order to our search workers (each with its own buffers and
+/// table handle). Workers stop taking hypotheses once a match is found or nu_max is exceeded. If our search is not
+/// deterministic, the first match found by any worker wins. Otherwise, every hypothesis before the best match is still
+/// tested, and we return what a single thread would. In this case, each hypothesis is first tested with its own
+/// count of comparisons. Our hypotheses are then resolved in order: the one hypothesis (if any) during which a single
+/// thread would have exceeded nu_max is tested again here, with nu seeded by the comparisons of every hypothesis before
+/// it. Its checks of nu_max thus fire exactly where they would have on a single thread.
+Identification::StarsEither Identification::search (const unsigned int n, const std::function<StarsEither (
+        Identification &, unsigned int)> &test) {
+    // Our image is hashed once for all of these hypotheses. Our workers share this hash.
+    this->image_overlay = std::make_shared<const Overlay>(*be->get_image(), epsilon_4);
+    StarsEither a = search_hypotheses(n, test);
+    this->image_overlay = nullptr;
+    return a;
+}
+
+/// Test the hypotheses [0, n) of an identify() call, as described in search.
+Identification::StarsEither Identification::search_hypotheses (const unsigned int n, const std::function<StarsEither (
+        Identification &, unsigned int)> &test) {
+    if (n_search_threads <= 1 || n <= 1 || !build_search_worker) {
+        for (unsigned int h = 0; h < n; h++) {
+            // Practical limit: exit early if we have iterated through too many comparisons without match.
+            if (nu > nu_max) return StarsEither{{}, EXCEEDED_NU_MAX_EITHER};
+
+            StarsEither a = test(*this, h);
+            if (a.error == 0 || a.error == EXCEEDED_NU_MAX_EITHER) return a;
+        }
+        return StarsEither{{}, NO_CONFIDENT_A_EITHER};
+    }
+
+    const unsigned int n_workers = std::min(n_search_threads, n);
+    while (search_workers.size() < n_workers - 1) search_workers.push_back(build_search_worker());
+    for (const std::shared_ptr<Identification> &w : search_workers) {
+        w->given_image(be), w->image_overlay = image_overlay;
+    }
+
+    // A hypothesis is only taken if no worker has stopped our search, and every hypothesis taken is tested. The tested
+    // hypotheses are thus always [0, next_h), less those after the best match.
+    std::atomic<unsigned int> next_h(0), best_h(n), total_nu(0);
+    std::atomic<bool> is_stopped(false);
+    std::vector<StarsEither> outcomes(n);
+    std::vector<unsigned int> outcome_nu(n, 0);
+    std::vector<char> is_tested(n, 0);
+
+    StarsEither first = StarsEither{{}, NO_CONFIDENT_A_EITHER};
+    std::exception_ptr first_error = nullptr;
+    std::mutex result_mutex;
+    auto work = [&] (Identification &w) -> void {
+        try {
+            while (!is_stopped) {
+                const unsigned int h = next_h++;
+                if (h >= n || h > best_h) return;
+
+                // A deterministic search counts the comparisons of each hypothesis on its own. The prefix sum of these
+                // is only known once every hypothesis before it is done, so nu_max is applied when we resolve them.
+                w.nu = (is_search_deterministic) ? 0 : total_nu.load();
+                const unsigned int nu_before = w.nu;
+                StarsEither a = test(w, h);
+                const bool is_final = a.error == 0 || a.error == EXCEEDED_NU_MAX_EITHER;
+                const unsigned int nu_after = (total_nu += w.nu - nu_before);
+
+                if (is_search_deterministic) {
+                    outcomes[h] = std::move(a), outcome_nu[h] = w.nu, is_tested[h] = 1;
+                    for (unsigned int b = best_h; is_final && h < b && !best_h.compare_exchange_weak(b, h););
+                    if (nu_after > nu_max) is_stopped = true;
+                }
+                else if (is_final || nu_after > nu_max) {
+                    std::lock_guard<std::mutex> guard(result_mutex);
+                    if (!is_stopped) first = is_final ? std::move(a) : StarsEither{{}, EXCEEDED_NU_MAX_EITHER};
+                    is_stopped = true;
+                }
+            }
+        }
+        catch (...) {
+            std::lock_guard<std::mutex> guard(result_mutex);
+            if (first_error == nullptr) first_error = std::current_exception();
+            is_stopped = true;
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned int t = 0; t < n_workers - 1; t++) threads.emplace_back(work, std::ref(*search_workers[t]));
+    work(*this);
+    for (std::thread &thread : threads) thread.join();
+    if (first_error != nullptr) std::rethrow_exception(first_error);
+
+    if (!is_search_deterministic) {
+        nu = total_nu;
+        return first;
+    }
+
+    // Walk through our hypotheses as a single thread would have. A hypothesis is only affected by the comparisons
+    // before it if nu_max is exceeded by its end (nu only grows). This one is tested again, starting from these.
+    nu = 0;
+    for (unsigned int h = 0; h < n; h++) {
+        if (nu > nu_max) return StarsEither{{}, EXCEEDED_NU_MAX_EITHER};
+        if (!is_tested[h]) break;
+
+        if (nu + outcome_nu[h] > nu_max) {
+            StarsEither a = test(*this, h);
+            if (a.error == 0 || a.error == EXCEEDED_NU_MAX_EITHER) return a;
+            continue;
+        }
+        nu += outcome_nu[h];
+        if (outcomes[h].error == 0 || outcomes[h].error == EXCEEDED_NU_MAX_EITHER) return outcomes[h];
+    }
+    return StarsEither{{}, NO_CONFIDENT_A_EITHER};
+}
+
+/// Rotate every point with the given rotation and find the first star of our image within epsilon_4 of each. Inside of
+/// a search, the hash of our image built for that search is used. Otherwise, our image is hashed here.
+///
+/// @return Each matched image star, with the label of the rotated point it matched.
+Star::list Identification::find_positive_overlay (const Star::list &big_p, const Rotation &q) {
+    if (image_overlay != nullptr) return image_overlay->find_matches(big_p, q);
+    return Overlay(*be->get_image(), epsilon_4).find_matches(big_p, q);
+}
+
+/// Constructor. Sort each star of the image into its bucket. Epsilon is given in degrees. No star is ever matched if
+/// epsilon is not positive, as no angle of separation is below it.
+Identification::Overlay::Overlay (const Star::list &big_i, const double epsilon) : big_i(big_i) {
+    const double theta = std::min(M_PI, epsilon * M_PI / 180.0);
+    const unsigned int n_stars = (epsilon > 0) ? static_cast<unsigned int>(big_i.size()) : 0;
+
+    // Two stars within epsilon are less than a chord apart (padded here against rounding). Our cells are two chords
+    // wide, so the points within a chord of any point cross at most one cell boundary along each axis.
+    this->cos_epsilon = std::cos(theta), this->chord = 2.0 * std::sin(theta / 2.0) * (1.0 + 1.0e-9);
+    this->cell_width = std::max(2.0 * chord, 1.0e-12);
+    for (this->n_buckets = 64; n_buckets < 2 * n_stars; n_buckets *= 2);
+
+    // Bucket our stars. Stars in the same bucket keep their order in the image.
+    std::vector<unsigned int> bucket(n_stars);
+    this->bucket_start.assign(n_buckets + 1, 0);
+    for (unsigned int i = 0; i < n_stars; i++) {
+        const Vector3 s = Vector3::Normalized(big_i[i]);
+        bucket[i] = bucket_for(static_cast<long long>(std::floor(s.X / cell_width)),
+                               static_cast<long long>(std::floor(s.Y / cell_width)),
+                               static_cast<long long>(std::floor(s.Z / cell_width)));
+        this->bucket_start[bucket[i] + 1]++;
+    }
+    for (unsigned int b = 0; b < n_buckets; b++) this->bucket_start[b + 1] += this->bucket_start[b];
+
+    std::vector<unsigned int> next(bucket_start.begin(), bucket_start.end() - 1);
+    this->member.resize(n_stars), this->points.resize(3 * n_stars);
+    for (unsigned int i = 0; i < n_stars; i++) {
+        const unsigned int r = next[bucket[i]]++;
+        const Vector3 s = Vector3::Normalized(big_i[i]);
+        this->member[r] = i;
+        this->points[3 * r] = s.X, this->points[3 * r + 1] = s.Y, this->points[3 * r + 2] = s.Z;
+    }
+}
+
+/// @return Bucket of the cell (x, y, z). Distinct cells may share a bucket.
+unsigned int Identification::Overlay::bucket_for (const long long x, const long long y, const long long z) const {
+    const auto h = static_cast<unsigned long long>(x) * 73856093ULL ^ static_cast<unsigned long long>(y) * 19349663ULL
+                   ^ static_cast<unsigned long long>(z) * 83492791ULL;
+    return static_cast<unsigned int>(h & (n_buckets - 1));
+}
+
+/// Find the first star of our image (in image order, as a linear search would) within epsilon of the point r. Only
+/// the buckets of the cells within a chord of r are visited.
+///
+/// @return Index of this star in our image, or -1 if no star is within epsilon of r.
+int Identification::Overlay::find_first_within (const Vector3 &r) const {
+    if (member.empty()) return -1;
+
+    const Vector3 f = Vector3::Normalized(r);
+    const double p[3] = {f.X, f.Y, f.Z};
+    long long c[3], lo[3], hi[3];
+    for (unsigned int a = 0; a < 3; a++) {
+        c[a] = static_cast<long long>(std::floor(p[a] / cell_width));
+        lo[a] = (p[a] - c[a] * cell_width < chord) ? c[a] - 1 : c[a];
+        hi[a] = ((c[a] + 1) * cell_width - p[a] < chord) ? c[a] + 1 : c[a];
+    }
+
+    int first = -1;
+    for (long long x = lo[0]; x <= hi[0]; x++) {
+        for (long long y = lo[1]; y <= hi[1]; y++) {
+            for (long long z = lo[2]; z <= hi[2]; z++) {
+                const unsigned int b = bucket_for(x, y, z);
+
+                // Members of a bucket are in image order, so we stop at the first match (or at any later star).
+                for (unsigned int m = bucket_start[b]; m < bucket_start[b + 1]; m++) {
+                    if (first >= 0 && member[m] >= static_cast<unsigned int>(first)) break;
+                    if (p[0] * points[3 * m] + p[1] * points[3 * m + 1] + p[2] * points[3 * m + 2] > cos_epsilon) {
+                        first = static_cast<int>(member[m]);
+                        break;
+                    }
+                }
+            }
+        }
+    }
+    return first;
+}
+
+/// Rotate every point with the given rotation and match it with the first star of our image within epsilon. Points
+/// are visited in a random order, as before.
+///
+/// @return Each matched image star, with the label of the rotated point it matched.
+Star::list Identification::Overlay::find_matches (const Star::list &big_p, const Rotation &q) const {
     Star::list big_p_c = big_p, m;
 
     std::shuffle(big_p_c.begin(), big_p_c.end(), RandomDraw::mersenne_twister);
-    std::for_each(big_p_c.begin(), big_p_c.end(), [&] (const Star &p_i) -> void {
+    for (const Star &p_i : big_p_c) {
         Star r_prime = Rotation::rotate(p_i, q);
+        const int i = find_first_within(r_prime);
+        if (i >= 0) m.emplace_back(Star(big_i[i][0], big_i[i][1], big_i[i][2], r_prime.get_label()));
+    }
+
+    return m;
+}
 
-        for (const Star &i_i : big_i) {
-            if (Star::within_angle(r_prime, i_i, epsilon)) {
-                m.emplace_back(Star(i_i[0], i_i[1], i_i[2], r_prime.get_label()));
+/// Find the neighbors of every star in the given list: all stars after it in the list that are within fov degrees of
+/// it. Any catalog pair or trio whose stars all lie within fov of each other must be built from these lists alone.
+///
+/// @return Ascending indices of the neighbors of each star in all_stars.
+std::vector<std::vector<unsigned int>> Identification::find_fov_neighbors (const Star::list &all_stars,
+                                                                           const double fov) {
+    std::vector<std::vector<unsigned int>> near(all_stars.size());
+    SkyGrid grid(all_stars);
+
+    for (unsigned int i = 0; i < all_stars.size(); i++) {
+        std::vector<unsigned int> nearby = grid.cone_query(all_stars[i], fov);
+        near[i].assign(std::upper_bound(nearby.begin(), nearby.end(), i), nearby.end());
+    }
+    return near;
+}
 
-                // Break early, we have found our match.
-                break;
+/// @return The number of threads to generate our tables with (one per core).
+unsigned int Identification::count_generation_threads () { return std::max(1u, std::thread::hardware_concurrency()); }
+
+/// Run work(i, t) for every pivot i in [0, n) using n_threads threads, where t is the index of the thread running the
+/// pivot. Pivots are handed out one at a time, as the amount of work per pivot varies greatly across the sky. The
+/// first exception thrown by work stops every thread after its current pivot, and is rethrown here once every thread
+/// has stopped.
+void Identification::distribute_pivots (const unsigned int n, const unsigned int n_threads,
+                                        const std::function<void (unsigned int, unsigned int)> &work) {
+    std::atomic<unsigned int> next_pivot(0);
+    std::exception_ptr first_error = nullptr;
+    std::mutex error_mutex;
+    std::vector<std::thread> workers;
+
+    for (unsigned int t = 0; t < n_threads; t++) {
+        workers.emplace_back([&, n, t] () -> void {
+            try {
+                for (unsigned int i = next_pivot++; i < n; i = next_pivot++) work(i, t);
+            }
+            catch (...) {
+                std::lock_guard<std::mutex> guard(error_mutex);
+                if (first_error == nullptr) first_error = std::current_exception();
+                next_pivot = n;
+            }
+        });
+    }
+    for (std::thread &worker : workers) worker.join();
+
+    if (first_error != nullptr) std::rethrow_exception(first_error);
+}
+
+/// Run work(i, t) for every item i in [0, n) using n_threads threads, where t is the index of the thread running the
+/// item. Each thread starts with a contiguous share of [0, n) and takes items from its front. A thread with nothing
+/// left steals the back half of the largest remaining share, so no thread idles while items remain. The first
+/// exception thrown by work is rethrown here, once every thread has stopped.
+void Identification::steal_work (const unsigned int n, const unsigned int n_threads,
+                                 const std::function<void (unsigned int, unsigned int)> &work) {
+    // Each share is packed into one word (front in the high half, back in the low half). Its owner and a thief both
+    // change it through a compare-and-swap, so no item is ever taken twice.
+    auto pack = [] (const uint64_t front, const uint64_t back) -> uint64_t { return front << 32 | back; };
+    auto front = [] (const uint64_t s) -> unsigned int { return static_cast<unsigned int>(s >> 32); };
+    auto back = [] (const uint64_t s) -> unsigned int { return static_cast<unsigned int>(s); };
+    auto length = [&] (const uint64_t s) -> unsigned int { return (back(s) > front(s)) ? back(s) - front(s) : 0; };
+
+    std::vector<std::atomic<uint64_t>> shares(n_threads);
+    for (unsigned int t = 0; t < n_threads; t++) {
+        shares[t].store(pack(static_cast<uint64_t>(n) * t / n_threads, static_cast<uint64_t>(n) * (t + 1) / n_threads));
+    }
+
+    std::exception_ptr first_error = nullptr;
+    std::mutex error_mutex;
+    std::vector<std::thread> workers;
+    for (unsigned int t = 0; t < n_threads; t++) {
+        workers.emplace_back([&, t] () -> void {
+            try {
+                for (;;) {
+                    uint64_t s = shares[t].load();
+                    while (length(s) > 0 && !shares[t].compare_exchange_weak(s, pack(front(s) + 1, back(s))));
+                    if (length(s) > 0) {
+                        work(front(s), t);
+                        continue;
+                    }
+
+                    // Our share is empty. Take the back half of the largest share left, or stop if none are left.
+                    for (bool is_stolen = false; !is_stolen;) {
+                        unsigned int victim = n_threads;
+                        uint64_t victim_s = 0;
+                        for (unsigned int v = 0; v < n_threads; v++) {
+                            uint64_t v_s = shares[v].load();
+                            if (v != t && length(v_s) > length(victim_s)) victim = v, victim_s = v_s;
+                        }
+                        if (victim == n_threads) return;
+
+                        const unsigned int middle = front(victim_s) + length(victim_s) / 2;
+                        if (shares[victim].compare_exchange_strong(victim_s, pack(front(victim_s), middle))) {
+                            shares[t].store(pack(middle, back(victim_s)));
+                            is_stolen = true;
+                        }
+                    }
+                }
+            }
+            catch (...) {
+                std::lock_guard<std::mutex> guard(error_mutex);
+                if (first_error == nullptr) first_error = std::current_exception();
+            }
+        });
+    }
+    for (std::thread &worker : workers) worker.join();
+
+    if (first_error != nullptr) std::rethrow_exception(first_error);
+}
+
+/// Find the FOV-feasible pairs of the BRIGHT catalog, and (if requested) every trio whose stars are all within fov of
+/// each other. Trios are found per pivot across all cores, and are kept grouped by their pivot.
+///
+/// @param ch Catalog to take the BRIGHT stars from.
+/// @param fov Field-of-view limit (degrees) that all stars of a pair or trio must be within.
+/// @param with_trios If true, enumerate the trios as well as the pairs.
+/// @return The stars, their neighbor lists, and the trios built from these.
+Identification::Neighborhood Identification::find_neighborhood (const std::shared_ptr<Chomp> &ch, const double fov,
+                                                                const bool with_trios) {
+    return find_neighborhood(ch->bright_as_list(), fov, with_trios);
+}
+
+/// Find the FOV-feasible pairs and (if requested) trios of the given stars. The trios of each pivot i are in the same
+/// order for any number of threads: ascending by j, then by k.
+///
+/// @param stars Stars to find the pairs and trios of. Indices in the result refer to this list.
+/// @param fov Field-of-view limit (degrees) that all stars of a pair or trio must be within.
+/// @param with_trios If true, enumerate the trios as well as the pairs.
+/// @return The stars, their neighbor lists, and the trios built from these.
+Identification::Neighborhood Identification::find_neighborhood (const Star::list &stars, const double fov,
+                                                                const bool with_trios) {
+    Neighborhood nb;
+    nb.stars = stars, nb.fov = fov;
+    nb.near = find_fov_neighbors(nb.stars, fov);
+    if (!with_trios) return nb;
+
+    // k completes the trio (i, j, k) if it is a neighbor of both i and j.
+    nb.trios.resize(nb.stars.size());
+    distribute_pivots(static_cast<unsigned int>(nb.stars.size()), count_generation_threads(),
+                      [&nb] (const unsigned int i, const unsigned int) -> void {
+        const std::vector<unsigned int> &near_i = nb.near[i];
+        for (unsigned int j_n = 0; j_n < near_i.size(); j_n++) {
+            const unsigned int j = near_i[j_n];
+
+            for (unsigned int k_n = j_n + 1; k_n < near_i.size(); k_n++) {
+                const unsigned int k = near_i[k_n];
+                if (std::binary_search(nb.near[j].begin(), nb.near[j].end(), k)) {
+                    nb.trios[i].push_back(std::array<unsigned int, 2>{j, k});
+                }
             }
         }
     });
 
-    return m;
+    return nb;
+}
+
+/// Create every table in table_names that does not exist yet, and fill each with the same rows. The rows are only
+/// built if at least one table was created, and are built once for all of these tables.
+///
+/// @param ch Catalog to create the tables in.
+/// @param table_names Names of the tables to create. All share the same schema and rows.
+/// @param schema Schema of each table.
+/// @param key Fields each table is clustered on.
+/// @param fields Fields of each row, in the order build_rows returns them.
+/// @param build_rows Function returning the flattened rows to insert, in the order of key.
+/// @return TABLE_ALREADY_EXISTS if every table already exists. 0 otherwise.
+int Identification::load_tables (const std::shared_ptr<Chomp> &ch, const std::vector<std::string> &table_names,
+                                 const std::string &schema, const std::string &key, const std::string &fields,
+                                 const std::function<Nibble::tuple_d ()> &build_rows) {
+    std::vector<std::string> created;
+    for (const std::string &table : table_names) {
+        if (ch->create_table(table, schema, key) != Nibble::TABLE_NOT_CREATED_RET) created.push_back(table);
+    }
+    if (created.empty()) return TABLE_ALREADY_EXISTS;
+
+    const Nibble::tuple_d rows = build_rows();
+    for (const std::string &table : created) {
+        ch->select_table(table);
+        ch->bulk_insert_into_table(fields, rows);
+    }
+    return 0;
 }
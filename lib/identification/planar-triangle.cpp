@@ -12,7 +12,12 @@
 const unsigned int Plane::QUERY_STAR_SET_SIZE = 3;
 
 int PlanarTriangle::generate_table (const std::shared_ptr<Chomp> &ch, double fov, const std::string &table_name) {
-    return generate_triangle_table(ch, fov, table_name, Trio::planar_area, Trio::planar_moment);
+    return generate_tables(ch, find_neighborhood(ch, fov), {table_name});
+}
+
+int PlanarTriangle::generate_tables (const std::shared_ptr<Chomp> &ch, const Neighborhood &nb,
+                                     const std::vector<std::string> &table_names) {
+    return generate_triangle_tables(ch, nb, table_names, Trio::planar_area, Trio::planar_moment);
 }
 
 Plane::TrioVectorEither Plane::query_for_trios (const index_trio &c) {
@@ -26,6 +31,6 @@ std::vector<Identification::labels_list> Plane::query () {
 
 Plane::StarsEither Plane::reduce () { return e_reduction(); }
 Plane::StarsEither Plane::identify () {
-    std::cout << "[PLANE] Starting spherical identification." << std::endl;
+    HOKU_TRACE(INFO, PLANE, "Starting planar identification.");
     return e_identify();
 }
\ No newline at end of file
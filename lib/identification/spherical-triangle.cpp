@@ -22,8 +22,13 @@ double Sphere::spherical_moment (const Vector3 &b_1, const Vector3 &b_2, const V
 }
 
 int Sphere::generate_table (const std::shared_ptr<Chomp> &ch, double fov, const std::string &table_name) {
+    return generate_tables(ch, find_neighborhood(ch, fov), {table_name});
+}
+
+int Sphere::generate_tables (const std::shared_ptr<Chomp> &ch, const Neighborhood &nb,
+                             const std::vector<std::string> &table_names) {
     // Handle the error in the following lambdas. We define -1 to be an "error" result.
-    return generate_triangle_table(ch, fov, table_name, Sphere::spherical_area, Sphere::spherical_moment);
+    return generate_triangle_tables(ch, nb, table_names, Sphere::spherical_area, Sphere::spherical_moment);
 }
 
 Sphere::TrioVectorEither Sphere::query_for_trios (const index_trio &c) {
@@ -43,6 +48,6 @@ std::vector<Identification::labels_list> Sphere::query () {
 
 Sphere::StarsEither Sphere::reduce () { return e_reduction(); }
 Sphere::StarsEither Sphere::identify () {
-    std::cout << "[SPHERE] Starting spherical identification." << std::endl;
+    HOKU_TRACE(INFO, SPHERE, "Starting spherical identification.");
     return e_identify();
 }
\ No newline at end of file
@@ -0,0 +1,102 @@
+/// @file bucket-index.cpp
+/// @author Glenn Galvizo
+///
+/// Source file for BucketIndex class, which holds an in-memory index over two feature columns of a reference table.
+
+#include <algorithm>
+#include <numeric>
+#include <stdexcept>
+#include <utility>
+
+#include "storage/bucket-index.h"
+
+const unsigned int BucketIndex::DEFAULT_BUCKET_SIZE = 64;
+
+/// Constructor. Builds the index over the keys y_1 (which must already be sorted in ascending order) and y_2. Row r
+/// owns the labels ell[r * stride] through ell[r * stride + stride - 1]. The keys and labels are copied.
+BucketIndex::BucketIndex (const std::vector<double> &y_1, const std::vector<double> &y_2, const std::vector<int> &ell,
+                          const unsigned int stride, const unsigned int bucket_size) : kv(y_1, ell, stride) {
+    if (y_2.size() != y_1.size()) {
+        throw std::runtime_error(std::string("Number of second keys does not match the number of first keys."));
+    }
+    build(y_2.data(), bucket_size);
+}
+
+/// Constructor. Builds the index over n rows of keys and labels that live elsewhere (i.e. a memory-mapped file).
+/// Nothing is copied: 'storage' is held to keep the memory behind y_1 and ell alive. y_2 is only read here.
+BucketIndex::BucketIndex (const double *y_1, const double *y_2, const int *ell, const unsigned int n,
+                          const unsigned int stride, const std::shared_ptr<const void> &storage,
+                          const unsigned int bucket_size) : kv(y_1, ell, n, stride, storage) {
+    build(y_2, bucket_size);
+}
+
+void BucketIndex::build (const double *y_2, const unsigned int bucket_size) {
+    this->bucket_size = std::max(1u, bucket_size);
+    auto buckets = std::make_shared<std::pair<std::vector<double>, std::vector<unsigned int>>>();
+    std::vector<double> &y_2_b = buckets->first;
+    std::vector<unsigned int> &r_b = buckets->second;
+    y_2_b.resize(kv.size()), r_b.resize(kv.size());
+    std::iota(r_b.begin(), r_b.end(), 0);
+
+    // Rows are already in order of their first key. Within each bucket, reorder them by their second key.
+    for (unsigned int b = 0; b < kv.size(); b += this->bucket_size) {
+        unsigned int e = std::min(kv.size(), b + this->bucket_size);
+        std::sort(r_b.begin() + b, r_b.begin() + e, [y_2] (const unsigned int r_1, const unsigned int r_2) {
+            return (y_2[r_1] != y_2[r_2]) ? y_2[r_1] < y_2[r_2] : r_1 < r_2;
+        });
+        for (unsigned int i = b; i < e; i++) {
+            y_2_b[i] = y_2[r_b[i]];
+        }
+    }
+    this->bucket_y_2 = y_2_b.data(), this->bucket_r = r_b.data(), this->bucket_storage = buckets;
+}
+
+/// @return Shelves that hold this index (its k-vector and its buckets), named with the given prefix.
+std::vector<Pantry::Shelf> BucketIndex::shelves (const std::string &prefix) const {
+    std::vector<Pantry::Shelf> s = kv.shelves(prefix);
+    s.push_back(Pantry::shelf_of(prefix + "bucket_y_2", bucket_y_2, kv.size()));
+    s.push_back(Pantry::shelf_of(prefix + "bucket_r", bucket_r, kv.size()));
+    s.push_back(Pantry::shelf_of(prefix + "bucket_size", std::vector<unsigned int>{bucket_size}));
+    return s;
+}
+
+/// Attach to an index that was published (with shelves) to the given pantry. Nothing is copied or rebuilt.
+BucketIndex BucketIndex::attach (const std::shared_ptr<const Pantry> &pantry, const std::string &prefix) {
+    uint64_t n_y_2, n_r, n_size;
+    const unsigned int *size = pantry->shelf<unsigned int>(prefix + "bucket_size", n_size);
+    BucketIndex bi(KVector::attach(pantry, prefix), (n_size == 1) ? size[0] : 0);
+    bi.bucket_y_2 = pantry->shelf<double>(prefix + "bucket_y_2", n_y_2);
+    bi.bucket_r = pantry->shelf<unsigned int>(prefix + "bucket_r", n_r);
+    if (bi.bucket_size == 0 || n_y_2 != bi.kv.size() || n_r != bi.kv.size()) {
+        throw std::runtime_error(std::string("Shelves " + prefix + "* do not hold a bucket index."));
+    }
+    bi.bucket_storage = pantry;
+    return bi;
+}
+
+/// Find all rows whose first key is between y_1a and y_1b, and whose second key is between y_2a and y_2b (inclusive,
+/// to match SQL's BETWEEN). The k-vector finds the rows that meet the first bound, and each bucket these rows touch
+/// is binary searched on the second bound.
+///
+/// @param out Buffer that holds the matching rows in ascending order (i.e. the order of the table) on return.
+/// @return The number of matching rows.
+unsigned int BucketIndex::bound_query (const double y_1a, const double y_1b, const double y_2a, const double y_2b,
+                                       std::vector<unsigned int> &out) const {
+    out.clear();
+    KVector::Range range = kv.bound_query(y_1a, y_1b);
+    if (range.begin == range.end || y_2a > y_2b) return 0;
+
+    for (unsigned int b = range.begin - range.begin % bucket_size; b < range.end; b += bucket_size) {
+        unsigned int e = std::min(kv.size(), b + bucket_size);
+        const double *i = std::lower_bound(bucket_y_2 + b, bucket_y_2 + e, y_2a);
+        for (; i != bucket_y_2 + e && *i <= y_2b; i++) {
+            unsigned int r = bucket_r[i - bucket_y_2];
+
+            // The buckets at either end of our range may hold rows outside of the first bound.
+            if (r >= range.begin && r < range.end) out.push_back(r);
+        }
+    }
+
+    std::sort(out.begin(), out.end());
+    return static_cast<unsigned int>(out.size());
+}
@@ -6,60 +6,163 @@
 
 #define _USE_MATH_DEFINES
 
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cfloat>
 #include <cmath>
-#include <fstream>
-#include <iomanip>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <iterator>
 #include <sstream>
+#include <type_traits>
+#include <fcntl.h>
 #include <libgen.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "storage/chomp.h"
 
 const int Chomp::TABLE_EXISTS = -1;
+const int Chomp::NO_STAR_FOUND_EITHER = -1;
+const int Chomp::NO_STAR_INDEX = -1;
 
 Chomp::Chomp (const std::string &database_name, const std::string &hip_name, const std::string &bright_name,
-              const std::string &catalog_path, const std::string &current_time, double m_bright) :
-        Nibble(database_name) {
+              const std::string &catalog_path, const std::string &current_time, double m_bright,
+              const std::vector<std::string> &k_vector_tables, const std::vector<std::string> &rtree_tables,
+              const std::vector<std::string> &bucket_index_tables,
+              const std::vector<std::string> &feature_grid_tables, const bool in_memory,
+              const std::string &pantry_name) :
+        Nibble(database_name, in_memory) {
     this->bright_table = bright_name;
     this->hip_table = hip_name;
 
     // Generate the Hipparcos and Bright Hipparcos tables.
     if (!catalog_path.empty()) generate_tables(catalog_path, current_time, m_bright);
-    load_all_stars();
+
+    // Build the in-memory indices for each requested pair, triangle and dot table. Anything that is held in our pantry
+    // (if we are attached to one) is used in place instead. Our stars are only loaded with their first use.
+    auto load_indices = [&] () -> void {
+        for (const std::string &table : k_vector_tables) load_k_vector(table);
+        for (const std::string &table : bucket_index_tables) load_bucket_index(table);
+        for (const std::string &table : feature_grid_tables) load_feature_grid(table);
+    };
+    std::vector<std::string> pantry_tables = {hip_table, bright_table};
+    for (const auto *tables : {&k_vector_tables, &bucket_index_tables, &feature_grid_tables}) {
+        pantry_tables.insert(pantry_tables.end(), tables->begin(), tables->end());
+    }
+    if (!pantry_name.empty()) this->pantry = attach_pantry(pantry_name, pantry_tables);
+    select_table(hip_table);
+    load_indices();
+
+    // If no usable pantry exists yet, publish both catalogs and everything we have built. We then attach to it like
+    // every other process, so our private copies are released. If another process has published first, we attach to
+    // its pantry instead (which must hold our tables as they are now).
+    if (!pantry_name.empty() && pantry == nullptr) {
+        bright_catalog(), hip_catalog();
+        const int published = Pantry::publish(pantry_name, pantry_shelves());
+        this->pantry = Pantry::open(pantry_name);
+        if (pantry == nullptr || !is_pantry_current(*pantry, pantry_tables)) {
+            throw std::runtime_error(std::string("Pantry " + pantry_name + " cannot be " +
+                                                 ((published == Pantry::SEGMENT_EXISTS) ? "shared." : "published.")));
+        }
+
+        const long long load_ns = catalog->load_ns;
+        this->catalog = std::make_shared<Catalog>(), this->catalog->load_ns = load_ns;
+        load_indices();
+    }
+
+    // Route the bound queries of each requested multi-feature table through its R*Tree.
+    for (const std::string &table : rtree_tables) {
+        if (!does_table_exist(table + RTREE_SUFFIX)) {
+            throw std::runtime_error(std::string("R*Tree for table " + table + " does not exist."));
+        }
+        this->rtree_tables.insert(table);
+    }
 }
 
-/// Helper method for catalog table generation methods. Read the star catalog data and compute the {i, j, k} components
-/// given a line from the ASCII catalog. Source: http://cdsarc.u-strasbg.fr/viz-bin/Cat?I/311#sRM2.1
+/// Parse the fixed-width field [offset, offset + width) of a catalog line, with the same result as stof on the
+/// matching substr: the field is cut at the end of the line, and must start with a number after any leading spaces.
+/// Plain decimals ([sign] digits [. digits], at most 15 digits) are read in place. Their value is exact in a double,
+/// and this double is rounded to the same float as strtof unless it lies exactly between two floats. Every other field
+/// is copied to the stack and given to strtof, so nothing is allocated.
 ///
-/// @return Array of components in order {alpha, delta, i, j, k, m, label}.
-std::array<double, 7> Chomp::components_from_line (const std::string &entry, const double y_t) {
-    std::array<double, 7> components = {0, 0, 0, 0, 0, 0, 0};
+/// @return False if the field does not hold a number. True otherwise, with the value in out.
+bool Chomp::parse_field (const char *line, const std::size_t length, const std::size_t offset, const std::size_t width,
+                         double &out) {
+    static const double POWERS_OF_TEN[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13,
+                                           1e14, 1e15};
+    char field[32];
+    if (offset >= length || width >= sizeof(field)) return false;
+    const char *f = line + offset, *f_end = f + std::min(width, length - offset), *p = f;
+
+    while (p < f_end && *p == ' ') p++;
+    const bool is_negative = p < f_end && *p == '-';
+    if (p < f_end && (*p == '-' || *p == '+')) p++;
+
+    uint64_t mantissa = 0;
+    int n_digits = 0, n_fraction = 0;
+    bool is_fraction = false;
+    for (; p < f_end && ((*p >= '0' && *p <= '9') || (*p == '.' && !is_fraction)); p++) {
+        if (*p == '.') is_fraction = true;
+        else mantissa = 10 * mantissa + static_cast<uint64_t>(*p - '0'), n_digits++, n_fraction += is_fraction;
+    }
 
-    try {
-        // Parse the proper motion of the right ascension and declination.
-        double pm_alpha = stof(entry.substr(51, 8)), pm_delta = stof(entry.substr(60, 8));
+    // Exponents and hexadecimal values are left to strtof.
+    const bool is_plain = n_digits > 0 && n_digits <= 15 && (p == f_end || (*p != 'e' && *p != 'E' && *p != 'x' &&
+                                                                           *p != 'X'));
+    if (is_plain) {
+        const double d = static_cast<double>(mantissa) / POWERS_OF_TEN[n_fraction];
+        uint64_t d_bits;
+        std::memcpy(&d_bits, &d, sizeof(d));
+
+        // A double keeps 29 more fraction bits than a float. These bits are 100...0 for doubles halfway between floats.
+        if ((d == 0 || d >= FLT_MIN) && (d_bits & ((UINT64_C(1) << 29) - 1)) != (UINT64_C(1) << 28)) {
+            out = static_cast<float>(is_negative ? -d : d);
+            return true;
+        }
+    }
+
+    const auto n = static_cast<std::size_t>(f_end - f);
+    std::memcpy(field, f, n), field[n] = '\0';
 
-        // Read right ascension. Convert to degrees. Update with correct position.
-        double alpha = ((180.0 / M_PI) * stof(entry.substr(15, 13), nullptr)) + (pm_alpha * y_t * (1 / (3600000.0)));
+    char *field_end;
+    errno = 0;
+    const float x = std::strtof(field, &field_end);
+    if (field_end == field || errno == ERANGE) return false;
 
-        // Read declination. Convert to degrees. Update with correct position.
-        double delta = ((180.0 / M_PI) * stof(entry.substr(29, 13), nullptr)) + (pm_delta * y_t * (1 / (3600000.0)));
+    out = x;
+    return true;
+}
 
-        // Convert to cartesian w/ r = 1. Reduce to unit vector.
-        double r[] = {(M_PI / 180.0) * alpha, (M_PI / 180.0) * delta};
-        Vector3 s = Vector3::Normalized(Vector3(cos(r[0]) * cos(r[1]), sin(r[0]) * cos(r[1]), sin(r[1])));
+/// Parse the label, right ascension, declination, proper motion and apparent magnitude of every row in the ASCII
+/// catalog between begin and end. Rows without all of these fields are skipped. Source:
+/// http://cdsarc.u-strasbg.fr/viz-bin/Cat?I/311#sRM2.1
+void Chomp::parse_catalog (const char *begin, const char *end, CatalogColumns &c) {
+    const char *line = begin;
+    const auto next_line = [end] (const char *l) -> const char * {
+        const auto *n = static_cast<const char *>(std::memchr(l, '\n', static_cast<std::size_t>(end - l)));
+        return (n == nullptr) ? end : n + 1;
+    };
 
-        // Parse apparent magnitude and label.
-        double m = stof(entry.substr(129, 7), nullptr), ell = stof(entry.substr(0, 6), nullptr);
+    // We skip the header here.
+    for (int i = 0; i < 5 && line < end; i++) line = next_line(line);
 
-        components = {alpha, delta, s.data[0], s.data[1], s.data[2], m, ell};
-    }
-    catch (std::exception &e) {
-        // Ignore entries without recorded alpha or delta.
-    }
+    for (const char *line_end; line < end; line = line_end) {
+        line_end = next_line(line);
+        const auto length = static_cast<std::size_t>(line_end - line - (line_end[-1] == '\n' ? 1 : 0));
 
-    return components;
+        double alpha, delta, pm_alpha, pm_delta, m, ell;
+        if (parse_field(line, length, 51, 8, pm_alpha) && parse_field(line, length, 60, 8, pm_delta) &&
+            parse_field(line, length, 15, 13, alpha) && parse_field(line, length, 29, 13, delta) &&
+            parse_field(line, length, 129, 7, m) && parse_field(line, length, 0, 6, ell)) {
+            c.alpha.push_back(alpha), c.delta.push_back(delta), c.pm_alpha.push_back(pm_alpha);
+            c.pm_delta.push_back(pm_delta), c.m.push_back(m), c.label.push_back(ell);
+        }
+    }
 }
 
 /// Determine the difference in years between the time of the catalog recording (J1991.25) and the given time.
@@ -79,140 +182,580 @@ double Chomp::year_difference (const std::string &current_time) {
 }
 
 /// Parse the right ascension, declination, visual magnitude, and catalog ID for each star. The i, j, and k components
-/// are converted from the star's alpha, delta and are moved to their proper location given the current time.
+/// are converted from the star's alpha, delta and are moved to their proper location given the current time. The
+/// catalog is mapped into memory and read once, and both tables are filled from this single pass. Each table is
+/// clustered on label.
+///
+/// @return TABLE_EXISTS for each of the BRIGHT and HIP tables that already exists.
 int Chomp::generate_tables (const std::string &catalog_path, const std::string &current_time, double m_bright) {
-    auto create_table = [this, catalog_path, current_time, m_bright] (bool is_bright) {
-        std::ifstream catalog(catalog_path);
-        if (!catalog.is_open()) throw std::runtime_error(std::string("Catalog file cannot be opened."));
-
-        SQLite::Transaction transaction(*conn);
-        if (this->create_table(
-                (is_bright) ? bright_table : hip_table,
-                "alpha FLOAT, "
-                "delta FLOAT, "
-                "i FLOAT, "
-                "j FLOAT, "
-                "k FLOAT, "
-                "m FLOAT, "
-                "label INT"
-        ) == TABLE_NOT_CREATED_RET)
-            return TABLE_EXISTS;
-
-        // We skip the header here.
-        for (int i = 0; i < 5; i++) {
-            std::string entry;
-            getline(catalog, entry);
-        }
+    int fd = ::open(catalog_path.c_str(), O_RDONLY);
+    if (fd < 0) throw std::runtime_error(std::string("Catalog file cannot be opened."));
+
+    const bool is_bright_new = !does_table_exist(bright_table), is_hip_new = !does_table_exist(hip_table);
+    if (!is_bright_new && !is_hip_new) {
+        ::close(fd);
+        return 2 * TABLE_EXISTS;
+    }
+    double y_t;
+    try { y_t = year_difference(current_time); }
+    catch (std::exception &) {
+        ::close(fd);
+        throw;
+    }
 
-        // Insert into bright stars table. Account for the proper motion of each star.
-        double y_t = year_difference(current_time);
-        for (std::string entry; getline(catalog, entry);) {
-            std::array<double, 7> c = components_from_line(entry, y_t);
+    // Parse the catalog in place. Empty files cannot be mapped, and have no rows.
+    CatalogColumns c;
+    struct stat s = {};
+    if (fstat(fd, &s) == 0 && s.st_size > 0) {
+        const auto map_size = static_cast<std::size_t>(s.st_size);
+        void *map = mmap(nullptr, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            ::close(fd);
+            throw std::runtime_error(std::string("Catalog file cannot be mapped."));
+        }
+        madvise(map, map_size, MADV_SEQUENTIAL);
 
-            // Only insert if magnitude < m_bright (visible light by detector).
-            if (!is_bright || (c[5] < m_bright && !std::equal(c.begin() + 1, c.end(), c.begin()))) {
-                insert_into_table("alpha, delta, i, j, k, m, label", tuple_d{c[0], c[1], c[2], c[3], c[4], c[5], c[6]});
-            }
+        const auto *base = static_cast<const char *>(map);
+        const auto n_expected = static_cast<std::size_t>(std::count(base, base + map_size, '\n'));
+        for (std::vector<double> *column : {&c.alpha, &c.delta, &c.pm_alpha, &c.pm_delta, &c.m, &c.label}) {
+            column->reserve(n_expected);
         }
-        transaction.commit();
+        parse_catalog(base, base + map_size, c);
+        munmap(map, map_size);
+    }
+    ::close(fd);
 
-        return sort_and_index("label");
-    };
+    // Account for the proper motion of each star. Right ascension and declination are converted to degrees.
+    const std::size_t n = c.label.size();
+    for (std::size_t r = 0; r < n; r++) {
+        c.alpha[r] = ((180.0 / M_PI) * c.alpha[r]) + (c.pm_alpha[r] * y_t * (1 / (3600000.0)));
+        c.delta[r] = ((180.0 / M_PI) * c.delta[r]) + (c.pm_delta[r] * y_t * (1 / (3600000.0)));
+    }
 
-    return create_table(true) + create_table(false);
+    // Convert to cartesian w/ r = 1, and fill the rows of both tables. Only stars with magnitude < m_bright (visible
+    // light by detector) are bright.
+    tuple_d hip_rows, bright_rows;
+    hip_rows.reserve((is_hip_new) ? 7 * n : 0);
+    for (std::size_t r = 0; r < n; r++) {
+        double theta[] = {(M_PI / 180.0) * c.alpha[r], (M_PI / 180.0) * c.delta[r]};
+        Vector3 v = Vector3::Normalized(Vector3(cos(theta[0]) * cos(theta[1]), sin(theta[0]) * cos(theta[1]),
+                                                sin(theta[1])));
+        const std::initializer_list<double> row = {c.alpha[r], c.delta[r], v.data[0], v.data[1], v.data[2], c.m[r],
+                                                   c.label[r]};
+
+        if (is_hip_new) hip_rows.insert(hip_rows.end(), row);
+        if (is_bright_new && c.m[r] < m_bright) bright_rows.insert(bright_rows.end(), row);
+    }
+
+    const std::string schema = "alpha FLOAT, delta FLOAT, i FLOAT, j FLOAT, k FLOAT, m FLOAT, label INT";
+    const auto load_table = [&] (const bool is_new, const std::string &table, const tuple_d &rows) -> int {
+        if (!is_new || this->create_table(table, schema, "label") == TABLE_NOT_CREATED_RET) return TABLE_EXISTS;
+        select_table(table);
+        return bulk_insert_into_table("alpha, delta, i, j, k, m, label", rows);
+    };
+    return load_table(is_bright_new, bright_table, bright_rows) + load_table(is_hip_new, hip_table, hip_rows);
 }
 
 /// Search the Hipparcos catalog in memory (all_hip_stars) for a star with the matching catalog ID. If the star does
 /// not exist, than an exception is thrown. This is meant to discourage the use of guessing stars through labels.
 Star Chomp::query_hip (int label) {
-    for (const Star &s : all_hip_stars) {
-        if (s.get_label() == label) return s;
+    StarEither s = find_hip(label);
+    if (s.error == NO_STAR_FOUND_EITHER) {
+        throw std::runtime_error("Star does exist with the label: " + std::to_string(label) + ".");
     }
 
-    throw std::runtime_error("Star does exist with the label: " + std::to_string(label) + ".");
+    return s.result;
 }
 
-Star::list Chomp::bright_as_list () { return this->all_bright_stars; }
-Star::list Chomp::nearby_bright_stars (const Vector3 &focus, const double fov, const unsigned int expected) {
-    Star::list nearby;
-    nearby.reserve(expected);
+/// Non-throwing variant of query_hip. The lookup is a single access into our label-indexed table.
+///
+/// @return NO_STAR_FOUND_EITHER if no star exists with the given label. Otherwise, the star with the given label.
+Chomp::StarEither Chomp::find_hip (const int label) {
+    const Catalog &c = hip_catalog();
+    catalog->hip_lookups.fetch_add(1, std::memory_order_relaxed);
 
-    for (const Star &candidate : all_bright_stars) {
-        if (Star::within_angle(focus, candidate, fov)) nearby.push_back(candidate);
+    if (label < 0 || static_cast<unsigned int>(label) >= c.n_hip_index || c.hip_index[label] == NO_STAR_INDEX) {
+        return StarEither{Star(), NO_STAR_FOUND_EITHER};
     }
+    return StarEither{c.all_hip_stars[c.hip_index[label]], 0};
+}
 
-    return nearby;
+/// @return The number of catalog lookups (query_hip or find_hip) performed with this instance and its handles.
+unsigned long Chomp::get_hip_lookups () { return this->catalog->hip_lookups; }
+
+/// @return Total time (in milliseconds) spent loading our star catalogs with this instance.
+double Chomp::get_load_time () { return static_cast<double>(this->catalog->load_ns) / 1.0e6; }
+
+Star::list Chomp::bright_as_list () {
+    const Catalog &c = bright_catalog();
+    return Star::list(c.all_bright_stars, c.all_bright_stars + c.n_bright);
+}
+
+/// Search our bright stars for all stars within fov degrees of the focus. The sky grid over the bright stars is built
+/// with the first search.
+///
+/// @return List of all bright stars near the focus, in catalog order.
+Star::list Chomp::nearby_bright_stars (const Vector3 &focus, const double fov, const unsigned int expected) {
+    const Catalog &c = bright_catalog();
+    std::call_once(catalog->bright_grid_built, [this, &c] () -> void {
+        catalog->bright_grid = std::make_shared<SkyGrid>(c.all_bright_stars, c.n_bright);
+    });
+    return nearby_stars(*c.bright_grid, c.all_bright_stars, focus, fov, expected);
 }
+
+/// Search the entire Hipparcos catalog for all stars within fov degrees of the focus. The sky grid over these stars is
+/// built with the first search.
+///
+/// @return List of all Hipparcos stars near the focus, in catalog order.
 Star::list Chomp::nearby_hip_stars (const Vector3 &focus, const double fov, const unsigned int expected) {
+    const Catalog &c = hip_catalog();
+    std::call_once(catalog->hip_grid_built, [this, &c] () -> void {
+        catalog->hip_grid = std::make_shared<SkyGrid>(c.all_hip_stars, c.n_hip);
+    });
+    return nearby_stars(*c.hip_grid, c.all_hip_stars, focus, fov, expected);
+}
+
+/// Resolve the indices of a cone search on the given grid to the stars of the list the grid was built with.
+Star::list Chomp::nearby_stars (const SkyGrid &grid, const Star *stars, const Vector3 &focus, const double fov,
+                                const unsigned int expected) {
     Star::list nearby;
     nearby.reserve(expected);
 
-    for (const Star &candidate : all_hip_stars) {
-        if (Star::within_angle(focus, candidate, fov)) nearby.push_back(candidate);
+    for (const unsigned int i : grid.cone_query(focus, fov)) nearby.push_back(stars[i]);
+    return nearby;
+}
+
+/// Fill the given list with the stars stored in the binary image at path.
+void Chomp::load_stars_from_crumb (const std::string &path, Star::list &stars) {
+    std::shared_ptr<Crumb> cr = Crumb::open(path);
+    int c_i = cr->feature_column("i"), c_j = cr->feature_column("j"), c_k = cr->feature_column("k");
+    int c_m = cr->feature_column("m"), c_ell = cr->label_column("label");
+    if (std::min({c_i, c_j, c_k, c_m, c_ell}) == Crumb::NO_COLUMN_FOUND) {
+        throw std::runtime_error(std::string("Crumb file " + path + " is not a star table."));
     }
 
-    return nearby;
+    const double *i = cr->features(c_i), *j = cr->features(c_j), *k = cr->features(c_k), *m = cr->features(c_m);
+    stars.reserve(cr->size());
+    for (uint64_t r = 0; r < cr->size(); r++) stars.emplace_back(i[r], j[r], k[r], cr->labels(r)[c_ell], m[r]);
 }
 
-void Chomp::load_all_stars () {
-    // Reserve space for our tables. Note that we assume our HIP and BRIGHT tables have already been generated.
-    SQLite::Statement query_b_ell(
-            *conn,
-            "SELECT COUNT(*) "
-            "FROM " + bright_table
-    );
-    while (query_b_ell.executeStep()) this->all_bright_stars.reserve(query_b_ell.getColumn(0).getInt());
-    SQLite::Statement query_h_ell(
+/// Fill the given list with the stars stored in the given table of our database.
+void Chomp::load_stars_from_table (const std::string &table, Star::list &stars) {
+    SQLite::Statement query_ell(
             *conn,
             "SELECT COUNT(*) "
-            "FROM " + hip_table
+            "FROM " + table
     );
-    while (query_h_ell.executeStep()) this->all_hip_stars.reserve(query_h_ell.getColumn(0).getInt());
+    while (query_ell.executeStep()) stars.reserve(static_cast<unsigned int>(query_ell.getColumn(0).getInt()));
 
-    // Select all for bright stars, and load this into RAM.
-    select_table(bright_table);
-    SQLite::Statement query_b(
+    SQLite::Statement query(
             *conn,
             "SELECT i, j, k, label, m "
-            "FROM " + bright_table
+            "FROM " + table
     );
+    while (query.executeStep()) {
+        stars.emplace_back(
+                Star(query.getColumn(0).getDouble(), query.getColumn(1).getDouble(), query.getColumn(2).getDouble(),
+                     query.getColumn(3).getInt(), query.getColumn(4).getDouble()));
+    }
+}
+
+/// Fill the given list with the stars of the given table. If GenerateN has written the binary image of this table,
+/// read this instead of going through SQLite. Otherwise, we assume that the table has already been generated.
+void Chomp::load_stars (const std::string &table, Star::list &stars) {
+    if (is_crumb_current(table)) load_stars_from_crumb(Crumb::path_for(database_name, table), stars);
+    else load_stars_from_table(table, stars);
+}
 
-    while (query_b.executeStep()) {
-        this->all_bright_stars.emplace_back(
-                Star(query_b.getColumn(0).getDouble(), query_b.getColumn(1).getDouble(),
-                     query_b.getColumn(2).getDouble(),
-                     query_b.getColumn(3).getInt(), query_b.getColumn(4).getDouble()));
+/// Check for a binary image of the given table that was written from the table as it is now. An image left behind by
+/// an older generation of the table (or one whose rows have since changed) is ignored, and the table is then read
+/// through SQLite instead.
+///
+/// @return True if the crumb of the given table exists and may be used in its place.
+bool Chomp::is_crumb_current (const std::string &table) {
+    const std::string crumb = Crumb::path_for(database_name, table);
+    return Crumb::does_crumb_exist(crumb) && Crumb::is_crumb_current(crumb, fingerprint(table));
+}
+
+/// @return Our catalog, with our bright stars loaded. Only the first call (across all threads) loads these.
+const Chomp::Catalog &Chomp::bright_catalog () {
+    std::call_once(catalog->bright_loaded, [this] () -> void { load_bright_stars(); });
+    return *catalog;
+}
+
+/// @return Our catalog, with all Hipparcos stars loaded. Only the first call (across all threads) loads these.
+const Chomp::Catalog &Chomp::hip_catalog () {
+    std::call_once(catalog->hip_loaded, [this] () -> void { load_hip_stars(); });
+    return *catalog;
+}
+
+/// Load our bright stars, from our pantry if it holds these. The time taken is added to our load time.
+void Chomp::load_bright_stars () {
+    auto start = std::chrono::steady_clock::now();
+    Catalog &c = *catalog;
+    if (pantry != nullptr && pantry->has_shelf(bright_table + "/stars")) {
+        uint64_t n_b;
+        c.all_bright_stars = pantry->shelf<Star>(bright_table + "/stars", n_b);
+        c.n_bright = static_cast<unsigned int>(n_b), c.bright_storage = pantry;
+    }
+    else {
+        auto bright = std::make_shared<Star::list>();
+        load_stars(bright_table, *bright);
+        c.all_bright_stars = bright->data(), c.n_bright = static_cast<unsigned int>(bright->size());
+        c.bright_storage = bright;
     }
+    c.load_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
 
-    // Select all for general stars stars, and load this into RAM.
-    select_table(hip_table);
-    SQLite::Statement query_h(
-            *conn,
-            "SELECT i, j, k, label, m "
-            "FROM " + hip_table
-    );
-    while (query_h.executeStep()) {
-        this->all_hip_stars.emplace_back(
-                Star(query_h.getColumn(0).getDouble(), query_h.getColumn(1).getDouble(),
-                     query_h.getColumn(2).getDouble(),
-                     query_h.getColumn(3).getInt(), query_h.getColumn(4).getDouble()));
+/// Load the entire Hipparcos catalog and our label lookup, from our pantry if it holds these. The time taken is added
+/// to our load time.
+void Chomp::load_hip_stars () {
+    auto start = std::chrono::steady_clock::now();
+    Catalog &c = *catalog;
+    if (pantry != nullptr && pantry->has_shelf(hip_table + "/stars")) {
+        uint64_t n_h, n_i;
+        c.all_hip_stars = pantry->shelf<Star>(hip_table + "/stars", n_h);
+        c.hip_index = pantry->shelf<int>(hip_table + "/index", n_i);
+        c.n_hip = static_cast<unsigned int>(n_h), c.n_hip_index = static_cast<unsigned int>(n_i);
+        c.hip_storage = pantry;
+    }
+    else {
+        struct HipLists {
+            Star::list hip;
+            std::vector<int> hip_index;
+        };
+        auto lists = std::make_shared<HipLists>();
+        load_stars(hip_table, lists->hip);
+
+        // Build our label -> star lookup. Labels are dense (HIP numbers), so a flat table indexed by label suffices.
+        int max_label = 0;
+        for (const Star &s : lists->hip) max_label = std::max(max_label, s.get_label());
+        lists->hip_index.assign(static_cast<unsigned int>(max_label) + 1, NO_STAR_INDEX);
+        for (unsigned int i = 0; i < lists->hip.size(); i++) {
+            if (lists->hip[i].get_label() >= 0) lists->hip_index[lists->hip[i].get_label()] = static_cast<int>(i);
+        }
+
+        c.all_hip_stars = lists->hip.data(), c.n_hip = static_cast<unsigned int>(lists->hip.size());
+        c.hip_index = lists->hip_index.data();
+        c.n_hip_index = static_cast<unsigned int>(lists->hip_index.size()), c.hip_storage = lists;
+    }
+    c.load_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+/// @return Shelves that hold our stars, our label lookup and every in-memory index we hold, for publishing to a
+/// pantry. The name of our database is shelved as well, so processes of another database never attach to these. Each
+/// table is shelved with its fingerprint (the same one our crumbs hold), so a pantry of a table that has since changed
+/// is never used.
+std::vector<Pantry::Shelf> Chomp::pantry_shelves () {
+    static_assert(std::is_trivially_copyable<Star>::value, "Stars must be shareable as raw bytes.");
+    std::vector<Pantry::Shelf> shelves = {
+            Pantry::shelf_of("database", std::vector<char>(database_name.begin(), database_name.end())),
+            Pantry::shelf_of(bright_table + "/stars", catalog->all_bright_stars, catalog->n_bright),
+            Pantry::shelf_of(hip_table + "/stars", catalog->all_hip_stars, catalog->n_hip),
+            Pantry::shelf_of(hip_table + "/index", catalog->hip_index, catalog->n_hip_index)
+    };
+
+    std::set<std::string> tables = {bright_table, hip_table};
+    auto append = [&shelves, &tables] (const std::string &table, const std::vector<Pantry::Shelf> &s) -> void {
+        shelves.insert(shelves.end(), s.begin(), s.end()), tables.insert(table);
+    };
+    for (const auto &kv : k_vectors) append(kv.first, kv.second->shelves(kv.first + "/k_vector/"));
+    for (const auto &bi : bucket_indices) append(bi.first, bi.second->shelves(bi.first + "/bucket_index/"));
+    for (const auto &fg : feature_grids) append(fg.first, fg.second->shelves(fg.first + "/feature_grid/"));
+    for (const std::string &table : tables) {
+        shelves.push_back(Pantry::shelf_of(table + "/fingerprint", std::vector<uint64_t>{fingerprint(table)}));
+    }
+    return shelves;
+}
+
+/// Attach to the pantry with the given name, if it may be used for the given tables. A pantry that was never made
+/// ready (i.e. its publisher died), that cannot be read, or that holds one of these tables as it was before the table
+/// changed is removed, so a new one is published in its place. A pantry of another database is an error.
+///
+/// @return Nullptr if no usable pantry exists. Otherwise, the attached pantry.
+std::shared_ptr<const Pantry> Chomp::attach_pantry (const std::string &name, const std::vector<std::string> &tables) {
+    std::shared_ptr<const Pantry> p;
+    try {
+        p = Pantry::open(name);
+    }
+    catch (const std::runtime_error &) {
+        Pantry::remove(name);
+        return nullptr;
+    }
+    if (p == nullptr) return nullptr;
+
+    uint64_t n_name = 0;
+    const char *shelved_name = p->has_shelf("database") ? p->shelf<char>("database", n_name) : "";
+    if (std::string(shelved_name, n_name) != database_name) {
+        throw std::runtime_error(std::string("Pantry " + name + " does not hold " + database_name + "."));
+    }
+    if (!is_pantry_current(*p, tables)) {
+        Pantry::remove(name);
+        return nullptr;
+    }
+    return p;
+}
+
+/// A pantry is current if it holds both of our star tables, and if each of the given tables it holds was shelved with
+/// the fingerprint this table has now. Tables it does not hold are loaded from our database instead.
+///
+/// @return True if the given pantry may be used for the given tables. False otherwise.
+bool Chomp::is_pantry_current (const Pantry &p, const std::vector<std::string> &tables) {
+    if (!p.has_shelf(hip_table + "/fingerprint") || !p.has_shelf(bright_table + "/fingerprint")) return false;
+    for (const std::string &table : tables) {
+        if (!p.has_shelf(table + "/fingerprint")) continue;
+
+        uint64_t n;
+        const uint64_t *shelved = p.shelf<uint64_t>(table + "/fingerprint", n);
+        if (n != 1 || shelved[0] != fingerprint(table)) return false;
+    }
+    return true;
+}
+
+/// Search the current table for the given label and feature fields, for all rows whose foci lie between y_a and y_b.
+/// The results are stored in the caller's buffer. Our SQL is assembled in a reused buffer and our bounds are bound
+/// instead of printed, so every search on the same table, fields, and foci reuses the same prepared statement.
+///
+/// @return The number of rows found.
+int Chomp::simple_bound_query (const std::vector<std::string> &foci, const std::string &labels,
+                               const std::string &features, const std::vector<double> &y_a,
+                               const std::vector<double> &y_b, Results &out) {
+    return simple_bound_query(foci.data(), foci.size(), labels, features, y_a.data(), y_b.data(), out);
+}
+
+/// Search the R*Tree of the current table (built with index_rtree) for all rows within the given bounds. The R*Tree
+/// narrows the search on every focus at once. Its 32-bit boxes are rounded outward, so each candidate is checked
+/// against its exact features before being returned. Results are in the stored order of the table, as with
+/// simple_bound_query.
+///
+/// @return The number of rows found. These are written to out.
+int Chomp::rtree_bound_query (const std::vector<std::string> &foci, const std::string &labels,
+                              const std::string &features, const std::vector<double> &y_a,
+                              const std::vector<double> &y_b, Results &out) {
+    return rtree_bound_query(foci.data(), foci.size(), labels, features, y_a.data(), y_b.data(), out);
+}
+
+/// Search the current table for the n_foci fields in foci, bounded by the first n_foci entries of y_a and y_b. This
+/// is the body of simple_bound_query. Our SQL is appended straight into bound_sql, so a search on a statement we have
+/// already prepared allocates nothing beyond the growth of out.
+///
+/// @return The number of rows found. These are written to out.
+int Chomp::simple_bound_query (const std::string *foci, const std::size_t n_foci, const std::string &labels,
+                               const std::string &features, const double *y_a, const double *y_b, Results &out) {
+    if (rtree_tables.find(current_table) != rtree_tables.end()) {
+        return rtree_bound_query(foci, n_foci, labels, features, y_a, y_b, out);
+    }
+
+    bound_sql.assign("SELECT ").append(labels).append((labels.empty() || features.empty()) ? "" : ", ");
+    bound_sql.append(features).append(" FROM ").append(current_table).append(" WHERE ");
+    for (std::size_t i = 0; i < n_foci; i++) {
+        bound_sql.append(foci[i]).append(" BETWEEN ? AND ?").append((i < n_foci - 1) ? " AND " : "");
+    }
+
+    std::shared_ptr<SQLite::Statement> query = prepare(bound_sql);
+    for (std::size_t i = 0; i < n_foci; i++) {
+        query->bind(static_cast<int>(2 * i + 1), y_a[i]), query->bind(static_cast<int>(2 * i + 2), y_b[i]);
+    }
+
+    fetch_results(*query, count_fields(labels), count_fields(features), out);
+    return static_cast<int>(out.size());
+}
+
+/// Search the R*Tree of the current table for the n_foci fields in foci. This is the body of rtree_bound_query. As
+/// with simple_bound_query, our SQL is appended straight into bound_sql. Each bound is numbered, so the box and exact
+/// conditions can share it.
+///
+/// @return The number of rows found. These are written to out.
+int Chomp::rtree_bound_query (const std::string *foci, const std::size_t n_foci, const std::string &labels,
+                              const std::string &features, const double *y_a, const double *y_b, Results &out) {
+    bound_sql.assign("SELECT ").append(labels).append((labels.empty() || features.empty()) ? "" : ", ");
+    bound_sql.append(features).append(" FROM ").append(current_table).append(RTREE_SUFFIX).append(" JOIN ");
+    bound_sql.append(current_table).append(RTREE_ROWS_SUFFIX).append(" USING (id) WHERE ");
+    for (std::size_t i = 0; i < n_foci; i++) {
+        bound_sql.append(foci[i]).append("_max >= ?").append(std::to_string(2 * i + 1)).append(" AND ");
+        bound_sql.append(foci[i]).append("_min <= ?").append(std::to_string(2 * i + 2)).append(" AND ");
+    }
+    for (std::size_t i = 0; i < n_foci; i++) {
+        bound_sql.append(foci[i]).append(" BETWEEN ?").append(std::to_string(2 * i + 1));
+        bound_sql.append(" AND ?").append(std::to_string(2 * i + 2)).append((i < n_foci - 1) ? " AND " : "");
+    }
+    bound_sql.append(" ORDER BY id");
+
+    std::shared_ptr<SQLite::Statement> query = prepare(bound_sql);
+    for (std::size_t i = 0; i < n_foci; i++) {
+        query->bind(static_cast<int>(2 * i + 1), y_a[i]), query->bind(static_cast<int>(2 * i + 2), y_b[i]);
+    }
+
+    fetch_results(*query, count_fields(labels), count_fields(features), out);
+    return static_cast<int>(out.size());
+}
+
+/// Load the given pair table (label_a, label_b, theta) into RAM and build a k-vector over theta. The table is read
+/// once here, and all subsequent range searches on it are answered without SQLite. If GenerateN has written the
+/// binary image of this table (and the table has not changed since), the k-vector is built directly on top of the
+/// mapped file instead. If our pantry holds this k-vector, we attach to it and nothing is built.
+void Chomp::load_k_vector (const std::string &table) {
+    if (pantry != nullptr && pantry->has_shelf(table + "/k_vector/k")) {
+        this->k_vectors[table] = std::make_shared<KVector>(KVector::attach(pantry, table + "/k_vector/"));
+        return;
+    }
+
+    std::string crumb = Crumb::path_for(database_name, table);
+    if (is_crumb_current(table)) {
+        std::shared_ptr<Crumb> cr = Crumb::open(crumb);
+        if (cr->get_n_labels() != 2 || cr->label_column("label_a") != 0 || cr->label_column("label_b") != 1 ||
+            cr->feature_column("theta") == Crumb::NO_COLUMN_FOUND) {
+            throw std::runtime_error(std::string("Crumb file " + crumb + " is not a pair table."));
+        }
+
+        this->k_vectors[table] = std::make_shared<KVector>(cr->features(cr->feature_column("theta")), cr->labels(),
+                                                           static_cast<unsigned int>(cr->size()), 2, cr);
+        return;
+    }
+    if (!does_table_exist(table)) {
+        throw std::runtime_error(std::string("Table " + table + " does not exist."));
+    }
+    std::vector<double> theta;
+    std::vector<int> ell;
+
+    SQLite::Statement query_ell(*conn, "SELECT COUNT(*) FROM " + table);
+    while (query_ell.executeStep()) {
+        theta.reserve(static_cast<unsigned int>(query_ell.getColumn(0).getInt()));
+        ell.reserve(2 * static_cast<unsigned int>(query_ell.getColumn(0).getInt()));
+    }
+
+    SQLite::Statement query(*conn, "SELECT label_a, label_b, theta FROM " + table + " ORDER BY theta");
+    while (query.executeStep()) {
+        ell.push_back(query.getColumn(0).getInt()), ell.push_back(query.getColumn(1).getInt());
+        theta.push_back(query.getColumn(2).getDouble());
+    }
+
+    this->k_vectors[table] = std::make_shared<KVector>(theta, ell, 2);
+}
+
+/// @return The k-vector index for the given table if one was requested at construction. Otherwise, nullptr.
+std::shared_ptr<KVector> Chomp::k_vector (const std::string &table) {
+    auto kv = k_vectors.find(table);
+    return (kv == k_vectors.end()) ? nullptr : kv->second;
+}
+
+/// Load the given triangle table (label_a, label_b, label_c, a, i) into RAM and build a bucket index over (a, i). As
+/// with load_k_vector, the table is read once here, and the index is built on top of its crumb if a current one exists.
+/// Rows are kept in the stored order of the table, so the index returns candidates in the same order as
+/// simple_bound_query.
+void Chomp::load_bucket_index (const std::string &table) {
+    if (pantry != nullptr && pantry->has_shelf(table + "/bucket_index/bucket_r")) {
+        this->bucket_indices[table] = std::make_shared<BucketIndex>(
+                BucketIndex::attach(pantry, table + "/bucket_index/"));
+        return;
+    }
+
+    std::string crumb = Crumb::path_for(database_name, table);
+    if (is_crumb_current(table)) {
+        std::shared_ptr<Crumb> cr = Crumb::open(crumb);
+        if (cr->get_n_labels() != 3 || cr->label_column("label_a") != 0 || cr->label_column("label_b") != 1 ||
+            cr->label_column("label_c") != 2 || cr->feature_column("a") == Crumb::NO_COLUMN_FOUND ||
+            cr->feature_column("i") == Crumb::NO_COLUMN_FOUND) {
+            throw std::runtime_error(std::string("Crumb file " + crumb + " is not a triangle table."));
+        }
+
+        this->bucket_indices[table] = std::make_shared<BucketIndex>(
+                cr->features(cr->feature_column("a")), cr->features(cr->feature_column("i")), cr->labels(),
+                static_cast<unsigned int>(cr->size()), 3, cr);
+        return;
     }
+    if (!does_table_exist(table)) {
+        throw std::runtime_error(std::string("Table " + table + " does not exist."));
+    }
+    std::vector<double> a, i;
+    std::vector<int> ell;
+
+    SQLite::Statement query_ell(*conn, "SELECT COUNT(*) FROM " + table);
+    while (query_ell.executeStep()) {
+        a.reserve(static_cast<unsigned int>(query_ell.getColumn(0).getInt()));
+        i.reserve(static_cast<unsigned int>(query_ell.getColumn(0).getInt()));
+        ell.reserve(3 * static_cast<unsigned int>(query_ell.getColumn(0).getInt()));
+    }
+
+    SQLite::Statement query(*conn, "SELECT label_a, label_b, label_c, a, i FROM " + table +
+                                   " ORDER BY a, i, label_a, label_b, label_c");
+    while (query.executeStep()) {
+        for (int c = 0; c < 3; c++) ell.push_back(query.getColumn(c).getInt());
+        a.push_back(query.getColumn(3).getDouble()), i.push_back(query.getColumn(4).getDouble());
+    }
+
+    this->bucket_indices[table] = std::make_shared<BucketIndex>(a, i, ell, 3);
 }
 
-/// Search a table for the specified fields given foci columns using a simple bound query. Searches for all results
-/// between y_a and y_b.
-Nibble::tuples_d Chomp::simple_bound_query (const std::vector<std::string> &foci, const std::string &fields,
-                                            const std::vector<double> &y_a, const std::vector<double> &y_b,
-                                            unsigned int expected) {
-    std::ostringstream condition;
-    select_table(current_table);
+/// @return The bucket index for the given table if one was requested at construction. Otherwise, nullptr.
+std::shared_ptr<BucketIndex> Chomp::bucket_index (const std::string &table) {
+    auto bi = bucket_indices.find(table);
+    return (bi == bucket_indices.end()) ? nullptr : bi->second;
+}
+
+/// Load the given dot table (label_a, label_b, label_c, theta_1, theta_2, phi) and build a uniform grid over its three
+/// features. The grid copies every row into its own cells, so the crumb (if a current one exists) is only used to skip
+/// SQLite while loading. Rows are read in the stored order of the table, so the grid returns candidates in the same
+/// order as simple_bound_query.
+void Chomp::load_feature_grid (const std::string &table) {
+    if (pantry != nullptr && pantry->has_shelf(table + "/feature_grid/cell_row")) {
+        this->feature_grids[table] = std::make_shared<FeatureGrid>(
+                FeatureGrid::attach(pantry, table + "/feature_grid/"));
+        return;
+    }
+
+    std::string crumb = Crumb::path_for(database_name, table);
+    if (is_crumb_current(table)) {
+        std::shared_ptr<Crumb> cr = Crumb::open(crumb);
+        if (cr->get_n_labels() != 3 || cr->label_column("label_a") != 0 || cr->label_column("label_b") != 1 ||
+            cr->label_column("label_c") != 2 || cr->feature_column("theta_1") == Crumb::NO_COLUMN_FOUND ||
+            cr->feature_column("theta_2") == Crumb::NO_COLUMN_FOUND ||
+            cr->feature_column("phi") == Crumb::NO_COLUMN_FOUND) {
+            throw std::runtime_error(std::string("Crumb file " + crumb + " is not a dot table."));
+        }
+
+        this->feature_grids[table] = std::make_shared<FeatureGrid>(
+                std::array<const double *, 3>{cr->features(cr->feature_column("theta_1")),
+                                              cr->features(cr->feature_column("theta_2")),
+                                              cr->features(cr->feature_column("phi"))},
+                cr->labels(), static_cast<unsigned int>(cr->size()), 3);
+        return;
+    }
+    if (!does_table_exist(table)) {
+        throw std::runtime_error(std::string("Table " + table + " does not exist."));
+    }
+    std::array<std::vector<double>, 3> y;
+    std::vector<int> ell;
+
+    SQLite::Statement query_ell(*conn, "SELECT COUNT(*) FROM " + table);
+    while (query_ell.executeStep()) {
+        for (std::vector<double> &y_d : y) y_d.reserve(static_cast<unsigned int>(query_ell.getColumn(0).getInt()));
+        ell.reserve(3 * static_cast<unsigned int>(query_ell.getColumn(0).getInt()));
+    }
 
-    condition << std::setprecision(std::numeric_limits<double>::digits10 + 1) << std::fixed;
-    for (unsigned int i = 0; i < foci.size(); i++) {
-        condition << foci[i] << " BETWEEN " << y_a[i] << " AND " << y_b[i] << " ";
-        if (i < foci.size() - 1) condition << " AND ";
+    SQLite::Statement query(*conn, "SELECT label_a, label_b, label_c, theta_1, theta_2, phi FROM " + table +
+                                   " ORDER BY theta_1, theta_2, phi, label_a, label_b, label_c");
+    while (query.executeStep()) {
+        for (int c = 0; c < 3; c++) ell.push_back(query.getColumn(c).getInt());
+        for (int d = 0; d < 3; d++) y[d].push_back(query.getColumn(3 + d).getDouble());
     }
 
-    Nibble::tuples_d result = search_table(fields, condition.str(), expected);
-    return (result.empty()) ? Nibble::tuples_d{} : result;
+    this->feature_grids[table] = std::make_shared<FeatureGrid>(
+            std::array<const double *, 3>{y[0].data(), y[1].data(), y[2].data()}, ell.data(),
+            static_cast<unsigned int>(ell.size() / 3), 3);
 }
+
+/// @return The feature grid for the given table if one was requested at construction. Otherwise, nullptr.
+std::shared_ptr<FeatureGrid> Chomp::feature_grid (const std::string &table) {
+    auto fg = feature_grids.find(table);
+    return (fg == feature_grids.end()) ? nullptr : fg->second;
+}
+
+/// Constructor. Our handle shares the catalog and the in-memory indices of the given Chomp, but not its connection
+/// or its statement cache. No connection is opened until our first search.
+Chomp::Handle::Handle (const std::shared_ptr<Chomp> &ch, const std::string &table) : reader(*ch) {
+    reader.select_table(table);
+}
+
+/// @return The name of the table this handle searches.
+const std::string &Chomp::Handle::get_table () const { return reader.current_table; }
@@ -0,0 +1,198 @@
+/// @file crumb.cpp
+/// @author Glenn Galvizo
+///
+/// Source file for Crumb class, which writes and memory-maps versioned binary images of the tables in a Nibble
+/// database.
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "storage/crumb.h"
+
+const char Crumb::MAGIC[8] = {'H', 'O', 'K', 'U', 'C', 'R', 'M', 'B'};
+const uint32_t Crumb::VERSION = 2;
+const uint32_t Crumb::ALIGNMENT = 64;
+const unsigned int Crumb::NAME_SIZE = 32;
+const int Crumb::NO_COLUMN_FOUND = -1;
+
+/// Byte order marker. A file written on a machine with a different endianness will not match this when read.
+static const uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+uint64_t Crumb::align (const uint64_t offset) { return (offset + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT; }
+
+/// The binary image of a table lives next to its database: 'nibble.db' + 'ANGLE' -> 'nibble.db.ANGLE.crumb'.
+std::string Crumb::path_for (const std::string &database_name, const std::string &table) {
+    return database_name + "." + table + ".crumb";
+}
+bool Crumb::does_crumb_exist (const std::string &path) {
+    struct stat s = {};
+    return stat(path.c_str(), &s) == 0 && S_ISREG(s.st_mode);
+}
+
+/// Check that the file at path is a crumb of our version, written from a table with the given fingerprint. Only the
+/// header is read. A crumb left behind by an older generation of its table (or by an older Crumb) fails this check.
+///
+/// @return True if the crumb at path may be used in place of the table with the given fingerprint.
+bool Crumb::is_crumb_current (const std::string &path, const uint64_t fingerprint) {
+    std::ifstream in(path, std::ios::binary);
+    Header h = {};
+    in.read(reinterpret_cast<char *>(&h), sizeof(Header));
+    return in && std::equal(MAGIC, MAGIC + sizeof(MAGIC), h.magic) && h.version == VERSION &&
+           h.byte_order == BYTE_ORDER_MARK && h.fingerprint == fingerprint;
+}
+
+/// Write the given table to a binary image at path. INT columns are treated as labels, and all other columns are
+/// treated as features. Rows keep their stored order (rowid, or the key of a clustered table), so a table passed
+/// through sort_and_index or clustered on its focus remains sorted by its focus. The image is written to a temporary
+/// file first and then renamed, so concurrent readers never map a partially written file. The fingerprint of the table
+/// is stored with the image, so readers can tell when the table has since changed.
+int Crumb::write (Nibble &nb, const std::string &table, const std::string &path) {
+    std::vector<std::string> label_names, feature_names;
+    SQLite::Statement query_info(*nb.conn, "PRAGMA table_info (" + table + ")");
+    while (query_info.executeStep()) {
+        std::string name = query_info.getColumn(1).getString(), type = query_info.getColumn(2).getString();
+        if (name.size() >= NAME_SIZE) throw std::runtime_error(std::string("Column name " + name + " is too long."));
+
+        std::transform(type.begin(), type.end(), type.begin(), ::toupper);
+        ((type.find("INT") != std::string::npos) ? label_names : feature_names).push_back(name);
+    }
+    if (label_names.empty() && feature_names.empty()) {
+        throw std::runtime_error(std::string("Table " + table + " does not exist."));
+    }
+
+    // Read the entire table, labels first.
+    std::string fields;
+    for (const std::string &name : label_names) fields += name + ", ";
+    for (const std::string &name : feature_names) fields += name + ", ";
+    fields.erase(fields.size() - 2);
+
+    std::vector<int32_t> labels;
+    std::vector<std::vector<double>> features(feature_names.size());
+    SQLite::Statement query(*nb.conn, "SELECT " + fields + " FROM " + table);
+    while (query.executeStep()) {
+        int c = 0;
+        for (unsigned int i = 0; i < label_names.size(); i++) labels.push_back(query.getColumn(c++).getInt());
+        for (auto &feature : features) feature.push_back(query.getColumn(c++).getDouble());
+    }
+
+    Header h = {};
+    std::copy(MAGIC, MAGIC + sizeof(MAGIC), h.magic);
+    h.version = VERSION, h.byte_order = BYTE_ORDER_MARK, h.fingerprint = nb.fingerprint(table);
+    h.n_labels = static_cast<uint32_t>(label_names.size());
+    h.n_features = static_cast<uint32_t>(feature_names.size());
+    h.n_rows = (h.n_labels > 0) ? labels.size() / h.n_labels : features[0].size();
+    h.label_offset = align(sizeof(Header) + NAME_SIZE * (h.n_labels + h.n_features));
+    h.feature_offset = align(h.label_offset + sizeof(int32_t) * labels.size());
+    h.feature_stride = align(sizeof(double) * h.n_rows);
+
+    std::string temporary_path = path + ".tmp";
+    std::ofstream out(temporary_path, std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) throw std::runtime_error(std::string("Crumb file cannot be opened."));
+
+    auto pad_to = [&out] (const uint64_t offset) -> void {
+        std::vector<char> zeros(static_cast<size_t>(offset - static_cast<uint64_t>(out.tellp())), 0);
+        out.write(zeros.data(), zeros.size());
+    };
+    auto write_name = [&out] (const std::string &name) -> void {
+        char buffer[NAME_SIZE] = {};
+        std::copy(name.begin(), name.end(), buffer);
+        out.write(buffer, NAME_SIZE);
+    };
+
+    out.write(reinterpret_cast<const char *>(&h), sizeof(Header));
+    std::for_each(label_names.begin(), label_names.end(), write_name);
+    std::for_each(feature_names.begin(), feature_names.end(), write_name);
+    pad_to(h.label_offset);
+    out.write(reinterpret_cast<const char *>(labels.data()), sizeof(int32_t) * labels.size());
+    for (unsigned int c = 0; c < features.size(); c++) {
+        pad_to(h.feature_offset + c * h.feature_stride);
+        out.write(reinterpret_cast<const char *>(features[c].data()), sizeof(double) * features[c].size());
+    }
+    pad_to(h.feature_offset + features.size() * h.feature_stride);
+    out.close();
+
+    if (out.fail() || std::rename(temporary_path.c_str(), path.c_str()) != 0) {
+        throw std::runtime_error(std::string("Crumb file " + path + " could not be written."));
+    }
+    return 0;
+}
+
+/// Check that every block described by the given header lies within a file of map_size bytes, in order: the header,
+/// the column names, the label block, and then each feature block. Each product is bounded by a division first, so
+/// that a corrupt header cannot overflow our arithmetic.
+///
+/// @return True if the header describes blocks that can be read from our mapping.
+bool Crumb::is_layout_valid (const Header &h, const uint64_t map_size) {
+    const uint64_t names_end = sizeof(Header) + static_cast<uint64_t>(NAME_SIZE) * (h.n_labels + h.n_features);
+    if (names_end > h.label_offset || h.label_offset > h.feature_offset || h.feature_offset > map_size) return false;
+    if (h.label_offset % alignof(int32_t) != 0 || h.feature_offset % alignof(double) != 0 ||
+        h.feature_stride % alignof(double) != 0) {
+        return false;
+    }
+
+    const uint64_t label_row_size = sizeof(int32_t) * static_cast<uint64_t>(h.n_labels);
+    if (label_row_size != 0 && h.n_rows > (h.feature_offset - h.label_offset) / label_row_size) return false;
+    if (h.n_features == 0) return true;
+    return h.n_rows <= h.feature_stride / sizeof(double) &&
+           h.feature_stride <= (map_size - h.feature_offset) / h.n_features;
+}
+
+/// Map the binary image at path into memory. The mapping is read-only and shared, so every process that opens the
+/// same file uses the same physical pages.
+std::shared_ptr<Crumb> Crumb::open (const std::string &path) { return std::shared_ptr<Crumb>(new Crumb(path)); }
+
+Crumb::Crumb (const std::string &path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) throw std::runtime_error(std::string("Crumb file " + path + " cannot be opened."));
+
+    struct stat s = {};
+    if (fstat(fd, &s) != 0 || static_cast<size_t>(s.st_size) < sizeof(Header)) {
+        ::close(fd);
+        throw std::runtime_error(std::string("Crumb file " + path + " is truncated."));
+    }
+    this->map_size = static_cast<size_t>(s.st_size);
+    this->map = mmap(nullptr, map_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) throw std::runtime_error(std::string("Crumb file " + path + " cannot be mapped."));
+
+    // Validate the header before trusting any of the offsets inside it.
+    const auto *base = static_cast<const char *>(map);
+    Header h = {};
+    std::memcpy(&h, base, sizeof(Header));
+    if (!std::equal(MAGIC, MAGIC + sizeof(MAGIC), h.magic) || h.version != VERSION ||
+        h.byte_order != BYTE_ORDER_MARK || !is_layout_valid(h, map_size)) {
+        munmap(map, map_size);
+        throw std::runtime_error(std::string("Crumb file " + path + " is not a version " +
+                                             std::to_string(VERSION) + " crumb."));
+    }
+    this->n_rows = h.n_rows, this->fingerprint = h.fingerprint;
+    this->n_labels = h.n_labels, this->n_features = h.n_features;
+
+    const char *name = base + sizeof(Header);
+    for (unsigned int c = 0; c < n_labels + n_features; c++, name += NAME_SIZE) {
+        (c < n_labels ? label_names : feature_names).emplace_back(name, strnlen(name, NAME_SIZE));
+    }
+
+    this->label_block = reinterpret_cast<const int32_t *>(base + h.label_offset);
+    for (unsigned int c = 0; c < n_features; c++) {
+        feature_blocks.push_back(reinterpret_cast<const double *>(base + h.feature_offset + c * h.feature_stride));
+    }
+}
+Crumb::~Crumb () { munmap(map, map_size); }
+
+/// @return Index of the label column with the given name. NO_COLUMN_FOUND if this does not exist.
+int Crumb::label_column (const std::string &name) const {
+    auto c = std::find(label_names.begin(), label_names.end(), name);
+    return (c == label_names.end()) ? NO_COLUMN_FOUND : static_cast<int>(c - label_names.begin());
+}
+/// @return Index of the feature column with the given name. NO_COLUMN_FOUND if this does not exist.
+int Crumb::feature_column (const std::string &name) const {
+    auto c = std::find(feature_names.begin(), feature_names.end(), name);
+    return (c == feature_names.end()) ? NO_COLUMN_FOUND : static_cast<int>(c - feature_names.begin());
+}
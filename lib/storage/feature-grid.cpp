@@ -0,0 +1,141 @@
+/// @file feature-grid.cpp
+/// @author Glenn Galvizo
+///
+/// Source file for FeatureGrid class, which holds an in-memory uniform grid over three feature columns of a reference
+/// table.
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include "storage/feature-grid.h"
+
+const unsigned int FeatureGrid::DEFAULT_OCCUPANCY = 4;
+
+/// Arrays of a grid that we have built ourselves.
+struct Cells {
+    std::vector<unsigned int> begin;
+    std::vector<std::array<double, 3>> y;
+    std::vector<int> ell;
+    std::vector<unsigned int> row;
+};
+
+/// Constructor. Builds the grid over n rows, where row r has the features y[0][r], y[1][r], y[2][r] and the labels
+/// ell[r * stride] through ell[r * stride + stride - 1]. The grid holds roughly n / occupancy cells, split evenly
+/// between the features. Everything is copied into the grid's own cell-ordered arrays, so the inputs may be released
+/// after construction.
+FeatureGrid::FeatureGrid (const std::array<const double *, 3> &y, const int *ell, const unsigned int n,
+                          const unsigned int stride, const unsigned int occupancy) : n(n), stride(stride) {
+    unsigned int n_d = static_cast<unsigned int>(std::max(1.0, std::cbrt(static_cast<double>(n) /
+                                                                         std::max(1u, occupancy))));
+    for (unsigned int d = 0; d < 3; d++) {
+        double y_min = (n == 0) ? 0 : *std::min_element(y[d], y[d] + n);
+        double y_max = (n == 0) ? 0 : *std::max_element(y[d], y[d] + n);
+        this->y_0[d] = y_min, this->n_cells[d] = n_d;
+        this->w[d] = (y_max > y_min) ? (y_max - y_min) / n_d : 1;
+    }
+
+    // Count the rows of each cell, then place each row at the next open slot of its cell (a counting sort). Rows
+    // within a cell keep their table order.
+    auto cells = std::make_shared<Cells>();
+    std::vector<unsigned int> c_r(n);
+    cells->begin.assign(get_n_cells() + 1, 0);
+    for (unsigned int r = 0; r < n; r++) {
+        c_r[r] = (cell_of(2, y[2][r]) * n_cells[1] + cell_of(1, y[1][r])) * n_cells[0] + cell_of(0, y[0][r]);
+        cells->begin[c_r[r] + 1]++;
+    }
+    for (unsigned int c = 0; c < get_n_cells(); c++) {
+        cells->begin[c + 1] += cells->begin[c];
+    }
+
+    std::vector<unsigned int> next(cells->begin.begin(), cells->begin.end() - 1);
+    cells->y.resize(n), cells->ell.resize(static_cast<std::size_t>(n) * stride), cells->row.resize(n);
+    for (unsigned int r = 0; r < n; r++) {
+        unsigned int p = next[c_r[r]]++;
+        cells->y[p] = {y[0][r], y[1][r], y[2][r]};
+        std::copy(ell + static_cast<std::size_t>(r) * stride, ell + static_cast<std::size_t>(r + 1) * stride,
+                  cells->ell.begin() + static_cast<std::size_t>(p) * stride);
+        cells->row[p] = r;
+    }
+
+    this->cell_begin = cells->begin.data(), this->cell_y = cells->y.data();
+    this->cell_ell = cells->ell.data(), this->cell_row = cells->row.data(), this->cell_storage = cells;
+}
+
+/// @return Shelves that hold this grid (its shape and its cells), named with the given prefix.
+std::vector<Pantry::Shelf> FeatureGrid::shelves (const std::string &prefix) const {
+    std::vector<double> shape = {static_cast<double>(stride)};
+    for (unsigned int d = 0; d < 3; d++) shape.insert(shape.end(), {y_0[d], w[d], static_cast<double>(n_cells[d])});
+
+    return {
+            Pantry::shelf_of(prefix + "shape", shape),
+            Pantry::shelf_of(prefix + "cell_begin", cell_begin, get_n_cells() + 1),
+            Pantry::shelf_of(prefix + "cell_y", cell_y, n),
+            Pantry::shelf_of(prefix + "cell_ell", cell_ell, static_cast<uint64_t>(n) * stride),
+            Pantry::shelf_of(prefix + "cell_row", cell_row, n)
+    };
+}
+
+/// Attach to a grid that was published (with shelves) to the given pantry. Nothing is copied or rebuilt.
+FeatureGrid FeatureGrid::attach (const std::shared_ptr<const Pantry> &pantry, const std::string &prefix) {
+    uint64_t n_shape, n_begin, n_y, n_ell, n_row;
+    FeatureGrid fg;
+    const double *shape = pantry->shelf<double>(prefix + "shape", n_shape);
+    if (n_shape != 10) throw std::runtime_error(std::string("Shelves " + prefix + "* do not hold a feature grid."));
+    fg.stride = static_cast<unsigned int>(shape[0]);
+    for (unsigned int d = 0; d < 3; d++) {
+        fg.y_0[d] = shape[1 + 3 * d], fg.w[d] = shape[2 + 3 * d];
+        fg.n_cells[d] = static_cast<unsigned int>(shape[3 + 3 * d]);
+    }
+
+    fg.cell_begin = pantry->shelf<unsigned int>(prefix + "cell_begin", n_begin);
+    fg.cell_y = pantry->shelf<std::array<double, 3>>(prefix + "cell_y", n_y);
+    fg.cell_ell = pantry->shelf<int>(prefix + "cell_ell", n_ell);
+    fg.cell_row = pantry->shelf<unsigned int>(prefix + "cell_row", n_row);
+    if (n_begin != fg.get_n_cells() + 1 || n_row != n_y || n_ell != n_y * fg.stride) {
+        throw std::runtime_error(std::string("Shelves " + prefix + "* do not hold a feature grid."));
+    }
+    fg.n = static_cast<unsigned int>(n_y), fg.cell_storage = pantry;
+    return fg;
+}
+
+/// @return Index of the cell along feature d that holds y_d. Values outside of the grid are clamped to its edges.
+unsigned int FeatureGrid::cell_of (const unsigned int d, const double y_d) const {
+    double c = std::floor((y_d - y_0[d]) / w[d]);
+    return static_cast<unsigned int>(std::max(0.0, std::min(static_cast<double>(n_cells[d] - 1), c)));
+}
+
+/// Find all entries whose features lie between y_a and y_b (inclusive, to match SQL's BETWEEN). Only the cells that
+/// the box touches are visited, and each of their entries is checked against the exact bounds.
+///
+/// @param out Buffer that holds the matching entries on return, in the order of their rows in the source table.
+/// @return The number of matching entries.
+unsigned int FeatureGrid::bound_query (const std::array<double, 3> &y_a, const std::array<double, 3> &y_b,
+                                       std::vector<unsigned int> &out) const {
+    out.clear();
+    if (n == 0) return 0;
+    std::array<unsigned int, 3> c_a, c_b;
+    for (unsigned int d = 0; d < 3; d++) {
+        if (y_a[d] > y_b[d] || y_b[d] < y_0[d]) return 0;
+        c_a[d] = cell_of(d, y_a[d]), c_b[d] = cell_of(d, y_b[d]);
+    }
+
+    for (unsigned int k = c_a[2]; k <= c_b[2]; k++) {
+        for (unsigned int j = c_a[1]; j <= c_b[1]; j++) {
+            unsigned int c = (k * n_cells[1] + j) * n_cells[0];
+            for (unsigned int p = cell_begin[c + c_a[0]]; p < cell_begin[c + c_b[0] + 1]; p++) {
+                const std::array<double, 3> &y = cell_y[p];
+                if (y[0] >= y_a[0] && y[0] <= y_b[0] && y[1] >= y_a[1] && y[1] <= y_b[1] && y[2] >= y_a[2] &&
+                    y[2] <= y_b[2]) {
+                    out.push_back(p);
+                }
+            }
+        }
+    }
+
+    // Entries of neighboring cells interleave in the table, so restore the table's order.
+    std::sort(out.begin(), out.end(), [this] (const unsigned int p_1, const unsigned int p_2) -> bool {
+        return cell_row[p_1] < cell_row[p_2];
+    });
+    return static_cast<unsigned int>(out.size());
+}
@@ -0,0 +1,103 @@
+/// @file k-vector.cpp
+/// @author Glenn Galvizo
+///
+/// Source file for KVector class, which holds an in-memory k-vector index over a single sorted feature column of a
+/// reference table.
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+
+#include "storage/k-vector.h"
+
+/// Constructor. Builds the k-vector over the keys y, which must already be sorted in ascending order. Row r owns the
+/// labels ell[r * stride] through ell[r * stride + stride - 1]. The keys and labels are copied.
+KVector::KVector (const std::vector<double> &y, const std::vector<int> &ell, const unsigned int stride) {
+    if (ell.size() != y.size() * stride) {
+        throw std::runtime_error(std::string("Number of labels does not match the number of keys."));
+    }
+    auto columns = std::make_shared<std::pair<std::vector<double>, std::vector<int>>>(y, ell);
+    this->y = columns->first.data(), this->ell = columns->second.data(), this->storage = columns;
+    this->n = static_cast<unsigned int>(y.size()), this->stride = stride;
+    build();
+}
+
+/// Constructor. Builds the k-vector over n keys and n * stride labels that live elsewhere (i.e. a memory-mapped
+/// file). Nothing is copied: 'storage' is held to keep the memory behind y and ell alive.
+KVector::KVector (const double *y, const int *ell, const unsigned int n, const unsigned int stride,
+                  const std::shared_ptr<const void> &storage) {
+    this->y = y, this->ell = ell, this->storage = storage;
+    this->n = n, this->stride = stride;
+    build();
+}
+
+void KVector::build () {
+    if (!std::is_sorted(y, y + n)) {
+        throw std::runtime_error(std::string("Keys of a k-vector must be sorted."));
+    }
+
+    // Our line z(i) = m * i + q runs from just below the smallest key to just above the largest key.
+    double xi = (n == 0) ? 0 : std::numeric_limits<double>::epsilon() *
+                               std::max(std::fabs(y[0]), std::fabs(y[n - 1]));
+    this->q = (n == 0) ? 0 : y[0] - xi;
+    this->m = (n < 2) ? 1 : (y[n - 1] - y[0] + 2 * xi) / (n - 1);
+
+    // k(i) is the number of keys that are less than or equal to z(i).
+    auto k_built = std::make_shared<std::vector<unsigned int>>(n);
+    for (unsigned int i = 0, j = 0; i < n; i++) {
+        double z = m * i + q;
+        while (j < n && y[j] <= z) j++;
+        (*k_built)[i] = j;
+    }
+    if (n > 0) (*k_built)[n - 1] = n;
+    this->k = k_built->data(), this->k_storage = k_built;
+}
+
+/// @return Shelves that hold this k-vector (keys, labels and the k-vector itself), named with the given prefix.
+std::vector<Pantry::Shelf> KVector::shelves (const std::string &prefix) const {
+    return {
+            Pantry::shelf_of(prefix + "y", y, n),
+            Pantry::shelf_of(prefix + "ell", ell, static_cast<uint64_t>(n) * stride),
+            Pantry::shelf_of(prefix + "k", k, n),
+            Pantry::shelf_of(prefix + "line", std::vector<double>{m, q, static_cast<double>(stride)})
+    };
+}
+
+/// Attach to a k-vector that was published (with shelves) to the given pantry. Nothing is copied or rebuilt.
+KVector KVector::attach (const std::shared_ptr<const Pantry> &pantry, const std::string &prefix) {
+    uint64_t n_y, n_ell, n_k, n_line;
+    KVector kv;
+    kv.y = pantry->shelf<double>(prefix + "y", n_y), kv.ell = pantry->shelf<int>(prefix + "ell", n_ell);
+    kv.k = pantry->shelf<unsigned int>(prefix + "k", n_k);
+    const double *line = pantry->shelf<double>(prefix + "line", n_line);
+    if (n_line != 3 || n_k != n_y || n_ell != n_y * static_cast<uint64_t>(line[2])) {
+        throw std::runtime_error(std::string("Shelves " + prefix + "* do not hold a k-vector."));
+    }
+
+    kv.m = line[0], kv.q = line[1], kv.stride = static_cast<unsigned int>(line[2]);
+    kv.n = static_cast<unsigned int>(n_y), kv.storage = pantry, kv.k_storage = nullptr;
+    return kv;
+}
+
+/// Find all rows whose key is between y_a and y_b (inclusive, to match SQL's BETWEEN). The k-vector narrows the
+/// search down to a handful of rows, and the ends of this range are then trimmed to the exact bounds.
+KVector::Range KVector::bound_query (const double y_a, const double y_b) const {
+    if (n == 0 || y_a > y_b || y_b < y[0] || y_a > y[n - 1]) return Range{0, 0};
+
+    // Locate the line indices that bracket our search.
+    auto clamp = [this] (const double j) -> unsigned int {
+        return static_cast<unsigned int>(std::max(0.0, std::min(static_cast<double>(n - 1), j)));
+    };
+    unsigned int j_b = clamp(std::floor((y_a - q) / m)), j_t = clamp(std::ceil((y_b - q) / m));
+    unsigned int begin = k[j_b], end = k[j_t];
+
+    // Trim the candidate range to the exact bounds.
+    while (begin > 0 && y[begin - 1] >= y_a) begin--;
+    while (begin < end && y[begin] < y_a) begin++;
+    while (end < n && y[end] <= y_b) end++;
+    while (end > begin && y[end - 1] > y_b) end--;
+
+    return Range{begin, end};
+}
@@ -4,17 +4,94 @@
 /// Source file for Nibble class, which facilitate the retrieval and storage of various lookup tables.
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <sstream>
 #include <libgen.h>
 
+#include "third-party/sqlite-cpp/Backup.h"
 #include "storage/nibble.h"
 
 const int Nibble::TABLE_NOT_CREATED_RET = -1;
 const int Nibble::NO_RESULT_FOUND_EITHER = 0;
+const unsigned int Nibble::STATEMENT_CACHE_LIMIT = 256;
+const unsigned int Nibble::BULK_BATCH_SIZE = 64;
+const std::string Nibble::RTREE_SUFFIX = "_RTREE";
+const std::string Nibble::RTREE_ROWS_SUFFIX = "_RTREE_ROWS";
+const std::string Nibble::GENERATION_TABLE = "NIBBLE_GENERATIONS";
 
-Nibble::Nibble (const std::string &database_name) {
-    // Automatically create the database if it does not exist.
+/// Number of in-memory copies made by this process so far. Each copy is named after this, so no two are confused.
+static std::atomic<unsigned long> n_memory_copies{0};
+
+/// Constructor. If in_memory is set, the database must already exist. Its file is opened read-only and immutable (so
+/// no lock is ever taken on it), and every page is copied with the backup API into a named, shared-cache in-memory
+/// database. All searches are then answered from RAM, and every connection made by reconnect shares this one copy.
+/// Writes are allowed (and are seen by every connection to our copy), but are lost once its last connection closes.
+Nibble::Nibble (const std::string &database_name, const bool in_memory) : database_name(database_name),
+                                                                          is_in_memory(in_memory) {
+    const int FLAGS = SQLite::OPEN_READWRITE | SQLite::OPEN_CREATE; // NOLINT(hicpp-signed-bitwise)
+    this->statements = std::make_shared<std::map<std::string, std::shared_ptr<SQLite::Statement>>>();
+    if (!in_memory) {
+        // Automatically create the database if it does not exist.
+        this->conn = std::make_shared<SQLite::Database>(database_name, FLAGS);
+        return;
+    }
+
+    // Escape the characters that would otherwise end the path of our URI.
+    std::string uri = "file:";
+    for (const char c : database_name) {
+        if (c == '%') uri.append("%25");
+        else if (c == '?') uri.append("%3f");
+        else if (c == '#') uri.append("%23");
+        else uri.push_back(c);
+    }
+    const int DISK_FLAGS = SQLite::OPEN_READONLY | SQLite::OPEN_URI; // NOLINT(hicpp-signed-bitwise)
+    SQLite::Database disk(uri + "?immutable=1", DISK_FLAGS);
+
+    this->memory_uri = "file:hoku-memory-" + std::to_string(n_memory_copies++) + "?mode=memory&cache=shared";
+    connect_to_memory_copy();
+    SQLite::Backup backup(*conn, disk);
+    backup.executeStep();
+    if (backup.getRemainingPageCount() != 0) {
+        throw std::runtime_error(std::string("Database " + database_name + " could not be copied into memory."));
+    }
+}
+
+/// Retrieve the prepared statement for the given SQL, preparing it only if this is the first time we have seen it.
+/// The statement is reset and its bindings are cleared. Callers must reset the statement once they are done with it,
+/// so no read is left pending on our connection. If our cache is full, it is emptied first. Statements that are still
+/// held by a caller are only released by their holder.
+///
+/// @return The prepared statement. This stays valid for as long as it is held, even if our cache is emptied.
+std::shared_ptr<SQLite::Statement> Nibble::prepare (const std::string &sql) {
+    auto s = statements->find(sql);
+    if (s == statements->end()) {
+        if (statements->size() >= STATEMENT_CACHE_LIMIT) statements->clear();
+        s = statements->emplace(sql, std::make_shared<SQLite::Statement>(*conn, sql)).first;
+    }
+
+    s->second->reset(), s->second->clearBindings();
+    return s->second;
+}
+
+/// Replace our connection with a new connection to the same database (to the same in-memory copy of it, if we are in
+/// memory), with an empty statement cache. Copies of this Nibble made before keep the old connection. This lets each
+/// thread search the same database through a connection of its own, without the database ever being copied again.
+void Nibble::reconnect () {
     const int FLAGS = SQLite::OPEN_READWRITE | SQLite::OPEN_CREATE; // NOLINT(hicpp-signed-bitwise)
-    this->conn = std::make_shared<SQLite::Database>(database_name, FLAGS);
+    if (is_in_memory) connect_to_memory_copy();
+    else this->conn = std::make_shared<SQLite::Database>(database_name, FLAGS);
+    this->statements = std::make_shared<std::map<std::string, std::shared_ptr<SQLite::Statement>>>();
+}
+
+/// Open a new connection to our in-memory copy (creating it, if this is the first). Connections to the same copy
+/// share its pages, and would otherwise take a table lock for each read. Reads here never wait on these locks, which
+/// is safe as long as the copy is only searched once it is filled.
+void Nibble::connect_to_memory_copy () {
+    const int FLAGS = SQLite::OPEN_READWRITE | SQLite::OPEN_CREATE | SQLite::OPEN_URI; // NOLINT(hicpp-signed-bitwise)
+    this->conn = std::make_shared<SQLite::Database>(memory_uri, FLAGS);
+    (*conn).exec("PRAGMA read_uncommitted = 1");
 }
 
 void Nibble::select_table (const std::string &table) { this->current_table = table; }
@@ -30,49 +107,106 @@ bool Nibble::does_table_exist (const std::string &table) {
 
 Nibble::tuples_d Nibble::search_table (const std::string &fields, const std::string &constraint,
                                        const unsigned int expected) {
+    return search_table(fields, constraint, tuple_d{}, expected);
+}
+
+/// Search the current table for all rows that meet the given constraint. Each '?' in the constraint is bound to the
+/// corresponding entry of values, so constraints that only differ in their values share the same prepared statement.
+///
+/// @return All rows (as doubles) that meet our constraint.
+Nibble::tuples_d Nibble::search_table (const std::string &fields, const std::string &constraint,
+                                       const tuple_d &values, const unsigned int expected) {
     tuples_d result;
-    std::string sql =
-            "SELECT " + fields +
-            " FROM " + current_table +
-            " WHERE " + constraint;
+    std::shared_ptr<SQLite::Statement> query = prepare("SELECT " + fields + " FROM " + current_table + " WHERE " +
+                                                       constraint);
+    for (unsigned int i = 0; i < values.size(); i++) query->bind(i + 1, values[i]);
 
     result.reserve(expected);
-    SQLite::Statement query(*conn, sql);
-    while (query.executeStep()) {
+    while (query->executeStep()) {
         tuple_d tup;
 
-        for (int i = 0; i < query.getColumnCount(); i++) tup.push_back(query.getColumn(i).getDouble());
+        for (int i = 0; i < query->getColumnCount(); i++) tup.push_back(query->getColumn(i).getDouble());
         result.push_back(tup);
     }
 
+    query->reset();
     return result;
 }
+/// Search the current table for all rows that meet the given constraint, binding each '?' in the constraint to the
+/// corresponding entry of values. The label fields are read as ints and the feature fields as doubles, into 'out'.
+///
+/// @return The number of rows found.
+int Nibble::search_table (const std::string &labels, const std::string &features, const std::string &constraint,
+                          const tuple_d &values, Results &out) {
+    std::shared_ptr<SQLite::Statement> query = prepare("SELECT " + labels +
+                                                       ((labels.empty() || features.empty()) ? "" : ", ") + features +
+                                                       " FROM " + current_table + " WHERE " + constraint);
+    for (unsigned int i = 0; i < values.size(); i++) query->bind(i + 1, values[i]);
+
+    fetch_results(*query, count_fields(labels), count_fields(features), out);
+    return static_cast<int>(out.size());
+}
+
+/// @return The number of fields in the given comma-separated list of fields.
+unsigned int Nibble::count_fields (const std::string &fields) {
+    return (fields.empty()) ? 0 : 1 + static_cast<unsigned int>(std::count(fields.begin(), fields.end(), ','));
+}
+
+/// Step through the given (bound) statement, storing the first n_labels columns of each row as labels and the next
+/// n_features columns as features. The buffers of 'out' only grow, and are never shrunk. The statement is reset after.
+void Nibble::fetch_results (SQLite::Statement &query, const unsigned int n_labels, const unsigned int n_features,
+                            Results &out) {
+    out.n_labels = n_labels, out.n_features = n_features, out.n_rows = 0;
+
+    while (query.executeStep()) {
+        if ((out.n_rows + 1) * n_labels > out.ell.size()) out.ell.resize(2 * (out.n_rows + 1) * n_labels);
+        if ((out.n_rows + 1) * n_features > out.y.size()) out.y.resize(2 * (out.n_rows + 1) * n_features);
+
+        for (unsigned int i = 0; i < n_labels; i++) {
+            out.ell[out.n_rows * n_labels + i] = query.getColumn(static_cast<int>(i)).getInt();
+        }
+        for (unsigned int i = 0; i < n_features; i++) {
+            out.y[out.n_rows * n_features + i] = query.getColumn(static_cast<int>(n_labels + i)).getDouble();
+        }
+        out.n_rows++;
+    }
+
+    query.reset();
+}
+
 Nibble::tuples_d Nibble::search_table (const std::string &fields, const unsigned int expected) {
     tuples_d result;
-    std::string sql =
-            "SELECT " + fields +
-            " FROM " + current_table;
+    std::shared_ptr<SQLite::Statement> query = prepare("SELECT " + fields + " FROM " + current_table);
 
     result.reserve(expected);
-    SQLite::Statement query(*conn, sql);
-    while (query.executeStep()) {
+    while (query->executeStep()) {
         tuple_d tup;
 
-        for (int i = 0; i < query.getColumnCount(); i++) tup.push_back(query.getColumn(i).getDouble());
+        for (int i = 0; i < query->getColumnCount(); i++) tup.push_back(query->getColumn(i).getDouble());
         result.push_back(tup);
     }
 
+    query->reset();
     return result;
 }
 Nibble::Either Nibble::search_single (const std::string &fields, const std::string &constraint) {
-    std::string sql =
-            "SELECT " + fields +
-            " FROM " + current_table +
-            (constraint.empty() ? "" : " WHERE " + constraint);
+    return search_single(fields, constraint, tuple_d{});
+}
 
-    SQLite::Statement query(*conn, sql);
-    while (query.executeStep()) return Either{query.getColumn(0).getDouble(), 0}; // This should only execute once.
-    return Either{0, NO_RESULT_FOUND_EITHER};
+/// Search the current table for the first row that meets the given constraint, binding each '?' in the constraint to
+/// the corresponding entry of values.
+///
+/// @return NO_RESULT_FOUND_EITHER if no row meets our constraint. Otherwise, the first field of the first such row.
+Nibble::Either Nibble::search_single (const std::string &fields, const std::string &constraint,
+                                      const tuple_d &values) {
+    std::shared_ptr<SQLite::Statement> query = prepare("SELECT " + fields + " FROM " + current_table +
+                                                       (constraint.empty() ? "" : " WHERE " + constraint));
+    for (unsigned int i = 0; i < values.size(); i++) query->bind(i + 1, values[i]);
+
+    Either e = (query->executeStep()) ? Either{query->getColumn(0).getDouble(), 0} :
+               Either{0, NO_RESULT_FOUND_EITHER};
+    query->reset();
+    return e;
 }
 
 int Nibble::create_table (const std::string &table, const std::string &schema) {
@@ -89,6 +223,120 @@ int Nibble::create_table (const std::string &table, const std::string &schema) {
     }
 
     (*conn).exec("CREATE TABLE " + table + "(" + schema + ")");
+    stamp_generation(table);
+    return 0;
+}
+
+/// Create a table that is clustered on the given key (WITHOUT ROWID). Rows are stored in a b-tree ordered by the key
+/// itself, so searches on the key need no separate index, and rows inserted in key order are simply appended. The key
+/// must be unique across all rows.
+///
+/// @return TABLE_NOT_CREATED_RET if the table already exists. Otherwise, 0.
+int Nibble::create_table (const std::string &table, const std::string &schema, const std::string &key) {
+    select_table(table);
+    if (does_table_exist(table)) return TABLE_NOT_CREATED_RET;
+
+    (*conn).exec("CREATE TABLE " + table + "(" + schema + ", PRIMARY KEY (" + key + ")) WITHOUT ROWID");
+    stamp_generation(table);
+    return 0;
+}
+
+/// Record a new generation stamp (the time of the change, and always past the previous stamp) for the given table in
+/// GENERATION_TABLE, so the fingerprint of a changed or recreated table never matches that of the table it replaced.
+/// The binary image of the old table (see Crumb::path_for) is deleted as well, as it no longer describes this table.
+void Nibble::stamp_generation (const std::string &table) {
+    (*conn).exec("CREATE TABLE IF NOT EXISTS " + GENERATION_TABLE + " (name TEXT PRIMARY KEY, generation INT)");
+    SQLite::Statement stamp(*conn, "INSERT OR REPLACE INTO " + GENERATION_TABLE + " (name, generation) VALUES (?1, "
+                                   "MAX(?2, IFNULL((SELECT generation FROM " + GENERATION_TABLE + " WHERE name=?1), "
+                                   "0) + 1))");
+    stamp.bind(1, table), stamp.bind(2, static_cast<long long>(
+            std::chrono::system_clock::now().time_since_epoch() / std::chrono::nanoseconds(1)));
+    stamp.exec();
+
+    // An in-memory copy never changes the tables on disk, so their images are left alone.
+    if (!is_in_memory) std::remove((database_name + "." + table + ".crumb").c_str());
+}
+
+/// Summarize the given table as it is now: its schema and its generation stamp, hashed together (FNV-1a). Every table
+/// is stamped again when it is created, sorted, or written to through Nibble, so a table that has changed since has a
+/// different fingerprint. Only the catalog is read here (never the rows), so this is cheap for tables of any size.
+/// Tables created before generation stamps existed have a stamp of 0.
+///
+/// @return Fingerprint of the given table.
+uint64_t Nibble::fingerprint (const std::string &table) {
+    std::string sql;
+    long long generation = 0;
+
+    SQLite::Statement query_sql(*conn, "SELECT sql FROM sqlite_master WHERE type='table' AND name=?");
+    query_sql.bind(1, table);
+    if (query_sql.executeStep()) sql = query_sql.getColumn(0).getString();
+    if (does_table_exist(GENERATION_TABLE)) {
+        SQLite::Statement query_generation(*conn, "SELECT generation FROM " + GENERATION_TABLE + " WHERE name=?");
+        query_generation.bind(1, table);
+        if (query_generation.executeStep()) generation = query_generation.getColumn(0).getInt64();
+    }
+
+    uint64_t h = UINT64_C(14695981039346656037);
+    auto mix = [&h] (const char *bytes, const std::size_t n) -> void {
+        for (std::size_t b = 0; b < n; b++) h = (h ^ static_cast<unsigned char>(bytes[b])) * UINT64_C(1099511628211);
+    };
+    mix(sql.c_str(), sql.size() + 1);
+    mix(reinterpret_cast<const char *>(&generation), sizeof(generation));
+    return h;
+}
+
+/// Insert many rows into the current table at once. 'rows' holds the values of each row back to back, in the order of
+/// 'fields'. Rows are inserted BULK_BATCH_SIZE at a time through reused multi-row statements, all inside a single
+/// transaction. While loading, our connection does not sync to disk and keeps its journal in memory (an interrupted
+/// build is started over anyway). Both settings are restored afterwards. This must not be called inside a transaction.
+/// Our table is stamped with a new generation in the same transaction, so its fingerprint changes with its rows.
+///
+/// @return 0 when finished.
+int Nibble::bulk_insert_into_table (const std::string &fields, const tuple_d &rows) {
+    const unsigned int n_fields = count_fields(fields);
+    if (n_fields == 0 || rows.size() % n_fields != 0) {
+        throw std::runtime_error(std::string("Number of values does not match the number of fields."));
+    }
+    const auto n_rows = static_cast<unsigned int>(rows.size() / n_fields);
+    const unsigned int n_batch = std::max(1u, std::min(BULK_BATCH_SIZE, 999 / n_fields)); // SQLite's variable limit.
+
+    auto insert_sql = [this, &fields, n_fields] (const unsigned int n) -> std::string {
+        std::string row = "(", sql = "INSERT INTO " + current_table + " (" + fields + ") VALUES ";
+        for (unsigned int f = 0; f < n_fields; f++) row.append((f < n_fields - 1) ? "?, " : "?)");
+        for (unsigned int r = 0; r < n; r++) sql.append(row).append((r < n - 1) ? ", " : "");
+        return sql;
+    };
+    auto insert_rows = [this, &rows, n_fields] (SQLite::Statement &query, const unsigned int r, const unsigned int n) {
+        for (unsigned int v = 0; v < n * n_fields; v++) query.bind(static_cast<int>(v + 1), rows[r * n_fields + v]);
+        query.exec(), query.reset();
+    };
+
+    // Relax durability for the duration of our load.
+    const int synchronous = conn->execAndGet("PRAGMA synchronous").getInt();
+    const std::string journal_mode = conn->execAndGet("PRAGMA journal_mode").getString();
+    auto restore_pragmas = [this, synchronous, &journal_mode] () -> void {
+        (*conn).exec("PRAGMA journal_mode = " + journal_mode);
+        (*conn).exec("PRAGMA synchronous = " + std::to_string(synchronous));
+    };
+    (*conn).exec("PRAGMA synchronous = OFF");
+    (*conn).exec("PRAGMA journal_mode = MEMORY");
+
+    try {
+        SQLite::Transaction transaction(*conn);
+        unsigned int r = 0;
+
+        std::shared_ptr<SQLite::Statement> batch = prepare(insert_sql(n_batch));
+        for (; r + n_batch <= n_rows; r += n_batch) insert_rows(*batch, r, n_batch);
+        if (r < n_rows) insert_rows(*prepare(insert_sql(n_rows - r)), r, n_rows - r);
+        stamp_generation(current_table);
+        transaction.commit();
+    }
+    catch (...) {
+        restore_pragmas();
+        throw;
+    }
+
+    restore_pragmas();
     return 0;
 }
 
@@ -131,9 +379,65 @@ int Nibble::sort_and_index (const std::string &focus) {
     (*conn).exec("DROP TABLE " + current_table);
     (*conn).exec("ALTER TABLE " + current_table + "_SORTED RENAME TO " + current_table);
 
-    // Create the index name 'TABLE_IDX'.
+    // Create the index name 'TABLE_IDX'. Our rows are in a new order, so this is a new generation of our table.
+    index_table(focus);
+    stamp_generation(current_table);
+    transaction.commit();
+
+    return 0;
+}
+
+/// Create the index 'TABLE_IDX' on the given focus of the current table. Use this instead of sort_and_index when the
+/// rows of the table have already been inserted in sorted order.
+int Nibble::index_table (const std::string &focus) {
     (*conn).exec("CREATE INDEX " + current_table + "_IDX ON " + current_table + "(" + focus + ")");
+    return 0;
+}
+
+/// Build an R*Tree over the given features of the current table, named 'TABLE_RTREE'. Each row is a point box in
+/// feature space, so a box search visits only the rows near it in every dimension (a B-tree can only narrow on its
+/// first column). The R*Tree stores 32-bit bounds, so the exact labels and features of each row are kept alongside in
+/// 'TABLE_RTREE_ROWS', keyed by the same id. Ids follow the stored order of the current table.
+///
+/// @param labels Label fields of the current table to keep with each row.
+/// @param features Feature fields (at most five) to index.
+/// @return TABLE_NOT_CREATED_RET if the R*Tree already exists. Otherwise, 0.
+int Nibble::index_rtree (const std::string &labels, const std::string &features) {
+    const std::vector<std::string> foci = split_fields(features);
+    if (foci.empty() || foci.size() > 5) throw std::runtime_error(std::string("R*Tree must have 1 to 5 features."));
+    if (does_table_exist(current_table + RTREE_SUFFIX)) return TABLE_NOT_CREATED_RET;
+
+    std::string schema, bounds;
+    for (const std::string &field : split_fields(labels)) schema.append(field).append(" INT, ");
+    for (unsigned int i = 0; i < foci.size(); i++) {
+        schema.append(foci[i]).append(" FLOAT").append((i < foci.size() - 1) ? ", " : "");
+        bounds.append(foci[i] + "_min, " + foci[i] + "_max").append((i < foci.size() - 1) ? ", " : "");
+    }
+    const std::string rtree = current_table + RTREE_SUFFIX, rows = current_table + RTREE_ROWS_SUFFIX;
+
+    SQLite::Transaction transaction(*conn);
+    (*conn).exec("CREATE TABLE " + rows + " (id INTEGER PRIMARY KEY, " + schema + ")");
+    (*conn).exec("INSERT INTO " + rows + " (" + labels + ", " + features + ") SELECT " + labels + ", " + features +
+                 " FROM " + current_table);
+
+    std::string points;
+    for (unsigned int i = 0; i < foci.size(); i++) {
+        points.append(foci[i] + ", " + foci[i]).append((i < foci.size() - 1) ? ", " : "");
+    }
+    (*conn).exec("CREATE VIRTUAL TABLE " + rtree + " USING rtree (id, " + bounds + ")");
+    (*conn).exec("INSERT INTO " + rtree + " SELECT id, " + points + " FROM " + rows);
     transaction.commit();
 
     return 0;
 }
+
+/// @return Each field of the given comma-separated list, without surrounding spaces.
+std::vector<std::string> Nibble::split_fields (const std::string &fields) {
+    std::vector<std::string> names;
+    std::stringstream s(fields);
+    for (std::string name; std::getline(s, name, ',');) {
+        name.erase(0, name.find_first_not_of(' ')), name.erase(name.find_last_not_of(' ') + 1);
+        if (!name.empty()) names.push_back(name);
+    }
+    return names;
+}
@@ -0,0 +1,140 @@
+/// @file pantry.cpp
+/// @author Glenn Galvizo
+///
+/// Source file for Pantry class, which publishes and attaches to a named, read-only POSIX shared memory segment.
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "storage/pantry.h"
+
+const char Pantry::MAGIC[8] = {'H', 'O', 'K', 'U', 'P', 'N', 'T', 'R'};
+const uint32_t Pantry::VERSION = 1;
+const uint32_t Pantry::ALIGNMENT = 64;
+const unsigned int Pantry::WAIT_LIMIT_MS = 120000;
+const int Pantry::SEGMENT_EXISTS = -1;
+
+/// Byte order marker. A segment written by a process with a different endianness will not match this when read.
+static const uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+uint64_t Pantry::align (const uint64_t offset) { return (offset + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT; }
+
+/// Create the segment with the given name (i.e. "/hoku-catalog") and copy each shelf into it. The segment is created
+/// exclusively: if another process has already created it, nothing is written.
+///
+/// @return SEGMENT_EXISTS if a segment with this name already exists. Otherwise, 0.
+int Pantry::publish (const std::string &name, const std::vector<Shelf> &shelves) {
+    Header h = {};
+    std::copy(MAGIC, MAGIC + sizeof(MAGIC), h.magic);
+    h.version = VERSION, h.byte_order = BYTE_ORDER_MARK, h.ready = 0;
+    h.n_shelves = static_cast<uint32_t>(shelves.size());
+
+    std::vector<Entry> entries(shelves.size());
+    uint64_t offset = align(sizeof(Header) + sizeof(Entry) * shelves.size());
+    for (unsigned int i = 0; i < shelves.size(); i++) {
+        if (shelves[i].name.size() >= sizeof(entries[i].name)) {
+            throw std::runtime_error(std::string("Shelf name " + shelves[i].name + " is too long."));
+        }
+        std::copy(shelves[i].name.begin(), shelves[i].name.end(), entries[i].name);
+        entries[i].offset = offset, entries[i].size = shelves[i].size;
+        offset = align(offset + shelves[i].size);
+    }
+    h.size = offset;
+
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644); // NOLINT(hicpp-signed-bitwise)
+    if (fd < 0 && errno == EEXIST) return SEGMENT_EXISTS;
+    if (fd < 0) throw std::runtime_error(std::string("Pantry " + name + " cannot be created."));
+
+    void *segment = MAP_FAILED;
+    if (ftruncate(fd, static_cast<off_t>(h.size)) == 0) {
+        segment = mmap(nullptr, h.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0); // NOLINT(hicpp-signed-bitwise)
+    }
+    ::close(fd);
+    if (segment == MAP_FAILED) {
+        shm_unlink(name.c_str());
+        throw std::runtime_error(std::string("Pantry " + name + " cannot be mapped."));
+    }
+
+    auto *base = static_cast<char *>(segment);
+    std::memcpy(base + sizeof(Header), entries.data(), sizeof(Entry) * entries.size());
+    for (unsigned int i = 0; i < shelves.size(); i++) {
+        if (shelves[i].size > 0) std::memcpy(base + entries[i].offset, shelves[i].data, shelves[i].size);
+    }
+    std::memcpy(base, &h, sizeof(Header));
+
+    // Only now may other processes read the segment.
+    __atomic_store_n(&reinterpret_cast<Header *>(base)->ready, 1u, __ATOMIC_RELEASE);
+    munmap(segment, h.size);
+    return 0;
+}
+
+/// Remove the segment with the given name. Processes that are attached to it keep their mapping until they detach.
+///
+/// @return 0 if the segment was removed. -1 otherwise.
+int Pantry::remove (const std::string &name) { return shm_unlink(name.c_str()) == 0 ? 0 : -1; }
+
+/// Attach (read-only) to the segment with the given name. If the segment is still being published, wait for it to
+/// become ready (up to WAIT_LIMIT_MS).
+///
+/// @return Nullptr if no segment with this name exists. Otherwise, the attached segment.
+std::shared_ptr<Pantry> Pantry::open (const std::string &name) {
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0 && errno == ENOENT) return nullptr;
+    if (fd < 0) throw std::runtime_error(std::string("Pantry " + name + " cannot be opened."));
+
+    return std::shared_ptr<Pantry>(new Pantry(name, fd));
+}
+
+Pantry::Pantry (const std::string &name, const int fd) : name(name) {
+    // Wait for the publisher to size the segment and mark it as ready.
+    Header h = {};
+    auto start = std::chrono::steady_clock::now();
+    while (true) {
+        struct stat s = {};
+        if (fstat(fd, &s) == 0 && static_cast<size_t>(s.st_size) >= sizeof(Header)) {
+            this->map_size = static_cast<size_t>(s.st_size);
+            this->map = mmap(nullptr, map_size, PROT_READ, MAP_SHARED, fd, 0);
+            if (map == MAP_FAILED) {
+                ::close(fd);
+                throw std::runtime_error(std::string("Pantry " + name + " cannot be mapped."));
+            }
+            if (__atomic_load_n(&static_cast<const Header *>(map)->ready, __ATOMIC_ACQUIRE) == 1) break;
+            munmap(map, map_size);
+        }
+
+        if (std::chrono::steady_clock::now() - start > std::chrono::milliseconds(WAIT_LIMIT_MS)) {
+            ::close(fd);
+            throw std::runtime_error(std::string("Pantry " + name + " was never published."));
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    ::close(fd);
+
+    // Validate the header and directory before trusting any of the offsets inside them.
+    const auto *base = static_cast<const char *>(map);
+    std::memcpy(&h, base, sizeof(Header));
+    if (!std::equal(MAGIC, MAGIC + sizeof(MAGIC), h.magic) || h.version != VERSION ||
+        h.byte_order != BYTE_ORDER_MARK || h.size > map_size ||
+        sizeof(Header) + sizeof(Entry) * static_cast<uint64_t>(h.n_shelves) > h.size) {
+        munmap(map, map_size);
+        throw std::runtime_error(std::string("Pantry " + name + " is not a version " + std::to_string(VERSION) +
+                                             " pantry."));
+    }
+    for (unsigned int i = 0; i < h.n_shelves; i++) {
+        Entry e = {};
+        std::memcpy(&e, base + sizeof(Header) + i * sizeof(Entry), sizeof(Entry));
+        if (e.offset + e.size > h.size) {
+            munmap(map, map_size);
+            throw std::runtime_error(std::string("Pantry " + name + " has a truncated shelf."));
+        }
+        this->directory[std::string(e.name, strnlen(e.name, sizeof(e.name)))] = {e.offset, e.size};
+    }
+}
+Pantry::~Pantry () { munmap(map, map_size); }
@@ -0,0 +1,154 @@
+/// @file sky-grid.cpp
+/// @author Glenn Galvizo
+///
+/// Source file for SkyGrid class, which holds an in-memory spatial index over a list of stars using a cube-face grid.
+
+#define _USE_MATH_DEFINES
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+#include "storage/sky-grid.h"
+
+/// Default number of cells along each edge of a face. Cells are ~5.6 degrees wide.
+const unsigned int SkyGrid::DEFAULT_N = 16;
+
+/// Constructor. Sort each star into the cell it falls in. The indices returned by our searches refer to the positions
+/// in 'stars', which must outlive any use of these indices (the list itself is not held).
+SkyGrid::SkyGrid (const Star::list &stars, const unsigned int n) :
+        SkyGrid(stars.data(), static_cast<unsigned int>(stars.size()), n) {
+}
+
+/// Constructor. Builds the grid over the n_stars stars that start at 'stars'. Only the positions of these stars are
+/// copied, so cone searches return indices into this array.
+SkyGrid::SkyGrid (const Star *stars, const unsigned int n_stars, const unsigned int n) {
+    this->n = std::max(1u, n);
+
+    // Bucket our stars by cell. Stars in the same cell keep their order in the catalog.
+    std::vector<unsigned int> cell(n_stars);
+    this->cell_start.assign(get_n_cells() + 1, 0);
+    for (unsigned int i = 0; i < n_stars; i++) {
+        cell[i] = cell_for(stars[i]);
+        this->cell_start[cell[i] + 1]++;
+    }
+    for (unsigned int c = 0; c < get_n_cells(); c++) this->cell_start[c + 1] += this->cell_start[c];
+
+    std::vector<unsigned int> next(cell_start.begin(), cell_start.end() - 1);
+    this->member.resize(n_stars), this->points.resize(3 * n_stars);
+    for (unsigned int i = 0; i < n_stars; i++) {
+        unsigned int r = next[cell[i]]++;
+        Vector3 s = Vector3::Normalized(stars[i]);
+        this->member[r] = i;
+        this->points[3 * r] = s.X, this->points[3 * r + 1] = s.Y, this->points[3 * r + 2] = s.Z;
+    }
+
+    // Record the center of each cell, and the largest distance from any center to the corners of its cell. Cell edges
+    // are great circles, so no point of a cell is further from its center than its corners.
+    this->cell_center.resize(get_n_cells()), this->cell_radius = 0;
+    for (unsigned int c = 0; c < get_n_cells(); c++) {
+        unsigned int face = c / (this->n * this->n), a = (c / this->n) % this->n, b = c % this->n;
+        auto edge = [this] (const double t) -> double { return 2.0 * t / this->n - 1.0; };
+
+        this->cell_center[c] = face_point(face, edge(a + 0.5), edge(b + 0.5));
+        for (const double u : {edge(a), edge(a + 1)}) {
+            for (const double v : {edge(b), edge(b + 1)}) {
+                this->cell_radius = std::max(this->cell_radius, Vector3::Angle(cell_center[c], face_point(face, u, v)));
+            }
+        }
+    }
+}
+
+/// Determine the unit vector at the equiangular coordinates (u, v), both in [-1, 1], of the given face. Faces 0 and 1
+/// lie on the +x and -x axes, 2 and 3 on the +y and -y axes, and 4 and 5 on the +z and -z axes.
+///
+/// @return Unit vector at (u, v) on the given face.
+Vector3 SkyGrid::face_point (const unsigned int face, const double u, const double v) {
+    double p[3], sign = (face % 2 == 0) ? 1.0 : -1.0;
+    unsigned int axis = face / 2;
+
+    p[axis] = sign, p[(axis + 1) % 3] = std::tan(u * M_PI / 4.0), p[(axis + 2) % 3] = std::tan(v * M_PI / 4.0);
+    return Vector3::Normalized(Vector3(p[0], p[1], p[2]));
+}
+
+/// @return Index of the cell that the given vector falls in.
+unsigned int SkyGrid::cell_for (const Vector3 &s) const {
+    double p[3] = {s.X, s.Y, s.Z};
+    unsigned int axis = (std::fabs(p[0]) >= std::fabs(p[1]) && std::fabs(p[0]) >= std::fabs(p[2])) ? 0 :
+                        ((std::fabs(p[1]) >= std::fabs(p[2])) ? 1 : 2);
+    unsigned int face = 2 * axis + ((p[axis] < 0) ? 1 : 0);
+
+    // Project onto our face, then map the tangent plane coordinates to their equiangular cell.
+    auto cell_index = [this, &p, &axis] (const unsigned int offset) -> unsigned int {
+        double t = std::atan(p[(axis + offset) % 3] / std::fabs(p[axis])) * 4.0 / M_PI;
+        return std::min(this->n - 1, static_cast<unsigned int>(std::max(0.0, (t + 1.0) / 2.0 * this->n)));
+    };
+
+    return face * this->n * this->n + cell_index(1) * this->n + cell_index(2);
+}
+
+/// Determine the range of cell indices along one edge of a face that a cone may reach. The equiangular coordinate
+/// along this edge is the angle alpha of a star about the face's other edge axis, and all stars of constant alpha lie
+/// on a great circle. Our cone crosses this circle iff its focus is within theta_r + 90 degrees of the circle's normal.
+/// For a focus at angle psi (and distance rho from the other edge axis), this bounds alpha to psi +/- asin(sin(theta_r)
+/// / rho). Cones that are too wide, or whose focus is not above this face, are given the entire edge.
+///
+/// @param f Unit vector of the cone's focus.
+/// @param theta_r Half angle of the cone, in radians.
+/// @param face Face to find the cells of.
+/// @param offset 1 for the u coordinate of the face, and 2 for the v coordinate.
+/// @return First and last (inclusive) cell index along this edge that may overlap our cone.
+std::pair<unsigned int, unsigned int> SkyGrid::cell_range (const Vector3 &f, const double theta_r,
+                                                           const unsigned int face, const unsigned int offset) const {
+    double p[3] = {f.X, f.Y, f.Z};
+    unsigned int axis = face / 2;
+    double f_0 = ((face % 2 == 0) ? 1.0 : -1.0) * p[axis], f_1 = p[(axis + offset) % 3];
+    double rho = std::sqrt(f_0 * f_0 + f_1 * f_1);
+    if (theta_r >= M_PI / 2.0 || f_0 <= 0 || rho <= std::sin(theta_r)) return {0, n - 1};
+
+    // Pad our bounds so that stars on the border of a cell are never missed.
+    double psi = std::atan2(f_1, f_0), delta = std::asin(std::sin(theta_r) / rho) + 1.0e-9;
+    auto cell_index = [this] (const double alpha) -> unsigned int {
+        double t = std::max(-1.0, std::min(1.0, alpha * 4.0 / M_PI));
+        return std::min(this->n - 1, static_cast<unsigned int>((t + 1.0) / 2.0 * this->n));
+    };
+
+    return {cell_index(psi - delta), cell_index(psi + delta)};
+}
+
+/// Find all stars within theta degrees of the focus (exclusive, to match Star::within_angle). Only the cells whose
+/// bounding cap intersects our cone are visited, and each candidate is checked with a dot product against the cosine
+/// of theta rather than computing its angle.
+///
+/// @return Indices (into the star list this grid was built with) of all stars near the focus, in ascending order.
+std::vector<unsigned int> SkyGrid::cone_query (const Vector3 &focus, const double theta) const {
+    std::vector<unsigned int> nearby;
+    if (member.empty() || theta <= 0) return nearby;
+
+    Vector3 f = Vector3::Normalized(focus);
+    double theta_r = theta * M_PI / 180.0, cos_theta = std::cos(theta_r);
+    double cos_cell = std::cos(std::min(M_PI, theta_r + cell_radius));
+    double cos_face = std::cos(std::min(M_PI, theta_r + std::acos(1.0 / std::sqrt(3.0)) + 1.0e-9));
+
+    for (unsigned int face = 0; face < 6; face++) {
+        double face_dot = ((face % 2 == 0) ? 1.0 : -1.0) * ((face / 2 == 0) ? f.X : ((face / 2 == 1) ? f.Y : f.Z));
+        if (face_dot < cos_face) continue;
+
+        std::pair<unsigned int, unsigned int> a = cell_range(f, theta_r, face, 1), b = cell_range(f, theta_r, face, 2);
+        for (unsigned int i = a.first; i <= a.second; i++) {
+            for (unsigned int c = face * n * n + i * n + b.first; c <= face * n * n + i * n + b.second; c++) {
+                if (cell_start[c] == cell_start[c + 1] || Vector3::Dot(f, cell_center[c]) < cos_cell) continue;
+
+                for (unsigned int r = cell_start[c]; r < cell_start[c + 1]; r++) {
+                    if (f.X * points[3 * r] + f.Y * points[3 * r + 1] + f.Z * points[3 * r + 2] > cos_theta) {
+                        nearby.push_back(member[r]);
+                    }
+                }
+            }
+        }
+    }
+
+    // Return our stars in the same order as our catalog, as a linear search would.
+    std::sort(nearby.begin(), nearby.end());
+    return nearby;
+}
@@ -0,0 +1,124 @@
+/// @file trace.cpp
+/// @author Glenn Galvizo
+///
+/// Source file for Trace namespace, which records the progress messages of the identification methods and experiments
+/// into an in-memory ring buffer.
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <mutex>
+
+#include "trace/trace.h"
+
+const unsigned int Trace::Line::TEXT_SIZE;
+const unsigned int Trace::CAPACITY = 1 << 14;
+
+namespace {
+    /// A slot of our ring buffer. sequence is (ticket + 1) once the record of that ticket is complete, and 0 while a
+    /// record is being written. A reader only trusts a slot whose sequence is unchanged across its copy.
+    struct Slot {
+        std::atomic<uint64_t> sequence{0};
+        Trace::Level level;
+        Trace::Category category;
+        Trace::Line line;
+    };
+
+    Slot ring[Trace::CAPACITY]; // NOLINT(cert-err58-cpp)
+    std::atomic<uint64_t> next_ticket{0};
+
+    // Only flush reads from our buffer, one caller at a time.
+    std::mutex flush_mutex;
+    uint64_t next_flushed = 0, n_dropped = 0;
+}
+
+Trace::Line &Trace::Line::operator<< (const char *s) {
+    while (*s != '\0' && length < TEXT_SIZE - 1) buffer[length++] = *s++;
+    buffer[length] = '\0';
+    return *this;
+}
+
+/// Format n with the given printf format at the end of our text.
+#define HOKU_TRACE_APPEND(format, n) do { \
+    int n_written = std::snprintf(buffer + length, TEXT_SIZE - length, format, n); \
+    if (n_written > 0) length = std::min(TEXT_SIZE - 1, length + static_cast<unsigned int>(n_written)); \
+} while (false)
+
+Trace::Line &Trace::Line::operator<< (const int n) {
+    HOKU_TRACE_APPEND("%d", n);
+    return *this;
+}
+Trace::Line &Trace::Line::operator<< (const unsigned int n) {
+    HOKU_TRACE_APPEND("%u", n);
+    return *this;
+}
+Trace::Line &Trace::Line::operator<< (const long n) {
+    HOKU_TRACE_APPEND("%ld", n);
+    return *this;
+}
+Trace::Line &Trace::Line::operator<< (const unsigned long n) {
+    HOKU_TRACE_APPEND("%lu", n);
+    return *this;
+}
+Trace::Line &Trace::Line::operator<< (const double n) {
+    HOKU_TRACE_APPEND("%g", n);
+    return *this;
+}
+
+/// @return Name of the given category, as it prefixes each flushed record.
+const char *Trace::category_name (const Category category) {
+    static const char *names[] = {"EXPERIMENT", "ANGLE", "DOT", "TRIANGLE", "SPHERE", "PLANE", "PYRAMID", "COMPOSITE"};
+    return names[category];
+}
+
+/// Copy the given record into the next slot of our ring buffer. This never blocks, and never touches a stream.
+void Trace::record (const Level level, const Category category, const Line &line) {
+    const uint64_t ticket = next_ticket.fetch_add(1, std::memory_order_relaxed);
+    Slot &slot = ring[ticket % CAPACITY];
+
+    slot.sequence.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.level = level, slot.category = category, slot.line = line;
+    slot.sequence.store(ticket + 1, std::memory_order_release);
+}
+
+/// Write every record made since our last flush to the given stream, one line per record ("[ANGLE] Match found!"),
+/// oldest first. Records that were overwritten before they could be written are counted as dropped. We stop early at
+/// a record that is still being written, and resume from it on our next flush.
+///
+/// @return Number of records written.
+uint64_t Trace::flush (std::ostream &os) {
+    std::lock_guard<std::mutex> guard(flush_mutex);
+    const uint64_t last_ticket = next_ticket.load(std::memory_order_acquire);
+    if (last_ticket - next_flushed > CAPACITY) {
+        n_dropped += last_ticket - CAPACITY - next_flushed;
+        next_flushed = last_ticket - CAPACITY;
+    }
+
+    uint64_t n_written = 0;
+    for (; next_flushed < last_ticket; next_flushed++) {
+        const Slot &slot = ring[next_flushed % CAPACITY];
+        const uint64_t before = slot.sequence.load(std::memory_order_acquire);
+        if (before == 0 || before < next_flushed + 1) break; // This record is still being written.
+
+        Category category = slot.category;
+        Line line = slot.line;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (before != next_flushed + 1 || slot.sequence.load(std::memory_order_relaxed) != before) {
+            n_dropped++; // This record was overwritten by a newer one.
+            continue;
+        }
+
+        os << "[" << category_name(category) << "] " << line.text() << "\n";
+        n_written++;
+    }
+
+    os.flush();
+    return n_written;
+}
+
+/// @return Number of records that were overwritten before they could be flushed.
+uint64_t Trace::count_dropped () {
+    std::lock_guard<std::mutex> guard(flush_mutex);
+    return n_dropped;
+}
@@ -6,6 +6,7 @@
 
 #include <iostream>
 #include <algorithm>
+#include <sstream>
 #include <libgen.h>
 
 #include "identification/angle.h"
@@ -24,21 +25,23 @@ enum GenerateNArguments {
     MAGNITUDE_LIMIT = 6,
     FOV_LIMIT = 7,
     TABLE_TYPE = 8,
-    TABLE_NAME = 9
+    TABLE_NAME = 9,
+    QUERY_INDEX = 10
 };
 
-using TableGenerator = int (*) (const std::shared_ptr<Chomp> &, double, const std::string &);
+/// Generators for each table family. PYRAMID and COMPOSITE use the same tables as ANGLE and PLANE respectively, so
+/// they share their family's generator.
+using TableGenerator = int (*) (const std::shared_ptr<Chomp> &, const Identification::Neighborhood &,
+                                const std::vector<std::string> &);
 TableGenerator table_generator_factory (const std::string &choice) {
     std::map<std::string, TableGenerator> table_function_map;
-    table_function_map["HIP"] = [] (const std::shared_ptr<Chomp> &, double, const std::string &) -> int {
-        return 0;
-    };
-    table_function_map["ANGLE"] = Angle::generate_table;
-    table_function_map["DOT"] = Dot::generate_table;
-    table_function_map["SPHERE"] = Sphere::generate_table;
-    table_function_map["PLANE"] = Plane::generate_table;
-    table_function_map["PYRAMID"] = Pyramid::generate_table;
-    table_function_map["COMPOSITE"] = Composite::generate_table;
+    table_function_map["HIP"] = nullptr;
+    table_function_map["ANGLE"] = Angle::generate_tables;
+    table_function_map["DOT"] = Dot::generate_tables;
+    table_function_map["SPHERE"] = Sphere::generate_tables;
+    table_function_map["PLANE"] = Plane::generate_tables;
+    table_function_map["PYRAMID"] = Angle::generate_tables;
+    table_function_map["COMPOSITE"] = Plane::generate_tables;
 
     std::string upper_choice = choice;  // Convert our choice to upper case.
     std::transform(choice.begin(), choice.end(), upper_choice.begin(), ::toupper);
@@ -49,19 +52,72 @@ TableGenerator table_generator_factory (const std::string &choice) {
     return table_function_map[upper_choice];
 }
 
-int main (int, char *argv[]) {
-    table_generator_factory(argv[GenerateNArguments::TABLE_TYPE])(
-            std::make_shared<Chomp>(
-                    Chomp::Builder()
-                            .with_database_name(argv[GenerateNArguments::DATABASE_LOCATION])
-                            .using_catalog(argv[GenerateNArguments::CATALOG_LOCATION])
-                            .with_hip_name(argv[GenerateNArguments::HIP_NAME])
-                            .with_bright_name(argv[GenerateNArguments::BRIGHT_NAME])
-                            .using_current_time(argv[GenerateNArguments::CURRENT_TIME])
-                            .limited_by_magnitude(std::stod(argv[GenerateNArguments::MAGNITUDE_LIMIT]))
-                            .build()
-            ),
-            std::stod(argv[GenerateNArguments::FOV_LIMIT]),
-            argv[GenerateNArguments::TABLE_NAME]
+/// @return Each comma-separated entry of the given list.
+std::vector<std::string> split_list (const std::string &list) {
+    std::vector<std::string> entries;
+    std::stringstream s(list);
+    for (std::string entry; std::getline(s, entry, ',');) entries.push_back(entry);
+    return entries;
+}
+
+/// @return Features of the given table type to index with an R*Tree. Empty if this is not a multi-feature table.
+std::string rtree_features (const std::string &choice) {
+    std::string upper_choice = choice;
+    std::transform(choice.begin(), choice.end(), upper_choice.begin(), ::toupper);
+
+    if (upper_choice == "DOT") return "theta_1, theta_2, phi";
+    return (upper_choice == "SPHERE" || upper_choice == "PLANE" || upper_choice == "COMPOSITE") ? "a, i" : "";
+}
+
+/// Generate every requested table in one run. TABLE_TYPE and TABLE_NAME may be comma-separated lists of equal length,
+/// e.g. "ANGLE,DOT,PLANE" and "ANGLE,DOT,PLANE". The catalog is loaded once, and the FOV-feasible pairs and trios are
+/// enumerated once for all of these tables. If QUERY_INDEX is given as RTREE, an R*Tree is built over the features of
+/// each multi-feature table as well.
+int main (int argc, char *argv[]) {
+    std::vector<std::string> types = split_list(argv[GenerateNArguments::TABLE_TYPE]);
+    std::vector<std::string> names = split_list(argv[GenerateNArguments::TABLE_NAME]);
+    if (types.size() != names.size()) throw std::runtime_error("'table_type' and 'table_name' must be the same size.");
+
+    // Group our table names by family. Each family is generated once, and written to all of its tables.
+    std::map<TableGenerator, std::vector<std::string>> families;
+    bool with_trios = false;
+    for (unsigned int i = 0; i < types.size(); i++) {
+        TableGenerator generator = table_generator_factory(types[i]);
+        if (generator == nullptr) continue;
+
+        families[generator].push_back(names[i]);
+        with_trios = with_trios || generator != Angle::generate_tables;
+    }
+
+    std::shared_ptr<Chomp> ch = std::make_shared<Chomp>(
+            Chomp::Builder()
+                    .with_database_name(argv[GenerateNArguments::DATABASE_LOCATION])
+                    .using_catalog(argv[GenerateNArguments::CATALOG_LOCATION])
+                    .with_hip_name(argv[GenerateNArguments::HIP_NAME])
+                    .with_bright_name(argv[GenerateNArguments::BRIGHT_NAME])
+                    .using_current_time(argv[GenerateNArguments::CURRENT_TIME])
+                    .limited_by_magnitude(std::stod(argv[GenerateNArguments::MAGNITUDE_LIMIT]))
+                    .build()
     );
+    if (!families.empty()) {
+        Identification::Neighborhood nb = Identification::find_neighborhood(
+                ch, std::stod(argv[GenerateNArguments::FOV_LIMIT]), with_trios);
+        for (const auto &family : families) family.first(ch, nb, family.second);
+    }
+
+    std::string upper_index = (argc > GenerateNArguments::QUERY_INDEX) ? argv[GenerateNArguments::QUERY_INDEX] : "";
+    std::transform(upper_index.begin(), upper_index.end(), upper_index.begin(), ::toupper);
+    for (unsigned int i = 0; i < types.size() && upper_index == "RTREE"; i++) {
+        if (rtree_features(types[i]).empty()) continue;
+        ch->select_table(names[i]);
+        ch->index_rtree("label_a, label_b, label_c", rtree_features(types[i]));
+    }
+
+    // Write the binary image of each table we have touched. Chomp maps these at startup instead of using SQLite.
+    std::vector<std::string> tables = {argv[GenerateNArguments::HIP_NAME], argv[GenerateNArguments::BRIGHT_NAME]};
+    for (const auto &family : families) tables.insert(tables.end(), family.second.begin(), family.second.end());
+
+    for (const std::string &table : tables) {
+        Crumb::write(*ch, table, Crumb::path_for(argv[GenerateNArguments::DATABASE_LOCATION], table));
+    }
 }
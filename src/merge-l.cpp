@@ -0,0 +1,27 @@
+/// @file merge-l.cpp
+/// @author Glenn Galvizo
+///
+/// Source file for the Lumberjack record merger. Given the record files written by each PerformE worker, bulk-load all
+/// of their trials into the Lumberjack database. This is **not** meant to be used as is, rather is meant to be the
+/// entry point for the python script calling this.
+
+#include <iostream>
+
+#include "experiment/lumberjack.h"
+
+enum MergeLArguments {
+    RECORD_DB = 1,
+    RECORD_FILES = 2
+};
+
+int main (int argc, char *argv[]) {
+    if (argc <= MergeLArguments::RECORD_FILES) {
+        std::cout << "Usage: MergeL [record database] [record file 1] [record file 2] ..." << std::endl;
+        return -1;
+    }
+
+    std::vector<std::string> record_paths(argv + MergeLArguments::RECORD_FILES, argv + argc);
+    int n_merged = Lumberjack::merge_records(argv[MergeLArguments::RECORD_DB], record_paths);
+    std::cout << "[MERGE] " << n_merged << " trials merged from " << record_paths.size() << " files." << std::endl;
+    return 0;
+}
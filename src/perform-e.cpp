@@ -46,7 +46,14 @@ enum PerformEArguments {
     EXTRA_STAR_STEP = 24,
     REMOVE_STAR_ITER = 25,
     REMOVE_STAR_STEP = 26,
-    REMOVE_STAR_SIGMA = 27
+    REMOVE_STAR_SIGMA = 27,
+    QUERY_INDEX = 28,
+    IN_MEMORY = 29,
+    SHARED_CATALOG = 30,
+    N_THREADS = 31,
+    CPU_AFFINITY = 32,
+    RECORD_FILE = 33,
+    SEARCH_THREADS = 34
 };
 
 using ExperimentFunction = void (*) (
@@ -83,14 +90,61 @@ ExperimentFunction experiment_factory (const std::string &experiment_name, const
     else throw std::runtime_error("'strategy' must be in space [ANGLE, DOT, PLANE, SPHERE, PYRAMID, COMPOSITE].");
 }
 
-void connect_to_lumberjack (char *argv[], std::ostringstream &l) {
+/// Build our catalog. If requested, load the in-memory index or R*Tree that matches the strategy's reference table,
+/// copy the entire reference database into RAM before any trial is run, and share our catalog with the other workers.
+std::shared_ptr<Chomp> connect_to_chomp (int argc, char *argv[]) {
+    Chomp::Builder builder = Chomp::Builder()
+            .with_database_name(argv[PerformEArguments::REFERENCE_DB])
+            .with_hip_name(argv[PerformEArguments::HIP_TABLE])
+            .with_bright_name(argv[PerformEArguments::BRIGHT_TABLE]);
+    if (argc > PerformEArguments::IN_MEMORY && std::stoi(argv[PerformEArguments::IN_MEMORY]) != 0) {
+        builder.in_memory();
+    }
+    if (argc > PerformEArguments::SHARED_CATALOG && std::string(argv[PerformEArguments::SHARED_CATALOG]) != "0") {
+        builder.using_shared_catalog(argv[PerformEArguments::SHARED_CATALOG]);
+    }
+
+    std::string upper_index = (argc > PerformEArguments::QUERY_INDEX) ? argv[PerformEArguments::QUERY_INDEX] : "SQLITE";
+    std::string upper_strategy = argv[PerformEArguments::IDENTIFICATION_STRATEGY];
+    std::transform(upper_index.begin(), upper_index.end(), upper_index.begin(), ::toupper);
+    std::transform(upper_strategy.begin(), upper_strategy.end(), upper_strategy.begin(), ::toupper);
+    if (upper_index != "SQLITE" && upper_index != "MEMORY" && upper_index != "RTREE")
+        throw std::runtime_error("'index' must be in space [SQLITE, MEMORY, RTREE].");
+
+    // The pair tables have a k-vector, the triangle tables have a bucket index and the dot table has a feature grid.
+    // Only the multi-feature tables have an R*Tree.
+    bool is_pair_table = upper_strategy == "ANGLE" || upper_strategy == "PYRAMID";
+    bool is_triangle_table = upper_strategy == "SPHERE" || upper_strategy == "PLANE" || upper_strategy == "COMPOSITE";
+    if (upper_index == "MEMORY" && is_pair_table) {
+        builder.using_k_vector(argv[PerformEArguments::REFERENCE_TABLE]);
+    }
+    if (upper_index == "MEMORY" && is_triangle_table) {
+        builder.using_bucket_index(argv[PerformEArguments::REFERENCE_TABLE]);
+    }
+    if (upper_index == "MEMORY" && upper_strategy == "DOT") {
+        builder.using_feature_grid(argv[PerformEArguments::REFERENCE_TABLE]);
+    }
+    if (upper_index == "RTREE" && !is_pair_table) {
+        builder.using_rtree(argv[PerformEArguments::REFERENCE_TABLE]);
+    }
+
+    return std::make_shared<Chomp>(builder.build());
+}
+
+/// Build our Lumberjack, and populate its table if it does not already exist. If a record file is given, trials are
+/// appended to this file instead of the database (to be merged with MergeL afterwards).
+std::shared_ptr<Lumberjack> connect_to_lumberjack (int argc, char *argv[], std::ostringstream &l) {
+    Lumberjack::Builder builder = Lumberjack::Builder()
+            .with_database_name(argv[PerformEArguments::RECORD_DB])
+            .using_timestamp(l.str())
+            .using_trial_table(argv[PerformEArguments::EXPERIMENT_TABLE])
+            .with_prefix(argv[PerformEArguments::IDENTIFICATION_PREFIX]);
+    if (argc > PerformEArguments::RECORD_FILE && std::string(argv[PerformEArguments::RECORD_FILE]) != "0") {
+        builder.appending_to_file(argv[PerformEArguments::RECORD_FILE]);
+    }
+
     try {
-        Lumberjack::Builder()
-                .with_database_name(argv[PerformEArguments::RECORD_DB])
-                .using_timestamp(l.str())
-                .using_trial_table(argv[PerformEArguments::EXPERIMENT_TABLE])
-                .with_prefix(argv[PerformEArguments::IDENTIFICATION_PREFIX])
-                .build();
+        return std::make_shared<Lumberjack>(builder.build());
     }
     catch (const std::exception &e) {
         Lumberjack::create_table(
@@ -98,32 +152,28 @@ void connect_to_lumberjack (char *argv[], std::ostringstream &l) {
                 argv[PerformEArguments::EXPERIMENT_TABLE],
                 argv[PerformEArguments::EXPERIMENT_SCHEMA]
         );
+        return std::make_shared<Lumberjack>(builder.build());
     }
 }
 
-int main (int, char *argv[]) {
-    std::ios::sync_with_stdio(false); // Determine the timestamp.
-    std::ostringstream l;
+int main (int argc, char *argv[]) {
+    // Trials (and the hypotheses of each) may run on several threads. Our streams must then stay synchronized with
+    // stdio, which is thread-safe.
+    unsigned int n_threads = 1, n_search_threads = 1;
+    if (argc > PerformEArguments::N_THREADS) n_threads = std::stoi(argv[PerformEArguments::N_THREADS]);
+    if (argc > PerformEArguments::SEARCH_THREADS) n_search_threads = std::stoi(argv[PerformEArguments::SEARCH_THREADS]);
+    bool is_pinned = argc > PerformEArguments::CPU_AFFINITY && std::stoi(argv[PerformEArguments::CPU_AFFINITY]) != 0;
+    if (n_threads <= 1 && n_search_threads <= 1) std::ios::sync_with_stdio(false);
+
+    std::ostringstream l; // Determine the timestamp.
     l << std::chrono::system_clock::to_time_t(std::chrono::system_clock::now() - std::chrono::hours(24));
-    connect_to_lumberjack(argv, l);  // Populate lumberjack table if it does not already exist.
+    std::shared_ptr<Lumberjack> lumberjack = connect_to_lumberjack(argc, argv, l);
 
     // Perform the experiment! It looks like I really like the builder pattern.
+    std::shared_ptr<Chomp> ch = connect_to_chomp(argc, argv);
     experiment_factory(argv[PerformEArguments::EXPERIMENT_NAME], argv[PerformEArguments::IDENTIFICATION_STRATEGY])(
-            std::make_shared<Chomp>(
-                    Chomp::Builder()
-                            .with_database_name(argv[PerformEArguments::REFERENCE_DB])
-                            .with_hip_name(argv[PerformEArguments::HIP_TABLE])
-                            .with_bright_name(argv[PerformEArguments::BRIGHT_TABLE])
-                            .build()
-            ),
-            std::make_shared<Lumberjack>(
-                    Lumberjack::Builder()
-                            .with_database_name(argv[PerformEArguments::RECORD_DB])
-                            .using_timestamp(l.str())
-                            .using_trial_table(argv[PerformEArguments::EXPERIMENT_TABLE])
-                            .with_prefix(argv[PerformEArguments::IDENTIFICATION_PREFIX])
-                            .build()
-            ),
+            ch,
+            lumberjack,
             std::make_shared<Experiment::Parameters>(
                     Experiment::ParametersBuilder()
                             .prefixed_by(argv[PerformEArguments::IDENTIFICATION_PREFIX])
@@ -151,7 +201,12 @@ int main (int, char *argv[]) {
                                     std::stoi(argv[PerformEArguments::REMOVE_STAR_STEP]),
                                     std::stoi(argv[PerformEArguments::REMOVE_STAR_SIGMA])
                             )
+                            .running_on_n_threads(n_threads, is_pinned)
+                            .searching_on_n_threads(n_search_threads)
                             .build()
             )
     );
+
+    // Our catalog is loaded (once) by the first trial that needs it. Report this here, whether or not we trace.
+    std::cout << "[EXPERIMENT] Catalog load time: " << ch->get_load_time() << " ms." << std::endl;
 }
\ No newline at end of file
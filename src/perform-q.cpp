@@ -0,0 +1,183 @@
+/// @file perform-q.cpp
+/// @author Glenn Galvizo
+///
+/// Source file for the query benchmark runner. Based on the arguments, time the candidate searches of the given
+/// identification method against its reference table, once through SQLite and once through each available in-memory
+/// index or R*Tree. The query features are taken from randomly generated images, so the bounds mirror what the
+/// identifiers actually ask for.
+
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <libgen.h>
+
+#include "third-party/cxxtimer/cxxtimer.hpp"
+#include "benchmark/benchmark.h"
+#include "math/trio.h"
+
+enum PerformQArguments {
+    REFERENCE_DB = 1,
+    HIP_TABLE = 2,
+    BRIGHT_TABLE = 3,
+    REFERENCE_TABLE = 4,
+    IDENTIFICATION_STRATEGY = 5,
+    EPSILON_1 = 6,
+    EPSILON_2 = 7,
+    EPSILON_3 = 8,
+    SAMPLES = 9,
+    IMAGE_FOV = 10,
+    IN_MEMORY = 11
+};
+
+/// Lower and upper bounds for a single candidate search, in the order of the table's foci.
+struct QueryBounds {
+    std::vector<double> y_a, y_b;
+};
+
+/// A method of answering a candidate search. Returns the number of candidates found.
+struct QueryPath {
+    std::string name;
+    std::function<unsigned int (const QueryBounds &)> search;
+};
+
+/// Generate the bounds for the given strategy's table, using the first stars of random images. Features are computed
+/// as the identifiers compute them.
+std::vector<QueryBounds> generate_bounds (const std::shared_ptr<Chomp> &ch, const std::string &strategy,
+                                          char *argv[]) {
+    std::vector<QueryBounds> bounds;
+    std::array<double, 3> epsilon = {std::stod(argv[PerformQArguments::EPSILON_1]),
+                                     std::stod(argv[PerformQArguments::EPSILON_2]),
+                                     std::stod(argv[PerformQArguments::EPSILON_3])};
+    Benchmark be = Benchmark::Builder()
+            .using_chomp(ch)
+            .limited_by_fov(std::stod(argv[PerformQArguments::IMAGE_FOV]))
+            .build();
+
+    while (bounds.size() < static_cast<unsigned int>(std::stoi(argv[PerformQArguments::SAMPLES]))) {
+        be.generate_stars(ch);
+        if (be.get_image()->size() < 3) continue;
+        const Star &b_0 = be.get_image()->at(0), &b_1 = be.get_image()->at(1), &b_2 = be.get_image()->at(2);
+
+        std::vector<double> y;
+        if (strategy == "ANGLE" || strategy == "PYRAMID") {
+            y = {(180.0 / M_PI) * Vector3::Angle(b_0, b_1)};
+        }
+        else if (strategy == "DOT") {
+            // Ensure that condition 6d holds: switch if not.
+            double theta_1 = (180.0 / M_PI) * Vector3::Angle(b_2, b_0);
+            double theta_2 = (180.0 / M_PI) * Vector3::Angle(b_2, b_1);
+            y = {std::min(theta_1, theta_2), std::max(theta_1, theta_2), Trio::dot_angle(b_0, b_1, b_2)};
+        }
+        else if (strategy == "SPHERE") {
+            y = {Trio::spherical_area(b_0, b_1, b_2).result, Trio::spherical_moment(b_0, b_1, b_2).result};
+        }
+        else {
+            y = {Trio::planar_area(b_0, b_1, b_2), Trio::planar_moment(b_0, b_1, b_2)};
+        }
+
+        QueryBounds b;
+        for (unsigned int i = 0; i < y.size(); i++) {
+            b.y_a.push_back(y[i] - epsilon[i]), b.y_b.push_back(y[i] + epsilon[i]);
+        }
+        bounds.push_back(b);
+    }
+
+    return bounds;
+}
+
+/// Collect the SQLite search and all in-memory searches for the pair (theta) tables.
+std::vector<QueryPath> pair_paths (const std::shared_ptr<Chomp> &ch, const std::string &table) {
+    std::shared_ptr<KVector> kv = ch->k_vector(table);
+    auto results = std::make_shared<Nibble::Results>();
+
+    return {
+            QueryPath{"SQLITE", [ch, results] (const QueryBounds &b) -> unsigned int {
+                return static_cast<unsigned int>(
+                        ch->simple_bound_query({"theta"}, "label_a, label_b", "", b.y_a, b.y_b, *results));
+            }},
+            QueryPath{"KVECTOR", [kv] (const QueryBounds &b) -> unsigned int {
+                KVector::Range r = kv->bound_query(b.y_a[0], b.y_b[0]);
+                return r.end - r.begin;
+            }}
+    };
+}
+
+/// Collect the SQLite (B-tree) search for the multi-feature tables, the bucket index search for the triangle (a, i)
+/// tables, the feature grid search for the dot table, and the R*Tree search if it has been built.
+std::vector<QueryPath> feature_paths (const std::shared_ptr<Chomp> &ch, const std::string &table,
+                                      const std::vector<std::string> &foci) {
+    std::shared_ptr<BucketIndex> bi = ch->bucket_index(table);
+    std::shared_ptr<FeatureGrid> fg = ch->feature_grid(table);
+    auto results = std::make_shared<Nibble::Results>();
+    auto rows = std::make_shared<std::vector<unsigned int>>();
+    std::vector<QueryPath> paths = {
+            QueryPath{"SQLITE", [ch, foci, results] (const QueryBounds &b) -> unsigned int {
+                return static_cast<unsigned int>(
+                        ch->simple_bound_query(foci, "label_a, label_b, label_c", "", b.y_a, b.y_b, *results));
+            }}
+    };
+
+    if (bi != nullptr) {
+        paths.push_back(QueryPath{"BUCKET", [bi, rows] (const QueryBounds &b) -> unsigned int {
+            return bi->bound_query(b.y_a[0], b.y_b[0], b.y_a[1], b.y_b[1], *rows);
+        }});
+    }
+    if (fg != nullptr) {
+        paths.push_back(QueryPath{"GRID", [fg, rows] (const QueryBounds &b) -> unsigned int {
+            return fg->bound_query({b.y_a[0], b.y_a[1], b.y_a[2]}, {b.y_b[0], b.y_b[1], b.y_b[2]}, *rows);
+        }});
+    }
+    if (ch->does_table_exist(table + Nibble::RTREE_SUFFIX)) {
+        paths.push_back(QueryPath{"RTREE", [ch, foci, results] (const QueryBounds &b) -> unsigned int {
+            return static_cast<unsigned int>(
+                    ch->rtree_bound_query(foci, "label_a, label_b, label_c", "", b.y_a, b.y_b, *results));
+        }});
+    }
+    return paths;
+}
+
+int main (int argc, char *argv[]) {
+    std::string upper_strategy = argv[PerformQArguments::IDENTIFICATION_STRATEGY];
+    std::transform(upper_strategy.begin(), upper_strategy.end(), upper_strategy.begin(), ::toupper);
+    const std::map<std::string, std::vector<std::string>> strategy_foci = {
+            {"ANGLE", {"theta"}}, {"PYRAMID", {"theta"}}, {"DOT", {"theta_1", "theta_2", "phi"}},
+            {"SPHERE", {"a", "i"}}, {"PLANE", {"a", "i"}}, {"COMPOSITE", {"a", "i"}}
+    };
+    if (strategy_foci.find(upper_strategy) == strategy_foci.end())
+        throw std::runtime_error("'strategy' must be in space [ANGLE, PYRAMID, DOT, SPHERE, PLANE, COMPOSITE].");
+    const bool is_pair_table = upper_strategy == "ANGLE" || upper_strategy == "PYRAMID";
+    const bool is_triangle_table = strategy_foci.at(upper_strategy).size() == 2;
+
+    // Load our catalog and the in-memory index for the reference table.
+    std::string table = argv[PerformQArguments::REFERENCE_TABLE];
+    Chomp::Builder builder = Chomp::Builder()
+            .with_database_name(argv[PerformQArguments::REFERENCE_DB])
+            .with_hip_name(argv[PerformQArguments::HIP_TABLE])
+            .with_bright_name(argv[PerformQArguments::BRIGHT_TABLE]);
+    if (argc > PerformQArguments::IN_MEMORY && std::stoi(argv[PerformQArguments::IN_MEMORY]) != 0) builder.in_memory();
+    if (is_pair_table) builder.using_k_vector(table);
+    if (is_triangle_table) builder.using_bucket_index(table);
+    if (upper_strategy == "DOT") builder.using_feature_grid(table);
+    std::shared_ptr<Chomp> ch = std::make_shared<Chomp>(builder.build());
+
+    std::vector<QueryBounds> bounds = generate_bounds(ch, upper_strategy, argv);
+    std::vector<QueryPath> paths = (is_pair_table) ? pair_paths(ch, table)
+                                                   : feature_paths(ch, table, strategy_foci.at(upper_strategy));
+    ch->select_table(table);
+    std::cout << "[QUERY] Catalog load time: " << ch->get_load_time() << " ms." << std::endl;
+
+    // Time each path over the same set of searches. The candidate counts should agree between paths.
+    for (const QueryPath &path : paths) {
+        cxxtimer::Timer t(false);
+        unsigned long candidates = 0;
+
+        t.start();
+        for (const QueryBounds &b : bounds) candidates += path.search(b);
+        t.stop();
+
+        double mean_us = static_cast<double>(t.count<std::chrono::nanoseconds>()) / bounds.size() / 1000.0;
+        std::cout << "[QUERY] " << path.name << ": " << bounds.size() << " searches, " << candidates
+                  << " candidates, " << mean_us << " us per search." << std::endl;
+    }
+}
@@ -0,0 +1,181 @@
+/// @file test-lumberjack-writer.cpp
+/// @author Glenn Galvizo
+///
+/// Source file for the unit tests of how a Lumberjack stores its trials: through its writer (which commits trials from
+/// a thread of its own), or through record files that are merged later.
+
+#define ENABLE_TESTING_ACCESS
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <thread>
+
+#include "gtest/gtest.h"
+
+#include "experiment/lumberjack.h"
+
+/// Database and table that every writer test logs to. The table is recreated for each test.
+static const std::string WRITER_DATABASE = "/tmp/lumberjack-writer.db";
+static const std::string WRITER_TABLE = "WRITER_TEST";
+
+static void create_writer_table () {
+    Nibble nb(WRITER_DATABASE);
+    (*nb.conn).exec("DROP TABLE IF EXISTS " + WRITER_TABLE);
+    Lumberjack::create_table(WRITER_DATABASE, WRITER_TABLE, "IdentificationMethod TEXT, Timestamp TEXT, A FLOAT, "
+                                                            "B FLOAT");
+}
+
+/// @return Value of column A for every row of our table, in the order the rows were inserted.
+static std::vector<double> read_writer_table () {
+    Nibble nb(WRITER_DATABASE);
+    SQLite::Statement query(*nb.conn, "SELECT A FROM " + WRITER_TABLE + " ORDER BY rowid");
+    std::vector<double> a;
+    while (query.executeStep()) a.push_back(query.getColumn(0).getDouble());
+    return a;
+}
+
+/// Check that every logged result is written once the last copy of a Lumberjack is destroyed, even if neither a batch
+/// nor a flush interval has passed.
+TEST(LumberjackWriter, DrainsOnDestruction) {
+    create_writer_table();
+    {
+        Lumberjack lu = Lumberjack::Builder().with_database_name(WRITER_DATABASE).using_trial_table(WRITER_TABLE)
+                .with_prefix("W").using_timestamp("0").using_batch_size(1000).flushed_every(60000).build();
+        Lumberjack lu_c = lu;
+        for (int i = 0; i < 10; i++) lu.log_trial({static_cast<double>(i), 0});
+        EXPECT_TRUE(read_writer_table().empty());
+    }
+    EXPECT_EQ(read_writer_table().size(), 10);
+}
+
+/// Check that results are written in the order they were logged, across many batches.
+TEST(LumberjackWriter, KeepsLoggedOrder) {
+    create_writer_table();
+    {
+        Lumberjack lu = Lumberjack::Builder().with_database_name(WRITER_DATABASE).using_trial_table(WRITER_TABLE)
+                .with_prefix("W").using_timestamp("0").using_batch_size(7).flushed_every(1).build();
+        for (int i = 0; i < 500; i++) {
+            lu.log_trial({static_cast<double>(i), 0});
+            if (i % 50 == 0) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    std::vector<double> a = read_writer_table();
+    ASSERT_EQ(a.size(), 500);
+    for (unsigned int i = 0; i < a.size(); i++) EXPECT_EQ(a[i], i);
+}
+
+/// Check that a full batch is written without waiting for the flush interval, and that a partial batch waits for it
+/// (or for a flush).
+TEST(LumberjackWriter, CommitsFullBatches) {
+    create_writer_table();
+    Lumberjack lu = Lumberjack::Builder().with_database_name(WRITER_DATABASE).using_trial_table(WRITER_TABLE)
+            .with_prefix("W").using_timestamp("0").using_batch_size(5).flushed_every(60000).build();
+
+    for (int i = 0; i < 5; i++) lu.log_trial({static_cast<double>(i), 0});
+    auto start = std::chrono::steady_clock::now();
+    while (read_writer_table().size() < 5 && std::chrono::steady_clock::now() - start < std::chrono::seconds(10)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    EXPECT_EQ(read_writer_table().size(), 5);
+
+    for (int i = 5; i < 8; i++) lu.log_trial({static_cast<double>(i), 0});
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    EXPECT_EQ(read_writer_table().size(), 5);
+    lu.flush();
+    EXPECT_EQ(read_writer_table().size(), 8);
+}
+
+/// Check that a zero batch size and flush interval are raised to their smallest usable values, instead of stalling or
+/// spinning our writer.
+TEST(LumberjackWriter, ClampsZeroBatchAndInterval) {
+    create_writer_table();
+    Lumberjack lu = Lumberjack::Builder().with_database_name(WRITER_DATABASE).using_trial_table(WRITER_TABLE)
+            .with_prefix("W").using_timestamp("0").using_batch_size(0).flushed_every(0).build();
+
+    for (int i = 0; i < 20; i++) lu.log_trial({static_cast<double>(i), 0});
+    lu.flush();
+    EXPECT_EQ(read_writer_table().size(), 20);
+}
+
+/// Check that an error other than a busy database is not retried, and is rethrown to the logger instead.
+TEST(LumberjackWriter, RethrowsWriteErrors) {
+    create_writer_table();
+    Lumberjack lu = Lumberjack::Builder().with_database_name(WRITER_DATABASE).using_trial_table(WRITER_TABLE)
+            .with_prefix("W").using_timestamp("0").using_batch_size(5).flushed_every(60000).build();
+    lu.log_trial({0, 0});
+    lu.flush();
+
+    (*lu.conn).exec("DROP TABLE " + WRITER_TABLE);
+    lu.log_trial({1, 0});
+    EXPECT_THROW(lu.flush(), SQLite::Exception);
+    EXPECT_THROW(lu.log_trial({2, 0}), SQLite::Exception);
+}
+
+/// Check that trials appended to record files are merged into the tables named in these files, with their identifier
+/// name and timestamp, and that a trailing partial record is ignored.
+TEST(LumberjackRecords, MergeRoundTrip) {
+    create_writer_table();
+    const std::vector<std::string> paths = {"/tmp/lumberjack-records-0.rec", "/tmp/lumberjack-records-1.rec"};
+    for (unsigned int w = 0; w < paths.size(); w++) {
+        Lumberjack lu = Lumberjack::Builder().with_database_name(WRITER_DATABASE).using_trial_table(WRITER_TABLE)
+                .with_prefix("W" + std::to_string(w)).using_timestamp("1").appending_to_file(paths[w]).build();
+        for (int i = 0; i < 3; i++) lu.log_trial({10.0 * w + i, -1.0 * i});
+        EXPECT_ANY_THROW(lu.log_trial({0}));
+        lu.flush();
+    }
+    EXPECT_TRUE(read_writer_table().empty());
+
+    // The second worker was killed halfway through a record.
+    const double partial = 99;
+    std::ofstream(paths[1], std::ios::binary | std::ios::app).write(reinterpret_cast<const char *>(&partial),
+                                                                     sizeof(partial));
+    EXPECT_EQ(Lumberjack::merge_records(WRITER_DATABASE, paths), 6);
+
+    Nibble nb(WRITER_DATABASE);
+    SQLite::Statement query(*nb.conn, "SELECT IdentificationMethod, Timestamp, A, B FROM " + WRITER_TABLE +
+                                      " ORDER BY rowid");
+    for (unsigned int w = 0; w < paths.size(); w++) {
+        for (int i = 0; i < 3; i++) {
+            ASSERT_TRUE(query.executeStep());
+            EXPECT_EQ(query.getColumn(0).getString(), "W" + std::to_string(w));
+            EXPECT_EQ(query.getColumn(1).getString(), "1");
+            EXPECT_EQ(query.getColumn(2).getDouble(), 10.0 * w + i);
+            EXPECT_EQ(query.getColumn(3).getDouble(), -1.0 * i);
+        }
+    }
+    EXPECT_FALSE(query.executeStep());
+    for (const std::string &path : paths) std::remove(path.c_str());
+}
+
+/// Check that a record file is not merged into a table of another width, and that no file is merged if any one of
+/// them cannot be.
+TEST(LumberjackRecords, MergeRejectsWidthMismatch) {
+    create_writer_table();
+    const std::vector<std::string> paths = {"/tmp/lumberjack-records-0.rec", "/tmp/lumberjack-records-1.rec"};
+    for (const std::string &path : paths) {
+        Lumberjack lu = Lumberjack::Builder().with_database_name(WRITER_DATABASE).using_trial_table(WRITER_TABLE)
+                .with_prefix("W").using_timestamp("1").appending_to_file(path).build();
+        lu.log_trial({1, 2});
+    }
+
+    // The second file now names a table with one more column. Its table name follows the 24 byte header.
+    Nibble nb(WRITER_DATABASE);
+    (*nb.conn).exec("DROP TABLE IF EXISTS WRITER_WIDE");
+    nb.create_table("WRITER_WIDE", "IdentificationMethod TEXT, Timestamp TEXT, A FLOAT, B FLOAT, C FLOAT");
+    {
+        std::fstream f(paths[1], std::ios::binary | std::ios::in | std::ios::out);
+        char name[64] = "WRITER_WIDE";
+        f.seekp(24), f.write(name, sizeof(name));
+    }
+    EXPECT_THROW(Lumberjack::merge_records(WRITER_DATABASE, paths), std::runtime_error);
+    EXPECT_TRUE(read_writer_table().empty());
+
+    EXPECT_EQ(Lumberjack::merge_records(WRITER_DATABASE, {paths[0]}), 1);
+    EXPECT_EQ(read_writer_table().size(), 1);
+    EXPECT_THROW(Lumberjack::merge_records(WRITER_DATABASE, {"/tmp/lumberjack-records-none.rec"}),
+                 std::runtime_error);
+    (*nb.conn).exec("DROP TABLE WRITER_WIDE");
+    for (const std::string &path : paths) std::remove(path.c_str());
+}
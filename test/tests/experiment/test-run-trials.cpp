@@ -0,0 +1,85 @@
+/// @file test-run-trials.cpp
+/// @author Glenn Galvizo
+///
+/// Source file for the unit tests of Experiment::run_trials, which runs the trials of an experiment on a pool of
+/// workers.
+
+#define ENABLE_TESTING_ACCESS
+
+#include <set>
+
+#include "gtest/gtest.h"
+
+#include "experiment/experiment.h"
+
+/// Database and table that every run_trials test logs to. The table is recreated for each test.
+static const std::string TRIALS_DATABASE = "/tmp/lumberjack-trials.db";
+static const std::string TRIALS_TABLE = "TRIALS_TEST";
+
+/// @return Lumberjack of a new trial table, whose results hold the index of their trial and of their worker.
+static std::shared_ptr<Lumberjack> create_trials_lumberjack () {
+    Nibble nb(TRIALS_DATABASE);
+    (*nb.conn).exec("DROP TABLE IF EXISTS " + TRIALS_TABLE);
+    Lumberjack::create_table(TRIALS_DATABASE, TRIALS_TABLE, "IdentificationMethod TEXT, Timestamp TEXT, N INT, W INT");
+    return std::make_shared<Lumberjack>(Lumberjack::Builder().with_database_name(TRIALS_DATABASE)
+                                                .using_trial_table(TRIALS_TABLE).with_prefix("T")
+                                                .using_timestamp("0").build());
+}
+
+/// @return Trial index of every row in our trial table.
+static std::vector<int> read_trials_table () {
+    Nibble nb(TRIALS_DATABASE);
+    SQLite::Statement query(*nb.conn, "SELECT N FROM " + TRIALS_TABLE);
+    std::vector<int> n;
+    while (query.executeStep()) n.push_back(query.getColumn(0).getInt());
+    return n;
+}
+
+/// Check that every trial is run and logged exactly once, for any number of workers.
+TEST(RunTrials, EachTrialIsLoggedOnce) {
+    for (unsigned int n_threads : {1u, 2u, 4u, 7u}) {
+        std::shared_ptr<Lumberjack> lu = create_trials_lumberjack();
+        auto ep = std::make_shared<Experiment::Parameters>();
+        ep->n_threads = n_threads;
+
+        std::atomic<unsigned int> n_workers(0);
+        Experiment::run_trials(250, lu, ep, [&n_workers] (const unsigned int w) -> Experiment::TrialFunction {
+            n_workers++;
+            return [w] (const unsigned int n) -> Nibble::tuple_d {
+                return {static_cast<double>(n), static_cast<double>(w)};
+            };
+        });
+        EXPECT_EQ(n_workers, n_threads);
+
+        std::vector<int> n = read_trials_table();
+        EXPECT_EQ(n.size(), 250);
+        std::set<int> n_unique(n.begin(), n.end());
+        EXPECT_EQ(n_unique.size(), 250);
+        EXPECT_EQ(*n_unique.begin(), 0);
+        EXPECT_EQ(*n_unique.rbegin(), 249);
+    }
+}
+
+/// Check that an exception thrown while building a worker, running a trial or logging a result is rethrown once every
+/// worker has stopped.
+TEST(RunTrials, ErrorsAreRethrown) {
+    std::shared_ptr<Lumberjack> lu = create_trials_lumberjack();
+    auto ep = std::make_shared<Experiment::Parameters>();
+    ep->n_threads = 4;
+
+    EXPECT_THROW(Experiment::run_trials(100, lu, ep, [] (const unsigned int w) -> Experiment::TrialFunction {
+        if (w == 2) throw std::runtime_error("Worker cannot be built.");
+        return [] (const unsigned int n) -> Nibble::tuple_d { return {static_cast<double>(n), 0}; };
+    }), std::runtime_error);
+
+    EXPECT_THROW(Experiment::run_trials(100, lu, ep, [] (const unsigned int) -> Experiment::TrialFunction {
+        return [] (const unsigned int n) -> Nibble::tuple_d {
+            if (n == 37) throw std::runtime_error("Trial cannot be run.");
+            return {static_cast<double>(n), 0};
+        };
+    }), std::runtime_error);
+
+    EXPECT_THROW(Experiment::run_trials(100, lu, ep, [] (const unsigned int) -> Experiment::TrialFunction {
+        return [] (const unsigned int n) -> Nibble::tuple_d { return {static_cast<double>(n)}; };
+    }), std::runtime_error);
+}
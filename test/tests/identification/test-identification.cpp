@@ -105,4 +105,219 @@ TEST (Identification, Identification) {
     std::array<std::shared_ptr<Identification>, 6> identifiers = generate_identifiers();
 
     for (const auto &identifier : identifiers) { identifier->identify(); }
-}
\ No newline at end of file
+}
+
+/// @return Each point of big_p (rotated by q) paired with the first star of big_i within epsilon, found linearly.
+std::vector<std::pair<int, Star>> linear_overlay (const Star::list &big_i, const Star::list &big_p, const Rotation &q,
+                                                  const double epsilon) {
+    std::vector<std::pair<int, Star>> m;
+    for (const Star &p_i : big_p) {
+        Star r_prime = Rotation::rotate(p_i, q);
+        for (const Star &i_i : big_i) {
+            if (Star::within_angle(r_prime, i_i, epsilon)) {
+                m.emplace_back(r_prime.get_label(), i_i);
+                break;
+            }
+        }
+    }
+    return m;
+}
+
+TEST(Identification, OverlayMatchesLinearSearch) {
+    // Our image has clusters of close stars, so a point is often within epsilon of more than one of them.
+    Star::list big_i, big_p;
+    for (int i = 0; i < 400; i++) {
+        Star s = Star::chance();
+        big_i.push_back(s);
+        if (i % 4 == 0) big_i.push_back(Rotation::shake(s, 0.5));
+    }
+    for (int i = 0; i < 1000; i++) big_p.push_back(Star::chance(i));
+
+    for (const double epsilon : {0.0, 0.01, 1.0, 5.0, 45.0, 180.0}) {
+        for (const Rotation &q : {Rotation::identity(), Rotation::chance()}) {
+            Star::list found = Identification::Overlay(big_i, epsilon).find_matches(big_p, q);
+            std::vector<std::pair<int, Star>> expected = linear_overlay(big_i, big_p, q, epsilon);
+
+            // Points are visited in a random order, so our matches are compared by the label of their point.
+            std::sort(found.begin(), found.end(), [] (const Star &a, const Star &b) -> bool {
+                return a.get_label() < b.get_label();
+            });
+            ASSERT_EQ(expected.size(), found.size());
+            for (unsigned int i = 0; i < found.size(); i++) {
+                EXPECT_EQ(expected[i].first, found[i].get_label());
+                EXPECT_EQ(expected[i].second.get_vector(), found[i].get_vector());
+            }
+        }
+    }
+}
+
+/// Check that the pairs and trios of a neighborhood are exactly (and in the same order as) those found by comparing
+/// every pair and trio of stars.
+TEST(Identification, NeighborhoodMatchesBruteForce) {
+    Star::list stars;
+    for (int i = 0; i < 300; i++) stars.push_back(Star::chance(i));
+    const double fov = 25;
+    Identification::Neighborhood nb = Identification::find_neighborhood(stars, fov);
+
+    ASSERT_EQ(nb.near.size(), stars.size());
+    ASSERT_EQ(nb.trios.size(), stars.size());
+    unsigned long n_trios = 0;
+    for (unsigned int i = 0; i < stars.size(); i++) {
+        std::vector<unsigned int> near_i;
+        std::vector<std::array<unsigned int, 2>> trios_i;
+        for (unsigned int j = i + 1; j < stars.size(); j++) {
+            if (!Star::within_angle(stars[i], stars[j], fov)) continue;
+            near_i.push_back(j);
+            for (unsigned int k = j + 1; k < stars.size(); k++) {
+                if (Star::within_angle(stars[i], stars[k], fov) && Star::within_angle(stars[j], stars[k], fov)) {
+                    trios_i.push_back(std::array<unsigned int, 2>{j, k});
+                }
+            }
+        }
+        EXPECT_EQ(nb.near[i], near_i);
+        EXPECT_EQ(nb.trios[i], trios_i);
+        n_trios += trios_i.size();
+    }
+    EXPECT_GT(n_trios, 0);
+
+}
+
+/// Exposes the pivot pool of Identification to our tests.
+struct PivotPool : public Identification {
+    using Identification::distribute_pivots;
+};
+
+/// Check that every pivot is run once, and that an exception thrown by any pivot is rethrown once every thread has
+/// stopped.
+TEST(Identification, DistributePivotsRethrows) {
+    std::vector<std::atomic<int>> runs(1000);
+    PivotPool::distribute_pivots(1000, 4, [&runs] (const unsigned int i, const unsigned int) -> void { runs[i]++; });
+    for (const std::atomic<int> &r : runs) EXPECT_EQ(r, 1);
+
+    EXPECT_THROW(PivotPool::distribute_pivots(1000, 4, [] (const unsigned int i, const unsigned int) -> void {
+        if (i == 500) throw std::runtime_error("Pivot cannot be run.");
+    }), std::runtime_error);
+}
+
+TEST(Identification, IdentifyAllKeepsInputOrder) {
+    std::shared_ptr<Chomp> ch = std::make_shared<Chomp>(
+            Chomp::Builder()
+                    .with_database_name("/tmp/nibble.db")
+                    .with_bright_name("HIP_BRIGHT")
+                    .with_hip_name("HIP")
+                    .build()
+    );
+    Identification::Builder<Angle> builder = Identification::Builder<Angle>()
+            .using_chomp(ch)
+            .identified_by("ANGLE")
+            .with_table("ANGLE")
+            .using_epsilon_1(0.0001)
+            .using_epsilon_2(0)
+            .using_epsilon_3(0)
+            .using_epsilon_4(0.0001)
+            .limit_n_comparisons(5000000);
+
+    std::vector<std::shared_ptr<Benchmark>> images;
+    for (int i = 0; i < 8; i++) {
+        images.push_back(std::make_shared<Benchmark>(
+                Benchmark::Builder().using_chomp(ch).limited_by_m(4.5).limited_by_fov(20).build()
+        ));
+    }
+
+    // Each result must belong to the image at its index: every star found is an answer of that image.
+    std::vector<Identification::StarsEither> results = Identification::identify_all(builder, images, 3);
+    ASSERT_EQ(images.size(), results.size());
+    for (unsigned int i = 0; i < images.size(); i++) {
+        const Star::list &answers = *images[i]->get_answers();
+        EXPECT_EQ(0, results[i].error);
+        for (const Star &s : results[i].result) {
+            EXPECT_TRUE(std::any_of(answers.begin(), answers.end(), [&s] (const Star &a) -> bool {
+                return a.get_label() == s.get_label() && Star::within_angle(a, s, 0.001);
+            }));
+        }
+    }
+}
+
+TEST(Identification, ParallelSearchMatchesSerialOrder) {
+    std::shared_ptr<Chomp> ch = std::make_shared<Chomp>(
+            Chomp::Builder()
+                    .with_database_name("/tmp/nibble.db")
+                    .with_bright_name("HIP_BRIGHT")
+                    .with_hip_name("HIP")
+                    .build()
+    );
+    std::shared_ptr<Benchmark> be = std::make_shared<Benchmark>(
+            Benchmark::Builder().using_chomp(ch).limited_by_m(4.5).limited_by_fov(20).build()
+    );
+    Identification::Builder<Angle> builder = Identification::Builder<Angle>()
+            .using_chomp(ch)
+            .given_image(be)
+            .identified_by("ANGLE")
+            .with_table("ANGLE")
+            .using_epsilon_1(0.0001)
+            .using_epsilon_2(0)
+            .using_epsilon_3(0)
+            .using_epsilon_4(0.0001)
+            .limit_n_comparisons(5000000);
+    std::shared_ptr<Angle> serial = Identification::Builder<Angle>(builder).build();
+    std::shared_ptr<Angle> parallel = Identification::Builder<Angle>(builder).searching_on_n_threads(3).build();
+
+    // With false stars, the first confident pair sits deeper in our hypotheses.
+    for (int n = 0; n < 5; n++) {
+        be->generate_stars(ch, Benchmark::NO_N, 4.5);
+        be->add_extra_light(10);
+
+        Identification::StarsEither a = serial->identify(), b = parallel->identify();
+        EXPECT_EQ(a.error, b.error);
+        EXPECT_EQ(serial->get_nu(), parallel->get_nu());
+        ASSERT_EQ(a.result.size(), b.result.size());
+        for (unsigned int i = 0; i < a.result.size(); i++) {
+            EXPECT_EQ(a.result[i].get_label(), b.result[i].get_label());
+            EXPECT_TRUE(Star::within_angle(a.result[i], b.result[i], 0.000001));
+        }
+    }
+}
+
+TEST(Identification, ParallelSearchMatchesSerialNuLimit) {
+    std::shared_ptr<Chomp> ch = std::make_shared<Chomp>(
+            Chomp::Builder()
+                    .with_database_name("/tmp/nibble.db")
+                    .with_bright_name("HIP_BRIGHT")
+                    .with_hip_name("HIP")
+                    .build()
+    );
+    Plane::generate_table(ch, 20, "PLANE_NU_TEST");
+    std::shared_ptr<Benchmark> be = std::make_shared<Benchmark>(
+            Benchmark::Builder().using_chomp(ch).limited_by_m(4.5).limited_by_fov(20).build()
+    );
+
+    // A triangle method checks nu_max in the middle of a hypothesis, as well as between hypotheses. With a small
+    // nu_max, the hypothesis during which the limit is crossed decides our result.
+    for (const unsigned int nu_max : {0u, 2u, 5u, 10u, 25u, 60u}) {
+        Identification::Builder<Plane> builder = Identification::Builder<Plane>()
+                .using_chomp(ch)
+                .given_image(be)
+                .identified_by("PLANE")
+                .with_table("PLANE_NU_TEST")
+                .using_epsilon_1(0.0001)
+                .using_epsilon_2(0.0001)
+                .using_epsilon_4(0.0001)
+                .limit_n_comparisons(nu_max);
+        std::shared_ptr<Plane> serial = Identification::Builder<Plane>(builder).build();
+        std::shared_ptr<Plane> parallel = Identification::Builder<Plane>(builder).searching_on_n_threads(3).build();
+
+        for (int n = 0; n < 3; n++) {
+            be->generate_stars(ch, Benchmark::NO_N, 4.5);
+            be->add_extra_light(5);
+
+            Identification::StarsEither a = serial->identify(), b = parallel->identify();
+            EXPECT_EQ(a.error, b.error);
+            EXPECT_EQ(serial->get_nu(), parallel->get_nu());
+            ASSERT_EQ(a.result.size(), b.result.size());
+            for (unsigned int i = 0; i < a.result.size(); i++) {
+                EXPECT_EQ(a.result[i].get_label(), b.result[i].get_label());
+            }
+        }
+    }
+    (*ch->conn).exec("DROP TABLE PLANE_NU_TEST");
+}
@@ -11,8 +11,17 @@
 #include "math/test-trio.cpp"
 #include "storage/test-nibble.cpp"
 #include "storage/test-chomp.cpp"
+#include "storage/test-k-vector.cpp"
+#include "storage/test-bucket-index.cpp"
+#include "storage/test-feature-grid.cpp"
+#include "storage/test-pantry.cpp"
+#include "storage/test-crumb.cpp"
+#include "storage/test-sky-grid.cpp"
+#include "trace/test-trace.cpp"
 #include "benchmark/test-benchmark.cpp"
 #include "identification/test-identification.cpp"
+#include "experiment/test-run-trials.cpp"
+#include "experiment/test-lumberjack-writer.cpp"
 //#include "experiment/test-lumberjack.cpp"
 //#include "experiment/test-experiment.cpp"
 
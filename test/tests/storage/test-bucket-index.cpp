@@ -0,0 +1,72 @@
+/// @file test-bucket-index.cpp
+/// @author Glenn Galvizo
+///
+/// Source file for all BucketIndex class unit tests.
+
+#define ENABLE_TESTING_ACCESS
+
+#include <algorithm>
+#include "gtest/gtest.h"
+
+#include "math/random-draw.h"
+#include "storage/bucket-index.h"
+
+/// @return Rows whose keys lie in the given box, found by checking every row.
+std::vector<unsigned int> linear_box_query (const std::vector<double> &y_1, const std::vector<double> &y_2,
+                                            const double y_1a, const double y_1b, const double y_2a,
+                                            const double y_2b) {
+    std::vector<unsigned int> rows;
+    for (unsigned int r = 0; r < y_1.size(); r++) {
+        if (y_1[r] >= y_1a && y_1[r] <= y_1b && y_2[r] >= y_2a && y_2[r] <= y_2b) rows.push_back(r);
+    }
+    return rows;
+}
+
+TEST(BucketIndex, ConstructorUnsortedOrMismatched) {
+    EXPECT_ANY_THROW(BucketIndex({1, 0}, {0, 0}, {0, 0, 0, 1, 1, 1}, 3));
+    EXPECT_ANY_THROW(BucketIndex({0, 1}, {0}, {0, 0, 0, 1, 1, 1}, 3));
+    EXPECT_ANY_THROW(BucketIndex({0, 1}, {0, 0}, {0, 0, 0, 1, 1}, 3));
+    EXPECT_NO_THROW(BucketIndex({}, {}, {}, 3));
+}
+
+TEST(BucketIndex, BoundQueryMatchesLinearSearch) {
+    std::vector<double> y_1, y_2;
+    std::vector<int> ell;
+    for (unsigned int i = 0; i < 10000; i++) y_1.push_back(RandomDraw::draw_real(0, 20));
+    std::sort(y_1.begin(), y_1.end());
+    for (unsigned int i = 0; i < 10000; i++) {
+        y_2.push_back(RandomDraw::draw_real(0, 5));
+        ell.insert(ell.end(), {static_cast<int>(i), -static_cast<int>(i), 2 * static_cast<int>(i)});
+    }
+
+    // A bucket size that does not divide the number of rows leaves a partial bucket at the end.
+    for (const unsigned int bucket_size : {1u, 7u, BucketIndex::DEFAULT_BUCKET_SIZE, 20000u}) {
+        BucketIndex bi(y_1, y_2, ell, 3, bucket_size);
+        std::vector<unsigned int> rows;
+
+        for (int i = 0; i < 200; i++) {
+            double a = RandomDraw::draw_real(-1, 21), i_m = RandomDraw::draw_real(-1, 6);
+            double epsilon_1 = RandomDraw::draw_real(0, 0.5), epsilon_2 = RandomDraw::draw_real(0, 0.5);
+            unsigned int n = bi.bound_query(a - epsilon_1, a + epsilon_1, i_m - epsilon_2, i_m + epsilon_2, rows);
+            EXPECT_EQ(n, rows.size());
+            EXPECT_EQ(rows, linear_box_query(y_1, y_2, a - epsilon_1, a + epsilon_1, i_m - epsilon_2,
+                                             i_m + epsilon_2));
+        }
+        bi.bound_query(0, 20, 0, 5, rows);
+        ASSERT_EQ(rows.size(), 10000u);
+        EXPECT_EQ(bi.labels(rows[42])[0], 42);
+        EXPECT_EQ(bi.labels(rows[42])[2], 84);
+    }
+}
+
+TEST(BucketIndex, BoundQueryBoundsAreInclusive) {
+    BucketIndex bi({1, 2, 2, 3}, {4, 5, 6, 5}, {1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4}, 3, 2);
+    std::vector<unsigned int> rows;
+
+    EXPECT_EQ(bi.bound_query(2, 3, 5, 5, rows), 2);
+    EXPECT_EQ(rows, (std::vector<unsigned int>{1, 3}));
+    EXPECT_EQ(bi.bound_query(2, 2, 4, 6, rows), 2);
+    EXPECT_EQ(bi.bound_query(3, 2, 4, 6, rows), 0);
+    EXPECT_EQ(bi.bound_query(0, 5, 7, 8, rows), 0);
+    EXPECT_TRUE(rows.empty());
+}
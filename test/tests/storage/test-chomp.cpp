@@ -9,9 +9,14 @@
 
 #include "gmock/gmock.h"
 #include <fstream>
+#include <thread>
+#include <fcntl.h>
 #include <libgen.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 #include "storage/chomp.h"
+#include "math/random-draw.h"
 
 
 using testing::PrintToString;
@@ -95,6 +100,45 @@ TEST(Chomp, QueryHip) {
     EXPECT_DOUBLE_EQ(a[2], 0.627409554608177);
 }
 
+TEST(Chomp, FindHipMatchesQueryHip) {
+    Chomp ch = Chomp::Builder()
+            .with_database_name("/tmp/nibble.db")
+            .with_bright_name("HIP_BRIGHT")
+            .with_hip_name("HIP")
+            .build();
+    Chomp::StarEither a = ch.find_hip(32349), b = ch.find_hip(-1), c = ch.find_hip(1000000);
+
+    EXPECT_EQ(a.error, 0);
+    EXPECT_EQ(a.result.get_label(), 32349);
+    EXPECT_DOUBLE_EQ(a.result[0], ch.query_hip(32349)[0]);
+    EXPECT_EQ(b.error, Chomp::NO_STAR_FOUND_EITHER);
+    EXPECT_EQ(c.error, Chomp::NO_STAR_FOUND_EITHER);
+    EXPECT_ANY_THROW(ch.query_hip(1000000));
+    EXPECT_EQ(ch.get_hip_lookups(), 5);
+}
+
+TEST(Chomp, CatalogsLoadOnFirstUse) {
+    Chomp ch = Chomp::Builder()
+            .with_database_name("/tmp/nibble.db")
+            .with_bright_name("HIP_BRIGHT")
+            .with_hip_name("HIP")
+            .build();
+    EXPECT_EQ(ch.get_load_time(), 0);
+
+    // Each catalog is loaded once, by the first method that touches it.
+    Star::list bright = ch.bright_as_list();
+    double bright_time = ch.get_load_time();
+    EXPECT_GT(bright_time, 0);
+    EXPECT_EQ(ch.nearby_bright_stars(bright[0], 1, 10)[0].get_label(), bright[0].get_label());
+    EXPECT_EQ(ch.get_load_time(), bright_time);
+
+    EXPECT_EQ(ch.query_hip(bright[0].get_label()).get_vector(), bright[0].get_vector());
+    double hip_time = ch.get_load_time();
+    EXPECT_GT(hip_time, bright_time);
+    EXPECT_FALSE(ch.nearby_hip_stars(bright[0], 1, 10).empty());
+    EXPECT_EQ(ch.get_load_time(), hip_time);
+}
+
 TEST(Chomp, NearbyBrightStars) {
     Chomp ch = Chomp::Builder()
             .with_database_name("/tmp/nibble.db")
@@ -120,4 +164,324 @@ TEST(Chomp, NearbyHipStars) {
     for (int q = 0; q < 10; q++) {
         EXPECT_TRUE(Star::within_angle(nearby[q], focus, 5));
     }
-}
\ No newline at end of file
+}
+
+TEST(Chomp, GenerateTablesSkipsMalformedRows) {
+    const std::string catalog_path = "/tmp/chomp-catalog.dat", database_name = "/tmp/chomp-catalog.db";
+    std::remove(database_name.c_str());
+
+    // Each row holds {label, alpha, delta, pm_alpha, pm_delta, m} at their fixed-width columns.
+    const auto catalog_row = [] (const std::array<std::string, 6> &fields) -> std::string {
+        std::string row(136, ' ');
+        const std::array<int, 6> offsets = {0, 15, 29, 51, 60, 129};
+        for (int c = 0; c < 6; c++) row.replace(offsets[c], fields[c].size(), fields[c]);
+        return row;
+    };
+    std::ofstream catalog(catalog_path);
+    for (int i = 0; i < 5; i++) catalog << "#header" << std::endl;
+    catalog << catalog_row({"     1", "0.0000159148", "0.0190068680", "   -4.55", "   -1.19", " 9.2043"}) << std::endl;
+    catalog << catalog_row({"     2", "3.1883127431", "-1.0843551682", "  181.21", "   -0.93", " 3.5000"}) << std::endl;
+    catalog << std::endl << "     3" << std::endl;
+    catalog << catalog_row({"     4", "1.0e-1", "-0.5", "+2", "0", "4.25"}) << std::endl;
+    catalog << catalog_row({"     5", "0.5", "0.5", "0", "0", "       "}) << std::endl;
+    catalog << catalog_row({"     6", "0.25", "0.25", "0", "0", "1.0"});
+    catalog.close();
+
+    Chomp ch = Chomp::Builder()
+            .with_database_name(database_name)
+            .using_catalog(catalog_path)
+            .limited_by_magnitude(4.5)
+            .using_current_time("01-2018")
+            .with_bright_name("HIP_BRIGHT")
+            .with_hip_name("HIP")
+            .build();
+    ch.select_table("HIP");
+    EXPECT_EQ(ch.search_table("label", 10), (Nibble::tuples_d{{1}, {2}, {4}, {6}}));
+    EXPECT_EQ(ch.bright_as_list().size(), 3);
+    EXPECT_EQ(ch.find_hip(3).error, Chomp::NO_STAR_FOUND_EITHER);
+    EXPECT_EQ(ch.find_hip(5).error, Chomp::NO_STAR_FOUND_EITHER);
+
+    // Every field is read as stof would read it. Proper motion is applied over (2018 - 1991) + (1 - 3) = 25 years.
+    Nibble::tuple_d row = ch.search_table("alpha, delta, m", "label = 4", 1)[0];
+    EXPECT_DOUBLE_EQ(row[0], (180.0 / M_PI) * std::stof("1.0e-1") + 2 * 25.0 / 3600000.0);
+    EXPECT_DOUBLE_EQ(row[1], (180.0 / M_PI) * std::stof("-0.5"));
+    EXPECT_DOUBLE_EQ(row[2], std::stof("4.25"));
+    EXPECT_EQ(ch.generate_tables(catalog_path, "01-2018", 4.5), 2 * Chomp::TABLE_EXISTS);
+}
+
+TEST(Chomp, RTreeBoundQueryMatchesBTree) {
+    Nibble nb("/tmp/nibble.db");
+    for (std::string table : {"RTREE_TEST_RTREE", "RTREE_TEST_RTREE_ROWS", "RTREE_TEST"}) {
+        (*nb.conn).exec("DROP TABLE IF EXISTS " + table);
+    }
+
+    // Build a clustered table of random trios, and the R*Tree over its three features.
+    Nibble::tuple_d rows;
+    for (int r = 0; r < 5000; r++) {
+        rows.insert(rows.end(), {static_cast<double>(r), static_cast<double>(r + 1), static_cast<double>(r + 2),
+                                 RandomDraw::draw_real(0, 20), RandomDraw::draw_real(0, 20),
+                                 RandomDraw::draw_real(0, 180)});
+    }
+    nb.create_table("RTREE_TEST", "label_a INT, label_b INT, label_c INT, theta_1 FLOAT, theta_2 FLOAT, phi FLOAT",
+                    "theta_1, theta_2, phi, label_a, label_b, label_c");
+    nb.bulk_insert_into_table("label_a, label_b, label_c, theta_1, theta_2, phi", rows);
+    EXPECT_EQ(nb.index_rtree("label_a, label_b, label_c", "theta_1, theta_2, phi"), 0);
+    EXPECT_EQ(nb.index_rtree("label_a, label_b, label_c", "theta_1, theta_2, phi"), Nibble::TABLE_NOT_CREATED_RET);
+
+    Chomp ch_b = Chomp::Builder().with_database_name("/tmp/nibble.db").with_bright_name("HIP_BRIGHT")
+            .with_hip_name("HIP").build();
+    Chomp ch_r = Chomp::Builder().with_database_name("/tmp/nibble.db").with_bright_name("HIP_BRIGHT")
+            .with_hip_name("HIP").using_rtree("RTREE_TEST").build();
+    EXPECT_ANY_THROW(Chomp::Builder().with_database_name("/tmp/nibble.db").with_bright_name("HIP_BRIGHT")
+                             .with_hip_name("HIP").using_rtree("HIP").build());
+    ch_b.select_table("RTREE_TEST"), ch_r.select_table("RTREE_TEST");
+
+    // The R*Tree must return the same rows in the same order, including rows on the edges of each box.
+    const std::vector<std::string> foci = {"theta_1", "theta_2", "phi"};
+    Nibble::Results r_b, r_r;
+    for (int q = 0; q < 200; q++) {
+        const unsigned int r = static_cast<unsigned int>(RandomDraw::draw_integer(0, 4999));
+        const double w = (q % 2 == 0) ? 0 : RandomDraw::draw_real(0, 5);
+        std::vector<double> y_a = {rows[6 * r + 3] - w, rows[6 * r + 4] - w, rows[6 * r + 5] - w};
+        std::vector<double> y_b = {rows[6 * r + 3] + w, rows[6 * r + 4] + w, rows[6 * r + 5] + w};
+
+        ch_b.simple_bound_query(foci, "label_a, label_b, label_c", "phi", y_a, y_b, r_b);
+        ch_r.simple_bound_query(foci, "label_a, label_b, label_c", "phi", y_a, y_b, r_r);
+        EXPECT_GE(r_r.size(), 1);
+        EXPECT_EQ(r_b.ell, r_r.ell);
+        EXPECT_EQ(r_b.y, r_r.y);
+    }
+    for (std::string table : {"RTREE_TEST_RTREE", "RTREE_TEST_RTREE_ROWS", "RTREE_TEST"}) {
+        (*nb.conn).exec("DROP TABLE " + table);
+    }
+}
+
+TEST(Chomp, BucketIndexMatchesBTree) {
+    Nibble nb("/tmp/nibble.db");
+    (*nb.conn).exec("DROP TABLE IF EXISTS BUCKET_TEST");
+
+    // Build a clustered table of random trios. Ties on a are kept, so the index must order these rows as SQLite does.
+    Nibble::tuple_d rows;
+    for (int r = 0; r < 5000; r++) {
+        rows.insert(rows.end(), {static_cast<double>(r), static_cast<double>(r + 1), static_cast<double>(r + 2),
+                                 static_cast<double>(RandomDraw::draw_integer(0, 400)) / 20.0,
+                                 RandomDraw::draw_real(0, 5)});
+    }
+    nb.create_table("BUCKET_TEST", "label_a INT, label_b INT, label_c INT, a FLOAT, i FLOAT",
+                    "a, i, label_a, label_b, label_c");
+    nb.bulk_insert_into_table("label_a, label_b, label_c, a, i", rows);
+
+    Chomp ch = Chomp::Builder().with_database_name("/tmp/nibble.db").with_bright_name("HIP_BRIGHT")
+            .with_hip_name("HIP").using_bucket_index("BUCKET_TEST").build();
+    EXPECT_ANY_THROW(Chomp::Builder().with_database_name("/tmp/nibble.db").with_bright_name("HIP_BRIGHT")
+                             .with_hip_name("HIP").using_bucket_index("BUCKET_TEST_MISSING").build());
+    ASSERT_NE(ch.bucket_index("BUCKET_TEST"), nullptr);
+    EXPECT_EQ(ch.bucket_index("HIP"), nullptr);
+    ch.select_table("BUCKET_TEST");
+
+    // The index must return the same label trios in the same order, including rows on the edges of each box.
+    std::shared_ptr<BucketIndex> bi = ch.bucket_index("BUCKET_TEST");
+    std::vector<unsigned int> r_i;
+    Nibble::Results r_b;
+    for (int q = 0; q < 200; q++) {
+        const unsigned int r = static_cast<unsigned int>(RandomDraw::draw_integer(0, 4999));
+        const double w = (q % 2 == 0) ? 0 : RandomDraw::draw_real(0, 0.5);
+        std::vector<double> y_a = {rows[5 * r + 3] - w, rows[5 * r + 4] - w};
+        std::vector<double> y_b = {rows[5 * r + 3] + w, rows[5 * r + 4] + w};
+
+        ch.simple_bound_query({"a", "i"}, "label_a, label_b, label_c", "", y_a, y_b, r_b);
+        bi->bound_query(y_a[0], y_b[0], y_a[1], y_b[1], r_i);
+        ASSERT_EQ(r_i.size(), r_b.size());
+        EXPECT_GE(r_i.size(), 1);
+        for (unsigned int j = 0; j < r_i.size(); j++) {
+            EXPECT_TRUE(std::equal(r_b.labels(j), r_b.labels(j) + 3, bi->labels(r_i[j])));
+        }
+    }
+    (*nb.conn).exec("DROP TABLE BUCKET_TEST");
+}
+
+TEST(Chomp, FeatureGridMatchesBTree) {
+    Nibble nb("/tmp/nibble.db");
+    (*nb.conn).exec("DROP TABLE IF EXISTS GRID_TEST");
+
+    Nibble::tuple_d rows;
+    for (int r = 0; r < 5000; r++) {
+        rows.insert(rows.end(), {static_cast<double>(r), static_cast<double>(r + 1), static_cast<double>(r + 2),
+                                 RandomDraw::draw_real(0, 20), RandomDraw::draw_real(0, 20),
+                                 RandomDraw::draw_real(0, 180)});
+    }
+    nb.create_table("GRID_TEST", "label_a INT, label_b INT, label_c INT, theta_1 FLOAT, theta_2 FLOAT, phi FLOAT",
+                    "theta_1, theta_2, phi, label_a, label_b, label_c");
+    nb.bulk_insert_into_table("label_a, label_b, label_c, theta_1, theta_2, phi", rows);
+
+    Chomp ch = Chomp::Builder().with_database_name("/tmp/nibble.db").with_bright_name("HIP_BRIGHT")
+            .with_hip_name("HIP").using_feature_grid("GRID_TEST").build();
+    ASSERT_NE(ch.feature_grid("GRID_TEST"), nullptr);
+    EXPECT_EQ(ch.feature_grid("HIP"), nullptr);
+    ch.select_table("GRID_TEST");
+
+    // The grid must return the same label trios in the same order, including rows on the edges of each box.
+    std::shared_ptr<FeatureGrid> fg = ch.feature_grid("GRID_TEST");
+    std::vector<unsigned int> r_g;
+    Nibble::Results r_b;
+    for (int q = 0; q < 200; q++) {
+        const unsigned int r = static_cast<unsigned int>(RandomDraw::draw_integer(0, 4999));
+        const double w = (q % 2 == 0) ? 0 : RandomDraw::draw_real(0, 5);
+        std::vector<double> y_a = {rows[6 * r + 3] - w, rows[6 * r + 4] - w, rows[6 * r + 5] - w};
+        std::vector<double> y_b = {rows[6 * r + 3] + w, rows[6 * r + 4] + w, rows[6 * r + 5] + w};
+
+        ch.simple_bound_query({"theta_1", "theta_2", "phi"}, "label_a, label_b, label_c", "", y_a, y_b, r_b);
+        fg->bound_query({y_a[0], y_a[1], y_a[2]}, {y_b[0], y_b[1], y_b[2]}, r_g);
+        ASSERT_EQ(r_g.size(), r_b.size());
+        EXPECT_GE(r_g.size(), 1);
+        for (unsigned int j = 0; j < r_g.size(); j++) {
+            EXPECT_TRUE(std::equal(r_b.labels(j), r_b.labels(j) + 3, fg->labels(r_g[j])));
+        }
+    }
+    (*nb.conn).exec("DROP TABLE GRID_TEST");
+}
+
+TEST(Chomp, StaleCrumbIsNotUsed) {
+    Nibble nb("/tmp/nibble.db");
+    const std::string crumb = Crumb::path_for("/tmp/nibble.db", "STALE_TEST");
+    auto create = [&nb] (const int n_rows) -> void {
+        (*nb.conn).exec("DROP TABLE IF EXISTS STALE_TEST");
+        Nibble::tuple_d rows;
+        for (int r = 0; r < n_rows; r++) rows.insert(rows.end(), {static_cast<double>(r), r + 1.0, r * 0.01});
+        nb.create_table("STALE_TEST", "label_a INT, label_b INT, theta FLOAT", "theta, label_a, label_b");
+        nb.bulk_insert_into_table("label_a, label_b, theta", rows);
+    };
+    auto k_vector_size = [] () -> unsigned int {
+        return Chomp::Builder().with_database_name("/tmp/nibble.db").with_bright_name("HIP_BRIGHT")
+                .with_hip_name("HIP").using_k_vector("STALE_TEST").build().k_vector("STALE_TEST")->size();
+    };
+
+    // The crumb of a table that has since been regenerated must not be searched in its place.
+    create(100);
+    Crumb::write(nb, "STALE_TEST", crumb);
+    EXPECT_EQ(k_vector_size(), 100);
+    nb.select_table("STALE_TEST");
+    nb.bulk_insert_into_table("label_a, label_b, theta", {500, 501, 5.0});
+    EXPECT_EQ(k_vector_size(), 101);
+
+    create(50);
+    EXPECT_FALSE(Crumb::does_crumb_exist(crumb));
+    EXPECT_EQ(k_vector_size(), 50);
+
+    std::remove(crumb.c_str());
+    (*nb.conn).exec("DROP TABLE STALE_TEST");
+}
+
+TEST(Chomp, SharedCatalogMatchesPrivateCatalog) {
+    Pantry::remove("/hoku-test-chomp");
+    Nibble nb("/tmp/nibble.db");
+    (*nb.conn).exec("DROP TABLE IF EXISTS SHARED_TEST");
+    Nibble::tuple_d rows;
+    for (int r = 0; r < 1000; r++) rows.insert(rows.end(), {static_cast<double>(r), r + 1.0, r * 0.01});
+    nb.create_table("SHARED_TEST", "label_a INT, label_b INT, theta FLOAT", "theta, label_a, label_b");
+    nb.bulk_insert_into_table("label_a, label_b, theta", rows);
+
+    // The first Chomp publishes the catalog, and the second attaches to it.
+    auto build = [] (const std::string &pantry_name) -> Chomp {
+        Chomp::Builder b = Chomp::Builder().with_database_name("/tmp/nibble.db").with_bright_name("HIP_BRIGHT")
+                .with_hip_name("HIP").using_k_vector("SHARED_TEST");
+        if (!pantry_name.empty()) b.using_shared_catalog(pantry_name);
+        return b.build();
+    };
+    Chomp ch = build(""), ch_p = build("/hoku-test-chomp");
+    ASSERT_NE(Pantry::open("/hoku-test-chomp"), nullptr);
+    Chomp ch_a = build("/hoku-test-chomp");
+    EXPECT_ANY_THROW(Chomp::Builder().with_database_name("/tmp/nibble-other.db").with_bright_name("HIP_BRIGHT")
+                             .with_hip_name("HIP").using_shared_catalog("/hoku-test-chomp").build());
+    std::remove("/tmp/nibble-other.db");
+
+    for (Chomp *c : {&ch_p, &ch_a}) {
+        EXPECT_EQ(c->bright_as_list().size(), ch.bright_as_list().size());
+        EXPECT_EQ(c->query_hip(3).get_label(), 3);
+        EXPECT_EQ(c->query_hip(88).get_vector(), ch.query_hip(88).get_vector());
+        EXPECT_EQ(c->find_hip(-1).error, Chomp::NO_STAR_FOUND_EITHER);
+        EXPECT_EQ(c->nearby_hip_stars(Vector3(0, 0, 1), 10, 100).size(),
+                  ch.nearby_hip_stars(Vector3(0, 0, 1), 10, 100).size());
+
+        KVector::Range r = c->k_vector("SHARED_TEST")->bound_query(1, 2);
+        EXPECT_EQ(r.end - r.begin, 101);
+        EXPECT_EQ(c->k_vector("SHARED_TEST")->labels(r.begin)[0], 100);
+    }
+    Pantry::remove("/hoku-test-chomp");
+    (*nb.conn).exec("DROP TABLE SHARED_TEST");
+}
+
+TEST(Chomp, StalePantryIsPublishedAgain) {
+    Pantry::remove("/hoku-test-chomp");
+    Nibble nb("/tmp/nibble.db");
+    (*nb.conn).exec("DROP TABLE IF EXISTS SHARED_TEST");
+    Nibble::tuple_d rows;
+    for (int r = 0; r < 100; r++) rows.insert(rows.end(), {static_cast<double>(r), r + 1.0, r * 0.01});
+    nb.create_table("SHARED_TEST", "label_a INT, label_b INT, theta FLOAT", "theta, label_a, label_b");
+    nb.bulk_insert_into_table("label_a, label_b, theta", rows);
+    auto k_vector_size = [] () -> unsigned int {
+        return Chomp::Builder().with_database_name("/tmp/nibble.db").with_bright_name("HIP_BRIGHT")
+                .with_hip_name("HIP").using_k_vector("SHARED_TEST").using_shared_catalog("/hoku-test-chomp")
+                .build().k_vector("SHARED_TEST")->size();
+    };
+
+    // A pantry that holds a table as it was before the table changed is replaced.
+    EXPECT_EQ(k_vector_size(), 100);
+    nb.select_table("SHARED_TEST");
+    nb.bulk_insert_into_table("label_a, label_b, theta", {500, 501, 5.0});
+    EXPECT_EQ(k_vector_size(), 101);
+    EXPECT_EQ(k_vector_size(), 101);
+
+    // So is a segment that is not a pantry (i.e. one left behind by a publisher of another version).
+    Pantry::remove("/hoku-test-chomp");
+    int fd = shm_open("/hoku-test-chomp", O_CREAT | O_EXCL | O_RDWR, 0644); // NOLINT(hicpp-signed-bitwise)
+    ASSERT_GE(fd, 0);
+    const uint32_t not_a_pantry[16] = {0, 0, 0, 0, 1};
+    ASSERT_EQ(write(fd, not_a_pantry, sizeof(not_a_pantry)), static_cast<ssize_t>(sizeof(not_a_pantry)));
+    close(fd);
+    EXPECT_EQ(k_vector_size(), 101);
+
+    Pantry::remove("/hoku-test-chomp");
+    (*nb.conn).exec("DROP TABLE SHARED_TEST");
+}
+
+TEST(Chomp, HandlesShareOneChompAcrossThreads) {
+    auto build = [] () -> std::shared_ptr<Chomp> {
+        return std::make_shared<Chomp>(Chomp::Builder().with_database_name("/tmp/nibble.db")
+                                               .with_bright_name("HIP_BRIGHT").with_hip_name("HIP").build());
+    };
+    std::shared_ptr<Chomp> ch = build(), ch_e = build();
+
+    // Find our expected answers with a Chomp of their own, on a single thread.
+    std::vector<std::vector<int>> expected_labels;
+    std::vector<unsigned long> expected_nearby;
+    ch_e->select_table("HIP");
+    for (int q = 0; q < 20; q++) {
+        Nibble::Results r;
+        ch_e->simple_bound_query({"i"}, "label", "", {-1 + 0.1 * q}, {-0.95 + 0.1 * q}, r);
+        expected_labels.emplace_back(r.ell.begin(), r.ell.begin() + r.size());
+        expected_nearby.push_back(ch_e->nearby_hip_stars(Vector3(q, 1, 1), 5, 100).size());
+    }
+
+    // Every thread searches through a handle of its own, and races the others to load our catalog and sky grid.
+    Chomp::Handle shared_handle(ch, "HIP");
+    EXPECT_EQ(shared_handle.get_table(), "HIP");
+    std::vector<int> n_mismatches(4, 0);
+    std::vector<std::thread> threads;
+    for (unsigned int t = 0; t < n_mismatches.size(); t++) {
+        threads.emplace_back([&, t] () -> void {
+            Chomp::Handle handle(ch, "HIP");
+            Nibble::Results r;
+            for (int q = 0; q < 20; q++) {
+                handle.bound_query(std::array<std::string, 1>{"i"}, "label", "", {-1 + 0.1 * q}, {-0.95 + 0.1 * q}, r);
+                n_mismatches[t] += std::vector<int>(r.ell.begin(), r.ell.begin() + r.size()) != expected_labels[q];
+                n_mismatches[t] += ch->nearby_hip_stars(Vector3(q, 1, 1), 5, 100).size() != expected_nearby[q];
+                n_mismatches[t] += ch->query_hip(expected_labels[q][0]).get_label() != expected_labels[q][0];
+            }
+        });
+    }
+    for (std::thread &t : threads) t.join();
+
+    EXPECT_EQ(n_mismatches, std::vector<int>(n_mismatches.size(), 0));
+    EXPECT_EQ(ch->get_hip_lookups(), 20 * n_mismatches.size());
+}
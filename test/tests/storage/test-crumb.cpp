@@ -0,0 +1,127 @@
+/// @file test-crumb.cpp
+/// @author Glenn Galvizo
+///
+/// Source file for all Crumb class unit tests.
+
+#define ENABLE_TESTING_ACCESS
+
+#include <cstdint>
+#include <fstream>
+#include "gtest/gtest.h"
+
+#include "storage/crumb.h"
+
+/// Create a small table with two labels and two features per row, in the shape of the reference tables.
+void create_crumb_table (Nibble &nb) {
+    (*nb.conn).exec("DROP TABLE IF EXISTS CRUMB_TEST");
+    nb.create_table("CRUMB_TEST", "label_a INT, label_b INT, theta FLOAT, phi FLOAT");
+    nb.select_table("CRUMB_TEST");
+
+    SQLite::Transaction transaction(*nb.conn);
+    for (int i = 0; i < 100; i++) {
+        nb.insert_into_table("label_a, label_b, theta, phi", Nibble::tuple_d{
+                static_cast<double>(i), static_cast<double>(-i), i * 0.5, i * 0.25
+        });
+    }
+    transaction.commit();
+}
+
+TEST(Crumb, WriteAndOpen) {
+    Nibble nb("/tmp/nibble.db");
+    create_crumb_table(nb);
+    std::string path = Crumb::path_for("/tmp/nibble.db", "CRUMB_TEST");
+    EXPECT_EQ(path, "/tmp/nibble.db.CRUMB_TEST.crumb");
+
+    EXPECT_EQ(Crumb::write(nb, "CRUMB_TEST", path), 0);
+    EXPECT_TRUE(Crumb::does_crumb_exist(path));
+    std::shared_ptr<Crumb> cr = Crumb::open(path);
+
+    EXPECT_EQ(cr->size(), 100);
+    EXPECT_EQ(cr->get_n_labels(), 2);
+    EXPECT_EQ(cr->get_n_features(), 2);
+    EXPECT_EQ(cr->label_column("label_b"), 1);
+    EXPECT_EQ(cr->feature_column("phi"), 1);
+    EXPECT_EQ(cr->feature_column("label_a"), Crumb::NO_COLUMN_FOUND);
+
+    // Every block must be aligned, and rows must keep their order.
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(cr->labels()) % Crumb::ALIGNMENT, 0);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(cr->features(1)) % Crumb::ALIGNMENT, 0);
+    for (unsigned int r = 0; r < 100; r++) {
+        EXPECT_EQ(cr->labels(r)[0], static_cast<int>(r));
+        EXPECT_EQ(cr->labels(r)[1], -static_cast<int>(r));
+        EXPECT_DOUBLE_EQ(cr->features(0)[r], r * 0.5);
+        EXPECT_DOUBLE_EQ(cr->features(1)[r], r * 0.25);
+    }
+
+    std::remove(path.c_str());
+    (*nb.conn).exec("DROP TABLE IF EXISTS CRUMB_TEST");
+}
+
+TEST(Crumb, StaleOnceTableChanges) {
+    Nibble nb("/tmp/nibble.db");
+    create_crumb_table(nb);
+    std::string path = Crumb::path_for("/tmp/nibble.db", "CRUMB_TEST");
+    Crumb::write(nb, "CRUMB_TEST", path);
+    EXPECT_TRUE(Crumb::is_crumb_current(path, nb.fingerprint("CRUMB_TEST")));
+    EXPECT_EQ(Crumb::open(path)->get_fingerprint(), nb.fingerprint("CRUMB_TEST"));
+
+    // A table that gains a row no longer matches its crumb.
+    nb.insert_into_table("label_a, label_b, theta, phi", Nibble::tuple_d{100, -100, 50, 25});
+    EXPECT_FALSE(Crumb::is_crumb_current(path, nb.fingerprint("CRUMB_TEST")));
+
+    // Recreating a table removes its crumb. A crumb of the old table never matches the new one, even if both have the
+    // same schema and rows.
+    Crumb::write(nb, "CRUMB_TEST", path);
+    const uint64_t old_fingerprint = nb.fingerprint("CRUMB_TEST");
+    (*nb.conn).exec("DROP TABLE CRUMB_TEST");
+    nb.create_table("CRUMB_TEST", "label_a INT, label_b INT, theta FLOAT, phi FLOAT");
+    EXPECT_FALSE(Crumb::does_crumb_exist(path));
+    EXPECT_NE(nb.fingerprint("CRUMB_TEST"), old_fingerprint);
+
+    // A bulk insert stamps the table again as well, without its fingerprint ever counting rows.
+    Crumb::write(nb, "CRUMB_TEST", path);
+    EXPECT_TRUE(Crumb::is_crumb_current(path, nb.fingerprint("CRUMB_TEST")));
+    nb.bulk_insert_into_table("label_a, label_b, theta, phi", Nibble::tuple_d{1, -1, 0.5, 0.25, 2, -2, 1, 0.5});
+    EXPECT_FALSE(Crumb::does_crumb_exist(path));
+    EXPECT_FALSE(Crumb::is_crumb_current(path, nb.fingerprint("CRUMB_TEST")));
+
+    (*nb.conn).exec("DROP TABLE IF EXISTS CRUMB_TEST");
+}
+
+TEST(Crumb, OpenInvalidFile) {
+    EXPECT_ANY_THROW(Crumb::open("/tmp/does-not-exist.crumb"));
+
+    std::ofstream out("/tmp/invalid.crumb", std::ios::binary);
+    out << "This is not a crumb file, but it is long enough to hold the header of one.";
+    out.close();
+    EXPECT_ANY_THROW(Crumb::open("/tmp/invalid.crumb"));
+    std::remove("/tmp/invalid.crumb");
+}
+
+/// Check that a header whose blocks overlap, run past the end of the file, or overflow their offsets is rejected.
+TEST(Crumb, OpenCorruptHeader) {
+    Nibble nb("/tmp/nibble.db");
+    create_crumb_table(nb);
+    const std::string path = "/tmp/corrupt.crumb";
+    Crumb::write(nb, "CRUMB_TEST", path);
+    EXPECT_NO_THROW(Crumb::open(path));
+
+    // Each case is (byte offset of the header field, value written there).
+    const uint64_t huge = UINT64_MAX - 7;
+    for (const std::pair<std::streamoff, uint64_t> &field : std::vector<std::pair<std::streamoff, uint64_t>>{
+            {16, 1000000}, {24, 1ULL << 62}, {24, 200}, {40, huge}, {48, huge}, {56, 8}, {56, huge}}) {
+        Crumb::write(nb, "CRUMB_TEST", path);
+        std::fstream f(path, std::ios::binary | std::ios::in | std::ios::out);
+        f.seekp(field.first);
+        if (field.first == 16) {
+            const auto n = static_cast<uint32_t>(field.second);
+            f.write(reinterpret_cast<const char *>(&n), sizeof(n));
+        }
+        else f.write(reinterpret_cast<const char *>(&field.second), sizeof(field.second));
+        f.close();
+        EXPECT_ANY_THROW(Crumb::open(path)) << "Field at byte " << field.first << ".";
+    }
+
+    std::remove(path.c_str());
+    (*nb.conn).exec("DROP TABLE IF EXISTS CRUMB_TEST");
+}
@@ -0,0 +1,75 @@
+/// @file test-feature-grid.cpp
+/// @author Glenn Galvizo
+///
+/// Source file for all FeatureGrid class unit tests.
+
+#define ENABLE_TESTING_ACCESS
+
+#include <algorithm>
+#include "gtest/gtest.h"
+
+#include "math/random-draw.h"
+#include "storage/feature-grid.h"
+
+TEST(FeatureGrid, BoundQueryMatchesLinearSearch) {
+    std::array<std::vector<double>, 3> y;
+    std::vector<int> ell;
+    for (int r = 0; r < 10000; r++) {
+        y[0].push_back(RandomDraw::draw_real(0, 20)), y[1].push_back(RandomDraw::draw_real(0, 20));
+        y[2].push_back(RandomDraw::draw_real(0, 180));
+        ell.insert(ell.end(), {r, -r, 2 * r});
+    }
+
+    for (const unsigned int occupancy : {1u, FeatureGrid::DEFAULT_OCCUPANCY, 20000u}) {
+        FeatureGrid fg({y[0].data(), y[1].data(), y[2].data()}, ell.data(), 10000, 3, occupancy);
+        std::vector<unsigned int> out;
+
+        for (int q = 0; q < 200; q++) {
+            std::array<double, 3> y_a, y_b;
+            for (unsigned int d = 0; d < 3; d++) {
+                double y_d = RandomDraw::draw_real(-1, (d == 2) ? 181 : 21), w = RandomDraw::draw_real(0, 3);
+                y_a[d] = y_d - w, y_b[d] = y_d + w;
+            }
+
+            std::vector<int> expected;
+            for (int r = 0; r < 10000; r++) {
+                if (y[0][r] >= y_a[0] && y[0][r] <= y_b[0] && y[1][r] >= y_a[1] && y[1][r] <= y_b[1] &&
+                    y[2][r] >= y_a[2] && y[2][r] <= y_b[2]) {
+                    expected.push_back(r);
+                }
+            }
+
+            // Entries are returned in row order, and carry the labels of their row.
+            unsigned int n = fg.bound_query(y_a, y_b, out);
+            ASSERT_EQ(n, expected.size());
+            for (unsigned int j = 0; j < n; j++) {
+                EXPECT_EQ(fg.row(out[j]), static_cast<unsigned int>(expected[j]));
+                EXPECT_EQ(fg.labels(out[j])[0], expected[j]);
+                EXPECT_EQ(fg.labels(out[j])[2], 2 * expected[j]);
+            }
+        }
+    }
+}
+
+TEST(FeatureGrid, BoundQueryBoundsAreInclusive) {
+    std::array<std::vector<double>, 3> y = {std::vector<double>{0, 1, 2, 3}, std::vector<double>{0, 1, 2, 3},
+                                            std::vector<double>{0, 1, 2, 3}};
+    std::vector<int> ell = {0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3};
+    FeatureGrid fg({y[0].data(), y[1].data(), y[2].data()}, ell.data(), 4, 3, 1);
+    std::vector<unsigned int> out;
+
+    EXPECT_EQ(fg.bound_query({1, 1, 1}, {3, 3, 3}, out), 3);
+    EXPECT_EQ(fg.bound_query({3, 3, 3}, {3, 3, 3}, out), 1);
+    EXPECT_EQ(fg.labels(out[0])[0], 3);
+    EXPECT_EQ(fg.bound_query({3, 3, 3}, {1, 1, 1}, out), 0);
+    EXPECT_EQ(fg.bound_query({4, 4, 4}, {5, 5, 5}, out), 0);
+    EXPECT_EQ(fg.bound_query({-2, -2, -2}, {-1, -1, -1}, out), 0);
+}
+
+TEST(FeatureGrid, Empty) {
+    FeatureGrid fg({nullptr, nullptr, nullptr}, nullptr, 0, 3);
+    std::vector<unsigned int> out = {1};
+    EXPECT_EQ(fg.get_n_cells(), 1);
+    EXPECT_EQ(fg.bound_query({0, 0, 0}, {1, 1, 1}, out), 0);
+    EXPECT_TRUE(out.empty());
+}
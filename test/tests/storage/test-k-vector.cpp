@@ -0,0 +1,61 @@
+/// @file test-k-vector.cpp
+/// @author Glenn Galvizo
+///
+/// Source file for all KVector class unit tests.
+
+#define ENABLE_TESTING_ACCESS
+
+#include <algorithm>
+#include "gtest/gtest.h"
+
+#include "math/random-draw.h"
+#include "storage/k-vector.h"
+
+/// Build a k-vector over n random keys in [0, 20). Each row is labeled with its sorted position.
+KVector random_k_vector (const unsigned int n, std::vector<double> &y) {
+    std::vector<int> ell;
+
+    y.clear();
+    for (unsigned int i = 0; i < n; i++) y.push_back(RandomDraw::draw_real(0, 20));
+    std::sort(y.begin(), y.end());
+    for (unsigned int i = 0; i < n; i++) ell.push_back(static_cast<int>(i)), ell.push_back(-static_cast<int>(i));
+
+    return KVector(y, ell, 2);
+}
+
+TEST(KVector, ConstructorUnsortedOrMismatched) {
+    EXPECT_ANY_THROW(KVector({1, 0}, {0, 0, 1, 1}, 2));
+    EXPECT_ANY_THROW(KVector({0, 1}, {0, 0, 1}, 2));
+    EXPECT_NO_THROW(KVector({}, {}, 2));
+}
+
+TEST(KVector, BoundQueryMatchesLinearSearch) {
+    std::vector<double> y;
+    KVector kv = random_k_vector(10000, y);
+
+    for (int i = 0; i < 1000; i++) {
+        double theta = RandomDraw::draw_real(-1, 21), epsilon = RandomDraw::draw_real(0, 0.1);
+        KVector::Range r = kv.bound_query(theta - epsilon, theta + epsilon);
+
+        auto count = std::count_if(y.begin(), y.end(), [&theta, &epsilon] (const double y_i) -> bool {
+            return theta - epsilon <= y_i && y_i <= theta + epsilon;
+        });
+        EXPECT_EQ(r.end - r.begin, count);
+        for (unsigned int j = r.begin; j < r.end; j++) {
+            EXPECT_LE(theta - epsilon, kv.key(j));
+            EXPECT_GE(theta + epsilon, kv.key(j));
+            EXPECT_EQ(kv.labels(j)[0], static_cast<int>(j));
+        }
+    }
+}
+
+TEST(KVector, BoundQueryInclusiveBounds) {
+    KVector kv({1, 2, 2, 2, 3, 5}, {1, 2, 3, 4, 5, 6}, 1);
+    KVector::Range r_1 = kv.bound_query(2, 2), r_2 = kv.bound_query(1, 5), r_3 = kv.bound_query(3.5, 4.5);
+
+    EXPECT_EQ(r_1.begin, 1);
+    EXPECT_EQ(r_1.end, 4);
+    EXPECT_EQ(r_2.end - r_2.begin, 6);
+    EXPECT_EQ(r_3.begin, r_3.end);
+    EXPECT_EQ(kv.bound_query(6, 7).end, 0);
+}
@@ -241,3 +241,150 @@ TEST(Nibble, TableInsertion) {
         std::cout << "Exception: " << e.what() << std::endl;
     }
 }
+
+TEST(Nibble, SearchBoundValues) {
+    Nibble nb("/tmp/nibble.db");
+    (*nb.conn).exec("DROP TABLE IF EXISTS BOUND_TEST");
+    nb.create_table("BOUND_TEST", "label INT, theta FLOAT");
+    for (int i = 0; i < 10; i++) nb.insert_into_table("label, theta", Nibble::tuple_d{static_cast<double>(i), i * 0.5});
+
+    // The same constraint is run with different values, which must not leak between searches.
+    Nibble::tuples_d a = nb.search_table("label", "theta BETWEEN ? AND ?", {1.0, 2.0}, 3);
+    Nibble::tuples_d b = nb.search_table("label", "theta BETWEEN ? AND ?", {3.5, 10.0}, 3);
+    Nibble::Either c = nb.search_single("theta", "label = ?", {4});
+    Nibble::Either d = nb.search_single("theta", "label = ?", {100});
+
+    ASSERT_EQ(a.size(), 3);
+    EXPECT_EQ(a[0][0], 2);
+    EXPECT_EQ(a[2][0], 4);
+    ASSERT_EQ(b.size(), 3);
+    EXPECT_EQ(b[0][0], 7);
+    EXPECT_EQ(c.error, 0);
+    EXPECT_DOUBLE_EQ(c.result, 2.0);
+    EXPECT_EQ(d.error, Nibble::NO_RESULT_FOUND_EITHER);
+
+    // Cached statements must not hold any locks once a search has returned.
+    EXPECT_NO_THROW((*nb.conn).exec("DROP TABLE BOUND_TEST"));
+}
+
+TEST(Nibble, SearchIntoResults) {
+    Nibble nb("/tmp/nibble.db");
+    Nibble::Results r;
+    (*nb.conn).exec("DROP TABLE IF EXISTS RESULTS_TEST");
+    nb.create_table("RESULTS_TEST", "label_a INT, label_b INT, theta FLOAT");
+    for (int i = 0; i < 10; i++) {
+        nb.insert_into_table("label_a, label_b, theta", Nibble::tuple_d{static_cast<double>(i), -i * 1.0, i * 0.5});
+    }
+
+    EXPECT_EQ(nb.search_table("label_a, label_b", "theta", "theta BETWEEN ? AND ?", {1.0, 2.0}, r), 3);
+    EXPECT_EQ(r.n_labels, 2);
+    EXPECT_EQ(r.n_features, 1);
+    for (unsigned int i = 0; i < r.size(); i++) {
+        EXPECT_EQ(r.labels(i)[0], static_cast<int>(i + 2));
+        EXPECT_EQ(r.labels(i)[1], -static_cast<int>(i + 2));
+        EXPECT_DOUBLE_EQ(r.features(i)[0], (i + 2) * 0.5);
+    }
+
+    // A smaller search must reuse the same buffer without reallocating it.
+    const int *ell = r.ell.data();
+    EXPECT_EQ(nb.search_table("label_a", "", "theta BETWEEN ? AND ?", {0.0, 0.0}, r), 1);
+    EXPECT_EQ(r.labels(0)[0], 0);
+    EXPECT_EQ(r.ell.data(), ell);
+    EXPECT_EQ(nb.search_table("label_a", "", "theta BETWEEN ? AND ?", {100.0, 200.0}, r), 0);
+    EXPECT_TRUE(r.empty());
+
+    (*nb.conn).exec("DROP TABLE RESULTS_TEST");
+}
+
+TEST(Nibble, BulkInsertClusteredTable) {
+    Nibble nb("/tmp/nibble.db");
+    Nibble::tuple_d rows;
+    (*nb.conn).exec("DROP TABLE IF EXISTS BULK_TEST");
+
+    EXPECT_EQ(nb.create_table("BULK_TEST", "label_a INT, theta FLOAT", "theta, label_a"), 0);
+    EXPECT_EQ(nb.create_table("BULK_TEST", "label_a INT, theta FLOAT", "theta, label_a"),
+              Nibble::TABLE_NOT_CREATED_RET);
+    EXPECT_ANY_THROW(nb.bulk_insert_into_table("label_a, theta", {1, 2, 3}));
+
+    // Insert more rows than fit in one batch, in reverse order. The table must still be read back in key order.
+    for (int i = 200; i > 0; i--) rows.push_back(i), rows.push_back(i * 0.5);
+    EXPECT_EQ(nb.bulk_insert_into_table("label_a, theta", rows), 0);
+
+    Nibble::tuples_d a = nb.search_table("label_a, theta", 300);
+    ASSERT_EQ(a.size(), 200);
+    for (unsigned int i = 0; i < a.size(); i++) {
+        EXPECT_EQ(a[i][0], i + 1);
+        EXPECT_DOUBLE_EQ(a[i][1], (i + 1) * 0.5);
+    }
+
+    // Our pragmas must be restored after loading.
+    EXPECT_NE((*nb.conn).execAndGet("PRAGMA synchronous").getInt(), 0);
+    (*nb.conn).exec("DROP TABLE BULK_TEST");
+}
+
+TEST(Nibble, InMemoryCopy) {
+    Nibble nb("/tmp/nibble.db");
+    (*nb.conn).exec("DROP TABLE IF EXISTS MEMORY_TEST");
+    nb.create_table("MEMORY_TEST", "label_a INT, theta FLOAT", "theta, label_a");
+    nb.bulk_insert_into_table("label_a, theta", {1, 0.5, 2, 1.0, 3, 1.5});
+
+    // The copy must hold every table of the file, and writes to the copy must never reach the file.
+    Nibble nb_m("/tmp/nibble.db", true);
+    nb_m.select_table("MEMORY_TEST");
+    EXPECT_EQ(nb_m.search_table("label_a", "theta > ?", {0.75}, 3), (Nibble::tuples_d{{2}, {3}}));
+    (*nb_m.conn).exec("DELETE FROM MEMORY_TEST");
+    EXPECT_TRUE(nb_m.search_table("label_a", 3).empty());
+    nb.select_table("MEMORY_TEST");
+    EXPECT_EQ(nb.search_table("label_a", 3).size(), 3);
+
+    EXPECT_ANY_THROW(Nibble("/tmp/nibble-does-not-exist.db", true));
+    (*nb.conn).exec("DROP TABLE MEMORY_TEST");
+}
+
+/// Exposes the reconnection of Nibble to our tests.
+struct Reconnecting : public Nibble {
+    Reconnecting (const std::string &database_name, const bool in_memory) : Nibble(database_name, in_memory) {}
+    using Nibble::reconnect;
+};
+
+TEST(Nibble, ReconnectSharesInMemoryCopy) {
+    Nibble nb("/tmp/nibble.db");
+    (*nb.conn).exec("DROP TABLE IF EXISTS MEMORY_TEST");
+    nb.create_table("MEMORY_TEST", "label_a INT, theta FLOAT", "theta, label_a");
+    nb.bulk_insert_into_table("label_a, theta", {1, 0.5, 2, 1.0, 3, 1.5});
+
+    // A reconnected copy has a connection of its own, but reads the same in-memory copy (which is never made again).
+    Reconnecting nb_m("/tmp/nibble.db", true), nb_other("/tmp/nibble.db", true);
+    Reconnecting nb_r = nb_m;
+    nb_r.reconnect();
+    EXPECT_NE(nb_r.conn, nb_m.conn);
+    (*nb_m.conn).exec("DELETE FROM MEMORY_TEST WHERE label_a = 1");
+    nb_r.select_table("MEMORY_TEST"), nb_other.select_table("MEMORY_TEST");
+    EXPECT_EQ(nb_r.search_table("label_a", 3), (Nibble::tuples_d{{2}, {3}}));
+    EXPECT_EQ(nb_other.search_table("label_a", 3).size(), 3);
+
+    // Our copy lives for as long as any connection to it does.
+    nb_m.conn.reset();
+    EXPECT_EQ(nb_r.search_table("label_a", 3).size(), 2);
+    (*nb.conn).exec("DROP TABLE MEMORY_TEST");
+}
+
+/// Exposes the statement cache of Nibble to our tests.
+struct StatementCache : public Nibble {
+    explicit StatementCache (const std::string &database_name) : Nibble(database_name) {}
+    using Nibble::prepare;
+};
+
+TEST(Nibble, PreparedStatementOutlivesCache) {
+    StatementCache nb("/tmp/nibble.db");
+    std::shared_ptr<SQLite::Statement> held = nb.prepare("SELECT ?");
+    EXPECT_EQ(nb.prepare("SELECT ?"), held);
+
+    // Fill our cache past its limit, so it is emptied while our statement is still held.
+    for (unsigned int i = 0; i <= Nibble::STATEMENT_CACHE_LIMIT; i++) nb.prepare("SELECT " + std::to_string(i));
+    held->bind(1, 7);
+    ASSERT_TRUE(held->executeStep());
+    EXPECT_EQ(held->getColumn(0).getInt(), 7);
+    held->reset();
+    EXPECT_NE(nb.prepare("SELECT ?"), held);
+}
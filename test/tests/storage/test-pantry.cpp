@@ -0,0 +1,85 @@
+/// @file test-pantry.cpp
+/// @author Glenn Galvizo
+///
+/// Source file for all Pantry class unit tests.
+
+#define ENABLE_TESTING_ACCESS
+
+#include "gtest/gtest.h"
+
+#include "storage/pantry.h"
+#include "storage/k-vector.h"
+#include "storage/bucket-index.h"
+#include "storage/feature-grid.h"
+
+TEST(Pantry, PublishAndOpen) {
+    Pantry::remove("/hoku-test-pantry");
+    EXPECT_EQ(Pantry::open("/hoku-test-pantry"), nullptr);
+
+    std::vector<double> y = {1.5, 2.5, 3.5};
+    EXPECT_EQ(Pantry::publish("/hoku-test-pantry", {Pantry::shelf_of("y", y.data(), y.size()),
+                                                    Pantry::shelf_of("ell", std::vector<int>{7, 8, 9}),
+                                                    Pantry::shelf_of("empty", std::vector<int>{})}), 0);
+    EXPECT_EQ(Pantry::publish("/hoku-test-pantry", {}), Pantry::SEGMENT_EXISTS);
+
+    std::shared_ptr<Pantry> p = Pantry::open("/hoku-test-pantry");
+    ASSERT_NE(p, nullptr);
+    uint64_t n;
+    const double *p_y = p->shelf<double>("y", n);
+    EXPECT_EQ(n, 3);
+    EXPECT_EQ(std::vector<double>(p_y, p_y + n), y);
+    EXPECT_EQ(p->shelf<int>("ell", n)[1], 8);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(p->shelf<int>("ell", n)) % Pantry::ALIGNMENT, 0);
+    p->shelf<int>("empty", n);
+    EXPECT_EQ(n, 0);
+    EXPECT_FALSE(p->has_shelf("theta"));
+    EXPECT_ANY_THROW(p->shelf<double>("theta", n));
+    EXPECT_ANY_THROW(p->shelf<double>("ell", n));
+
+    // Attached processes keep their mapping after the segment is removed.
+    EXPECT_EQ(Pantry::remove("/hoku-test-pantry"), 0);
+    EXPECT_EQ(p->shelf<double>("y", n)[2], 3.5);
+    EXPECT_EQ(Pantry::open("/hoku-test-pantry"), nullptr);
+}
+
+TEST(Pantry, AttachedIndicesMatchBuiltIndices) {
+    std::vector<double> y_1, y_2, y_3;
+    std::vector<int> ell;
+    for (int r = 0; r < 2000; r++) {
+        y_1.push_back(r * 0.01), y_2.push_back((r * 37 % 2000) * 0.01), y_3.push_back((r * 91 % 2000) * 0.01);
+        ell.insert(ell.end(), {r, r + 1, r + 2});
+    }
+    std::vector<int> ell_2;
+    for (int r = 0; r < 2000; r++) ell_2.insert(ell_2.end(), {r, -r});
+
+    KVector kv(y_1, ell_2, 2);
+    BucketIndex bi(y_1, y_2, ell, 3, 16);
+    FeatureGrid fg({y_1.data(), y_2.data(), y_3.data()}, ell.data(), 2000, 3);
+    std::vector<Pantry::Shelf> shelves = kv.shelves("kv/"), bi_s = bi.shelves("bi/"), fg_s = fg.shelves("fg/");
+    shelves.insert(shelves.end(), bi_s.begin(), bi_s.end()), shelves.insert(shelves.end(), fg_s.begin(), fg_s.end());
+
+    Pantry::remove("/hoku-test-pantry");
+    ASSERT_EQ(Pantry::publish("/hoku-test-pantry", shelves), 0);
+    std::shared_ptr<Pantry> p = Pantry::open("/hoku-test-pantry");
+    Pantry::remove("/hoku-test-pantry");
+    KVector kv_a = KVector::attach(p, "kv/");
+    BucketIndex bi_a = BucketIndex::attach(p, "bi/");
+    FeatureGrid fg_a = FeatureGrid::attach(p, "fg/");
+    EXPECT_ANY_THROW(KVector::attach(p, "fg/"));
+
+    std::vector<unsigned int> out, out_a;
+    for (double y = -1; y < 21; y += 0.37) {
+        KVector::Range r = kv.bound_query(y, y + 0.5), r_a = kv_a.bound_query(y, y + 0.5);
+        EXPECT_EQ(r.begin, r_a.begin);
+        EXPECT_EQ(r.end, r_a.end);
+        if (r.begin != r.end) {
+            EXPECT_EQ(kv.labels(r.begin)[1], kv_a.labels(r_a.begin)[1]);
+        }
+
+        bi.bound_query(y, y + 2, y - 1, y + 1, out), bi_a.bound_query(y, y + 2, y - 1, y + 1, out_a);
+        EXPECT_EQ(out, out_a);
+        fg.bound_query({y, y - 1, 0}, {y + 2, y + 1, 10}, out);
+        fg_a.bound_query({y, y - 1, 0}, {y + 2, y + 1, 10}, out_a);
+        EXPECT_EQ(out, out_a);
+    }
+}
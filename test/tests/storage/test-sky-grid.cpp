@@ -0,0 +1,68 @@
+/// @file test-sky-grid.cpp
+/// @author Glenn Galvizo
+///
+/// Source file for all SkyGrid class unit tests.
+
+#define ENABLE_TESTING_ACCESS
+
+#include "gtest/gtest.h"
+
+#include "storage/sky-grid.h"
+
+/// @return Indices of all stars within theta degrees of the focus, found by checking every star.
+std::vector<unsigned int> linear_cone_query (const Star::list &stars, const Vector3 &focus, const double theta) {
+    std::vector<unsigned int> nearby;
+    for (unsigned int i = 0; i < stars.size(); i++) {
+        if (Star::within_angle(focus, stars[i], theta)) nearby.push_back(i);
+    }
+    return nearby;
+}
+
+TEST(SkyGrid, ConeQueryMatchesLinearSearch) {
+    Star::list stars;
+    for (int i = 0; i < 5000; i++) stars.push_back(Star::chance(i));
+    SkyGrid grid(stars);
+
+    for (const double theta : {0.5, 7.5, 20.0, 75.0, 180.0}) {
+        for (int i = 0; i < 20; i++) {
+            Star focus = Star::chance();
+            EXPECT_EQ(grid.cone_query(focus, theta), linear_cone_query(stars, focus, theta));
+        }
+    }
+}
+
+TEST(SkyGrid, ConeQueryAcrossFaces) {
+    Star::list stars;
+    for (int i = 0; i < 5000; i++) stars.push_back(Star::chance(i));
+    SkyGrid grid(stars, 8);
+
+    // A cube corner and a cube edge touch three and two faces respectively.
+    for (const Vector3 &focus : {Vector3(1, 1, 1), Vector3(-1, 0, 1), Vector3(0, 0, -1)}) {
+        EXPECT_EQ(grid.cone_query(focus, 10), linear_cone_query(stars, focus, 10));
+    }
+}
+
+TEST(SkyGrid, ConeQueryEmpty) {
+    SkyGrid grid(Star::list{});
+    EXPECT_EQ(grid.get_n_cells(), 6 * SkyGrid::DEFAULT_N * SkyGrid::DEFAULT_N);
+    EXPECT_TRUE(grid.cone_query(Vector3(0, 0, 1), 20).empty());
+
+    SkyGrid grid_2(Star::list{Star(0, 0, 1)});
+    EXPECT_EQ(grid_2.cone_query(Vector3(0, 0, 1), 1).size(), 1);
+    EXPECT_TRUE(grid_2.cone_query(Vector3(0, 0, -1), 1).empty());
+}
+
+TEST(SkyGrid, ConeQueryNearFaceBorders) {
+    Star::list stars;
+    for (int i = 0; i < 20000; i++) stars.push_back(Star::chance(i));
+    SkyGrid grid(stars, 32);
+
+    // Foci near the edges and corners of the cube, with cones up to and past the width of a face.
+    for (const double theta : {0.1, 2.0, 30.0, 50.0, 89.0, 95.0}) {
+        for (int i = 0; i < 50; i++) {
+            Star focus = Star::chance(), edge = Star::wrap(Vector3(1, 1, focus[2] * 0.1) * ((i % 2 == 0) ? 1.0 : -1.0));
+            EXPECT_EQ(grid.cone_query(focus, theta), linear_cone_query(stars, focus, theta));
+            EXPECT_EQ(grid.cone_query(edge, theta), linear_cone_query(stars, edge, theta));
+        }
+    }
+}
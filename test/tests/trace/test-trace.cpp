@@ -0,0 +1,78 @@
+/// @file test-trace.cpp
+/// @author Glenn Galvizo
+///
+/// Source file for all Trace namespace unit tests.
+
+#include <sstream>
+#include <thread>
+
+#include "gtest/gtest.h"
+
+#include "trace/trace.h"
+
+/// Check that a line is built from each of its operands, and is truncated instead of overflowing.
+TEST(Trace, LineFormatsAndTruncates) {
+    Trace::Line a;
+    a << "Pair [" << 3 << "," << 4u << "] " << -5L << " " << 6UL << " " << 0.5 << std::string("!");
+    EXPECT_STREQ(a.text(), "Pair [3,4] -5 6 0.5!");
+
+    Trace::Line b;
+    for (int i = 0; i < 50; i++) b << "abcdef" << i;
+    EXPECT_EQ(b.size(), Trace::Line::TEXT_SIZE - 1);
+    EXPECT_EQ(std::string(b.text()).size(), Trace::Line::TEXT_SIZE - 1);
+}
+
+/// Check that records are flushed once each, oldest first, with their category.
+TEST(Trace, FlushKeepsRecordOrder) {
+    std::ostringstream discard;
+    Trace::flush(discard);
+
+    for (int i = 0; i < 3; i++) {
+        Trace::Line line;
+        line << "Record " << i;
+        Trace::record(Trace::INFO, (i == 1) ? Trace::PYRAMID : Trace::ANGLE, line);
+    }
+
+    std::ostringstream os;
+    EXPECT_EQ(Trace::flush(os), 3u);
+    EXPECT_EQ(os.str(), "[ANGLE] Record 0\n[PYRAMID] Record 1\n[ANGLE] Record 2\n");
+
+    std::ostringstream empty;
+    EXPECT_EQ(Trace::flush(empty), 0u);
+    EXPECT_EQ(empty.str(), "");
+}
+
+/// Check that records from many threads are all flushed, and that an overfull buffer only drops its oldest records.
+TEST(Trace, ConcurrentRecordsAreKeptOrDropped) {
+    std::ostringstream discard;
+    Trace::flush(discard);
+    const uint64_t n_dropped = Trace::count_dropped();
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([t] () -> void {
+            for (int i = 0; i < 1000; i++) {
+                Trace::Line line;
+                line << "Thread " << t << " record " << i;
+                Trace::record(Trace::VERBOSE, Trace::DOT, line);
+            }
+        });
+    }
+    for (std::thread &t : threads) t.join();
+
+    std::ostringstream os;
+    EXPECT_EQ(Trace::flush(os), 4000u);
+    EXPECT_EQ(Trace::count_dropped(), n_dropped);
+
+    const uint64_t n_over = 2 * Trace::CAPACITY;
+    for (uint64_t i = 0; i < n_over; i++) {
+        Trace::Line line;
+        line << "Overflow " << static_cast<unsigned long>(i);
+        Trace::record(Trace::WARNING, Trace::EXPERIMENT, line);
+    }
+    std::ostringstream over;
+    EXPECT_EQ(Trace::flush(over), Trace::CAPACITY);
+    EXPECT_EQ(Trace::count_dropped(), n_dropped + n_over - Trace::CAPACITY);
+    EXPECT_EQ(over.str().substr(0, over.str().find('\n')),
+              "[EXPERIMENT] Overflow " + std::to_string(n_over - Trace::CAPACITY));
+}